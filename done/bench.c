@@ -0,0 +1,54 @@
+/**
+ * @file bench.c
+ * @brief Helpers shared by the benchmarks
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "bench.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*******************************************************************
+ * Monotonic time, in milliseconds
+ */
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+/*******************************************************************
+ * Reads a whole file; the content is to be freed by the caller
+ */
+int load_file(const char* path, void** content, size_t* size)
+{
+    M_REQUIRE_NON_NULL(path);
+    M_REQUIRE_NON_NULL(content);
+    M_REQUIRE_NON_NULL(size);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return ERR_IO;
+
+    int err = ERR_IO;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        const long end = ftell(file);
+        if (end > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            *size = (size_t) end;
+            *content = malloc(*size);
+            if (*content == NULL) {
+                err = ERR_OUT_OF_MEMORY;
+            } else if (fread(*content, 1, *size, file) == *size) {
+                err = ERR_NONE;
+            } else {
+                free(*content);
+            }
+        }
+    }
+    fclose(file);
+    return err;
+}
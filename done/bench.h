@@ -0,0 +1,33 @@
+/**
+ * @file bench.h
+ * @brief Helpers shared by the benchmarks (resize-bench, codec-bench).
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#pragma once
+
+#include <stddef.h> // for size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Monotonic time, in milliseconds.
+ */
+double now_ms(void);
+
+/**
+ * @brief Reads a whole file.
+ *
+ * @param path The path of the file
+ * @param content Set to its content, to be freed by the caller
+ * @param size Set to its size
+ * @return Some error code. 0 if no error.
+ */
+int load_file(const char* path, void** content, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
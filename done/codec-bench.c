@@ -0,0 +1,96 @@
+/**
+ * @file codec-bench.c
+ * @brief Compares the resized variants in JPEG and in WebP, per image and
+ *        per resolution: bytes to send, and latency of creating them.
+ *
+ * Usage: codec-bench <iterations> <JPEG files...>
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "image_content.h"
+#include "bench.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vips/vips.h>
+
+#define DEFAULT_THUMB_RES 64
+#define DEFAULT_SMALL_RES 256
+
+/*******************************************************************
+ * Mean latency, in milliseconds, of creating one variant in one codec
+ */
+static int time_codec(enum image_codec codec, uint16_t width, uint16_t height, void* original,
+                      size_t original_size, int iterations, double* latency, size_t* resized_size)
+{
+    void* resized = NULL;
+    // Once beforehand, so that both codecs start warm
+    int err = resize_content(original, original_size, width, height, codec, &resized, resized_size);
+    g_free(resized);
+
+    const double start = now_ms();
+    for (int i = 0; i < iterations && err == ERR_NONE; ++i) {
+        resized = NULL;
+        err = resize_content(original, original_size, width, height, codec, &resized, resized_size);
+        g_free(resized);
+    }
+    *latency = (now_ms() - start) / iterations;
+    return err;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <iterations> <JPEG files...>\n", argv[0]);
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+    const int iterations = atoi(argv[1]);
+    if (iterations <= 0) return ERR_INVALID_ARGUMENT;
+
+    if (VIPS_INIT(argv[0])) {
+        return ERR_IMGLIB;
+    }
+
+    static const char* const names[] = { "thumb", "small" };
+    static const uint16_t sides[] = { DEFAULT_THUMB_RES, DEFAULT_SMALL_RES };
+    printf("%-32s %-6s %10s %10s %7s %10s %10s\n", "image", "res", "jpeg(B)", "webp(B)", "saved",
+           "jpeg(ms)", "webp(ms)");
+
+    int err = ERR_NONE;
+    for (int i = 2; i < argc && err == ERR_NONE; ++i) {
+        void* original = NULL;
+        size_t original_size = 0;
+        err = load_file(argv[i], &original, &original_size);
+        if (err != ERR_NONE) {
+            fprintf(stderr, "%s: %s\n", argv[i], ERR_MSG(err));
+            break;
+        }
+
+        const char* name = strrchr(argv[i], '/') != NULL ? strrchr(argv[i], '/') + 1 : argv[i];
+        for (int res = THUMB_RES; res < ORIG_RES && err == ERR_NONE; ++res) {
+            double jpeg = 0, webp = 0;
+            size_t jpeg_size = 0, webp_size = 0;
+            err = time_codec(CODEC_JPEG, sides[res], sides[res], original, original_size,
+                             iterations, &jpeg, &jpeg_size);
+            if (err == ERR_NONE) {
+                err = time_codec(CODEC_WEBP, sides[res], sides[res], original, original_size,
+                                 iterations, &webp, &webp_size);
+            }
+            if (err != ERR_NONE) {
+                fprintf(stderr, "%s: %s\n", argv[i], ERR_MSG(err));
+                break;
+            }
+            printf("%-32s %-6s %10zu %10zu %6.1f%% %10.3f %10.3f\n", name, names[res], jpeg_size, webp_size,
+                   jpeg_size > 0 ? 100.0 * ((double) jpeg_size - (double) webp_size) / (double) jpeg_size : 0.0,
+                   jpeg, webp);
+        }
+        free(original);
+    }
+
+    vips_shutdown();
+    return err;
+}
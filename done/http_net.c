@@ -9,10 +9,14 @@
 #include <stdio.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include "http_prot.h"
 #include "http_net.h"
 #include "socket_layer.h"
@@ -21,6 +25,24 @@
 
 static int passive_socket = -1;
 static EventCallback cb;
+// URIs of the messages whose body is read by the callback itself
+static const char* streamed_uris[MAX_STREAMED_URIS];
+static size_t nb_streamed_uris = 0;
+
+// Event-loop threads, each with its own epoll instance watching the
+// passive socket and the connections it accepted
+#define NB_EVENT_LOOPS 4
+#define MAX_EVENTS 64
+// Connections are watched one event at a time: re-armed once handled
+#define CONNECTION_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLONESHOT)
+// handle_connection(): the message was handed to a worker
+#define CONNECTION_QUEUED 1
+
+// Sent, as far as the socket takes it, when no worker can take a message
+static const char refused[] = HTTP_PROTOCOL_ID HTTP_SERVICE_UNAVAILABLE HTTP_LINE_DELIM
+                              "Retry-After: 1" HTTP_LINE_DELIM
+                              "Connection: close" HTTP_LINE_DELIM
+                              "Content-Length: 0" HTTP_HDR_END_DELIM;
 
 #define MK_OUR_ERR(X) \
 static int our_ ## X = X
@@ -31,100 +53,479 @@ MK_OUR_ERR(ERR_OUT_OF_MEMORY);
 MK_OUR_ERR(ERR_IO);
 
 /***********************
- * Handle multiple HTTP messages
+ * State of one connection, between two readiness events
  */
-static void* handle_connection(void *arg)
+struct connection {
+    int socket;
+    int epoll_fd;     // of the event loop watching it
+    char* rcvbuf;     // always '\0'-terminated
+    size_t capacity;  // of rcvbuf, without the final '\0'
+    size_t total;     // bytes received, from the start of the current message
+    struct http_parser parser; // of the current message, resumed at each read
+};
+
+static struct connection* connection_new(int client_socket, int epoll_fd)
+{
+    struct connection* connection = calloc(1, sizeof(struct connection));
+    if (connection == NULL) return NULL;
+    connection->rcvbuf = calloc(MAX_HEADER_SIZE + 1, 1);
+    if (connection->rcvbuf == NULL) {
+        free(connection);
+        return NULL;
+    }
+    connection->socket = client_socket;
+    connection->epoll_fd = epoll_fd;
+    connection->capacity = MAX_HEADER_SIZE;
+    http_parser_init(&connection->parser);
+    return connection;
+}
+
+static void connection_close(struct connection* connection)
+{
+    // Closing the socket removes it from the epoll instance as well
+    close(connection->socket);
+    free(connection->rcvbuf);
+    free(connection);
+}
+
+/***********************
+ * A CLOCK_MONOTONIC time ms milliseconds from now
+ */
+static void deadline_in(struct timespec* deadline, uint64_t ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += (time_t) (ms / 1000);
+    deadline->tv_nsec += (long) (ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        ++deadline->tv_sec;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/***********************
+ * Whether the callback reads the body of the message itself
+ */
+static int is_streamed(const struct http_message* message)
+{
+    for (size_t i = 0; i < nb_streamed_uris; ++i) {
+        if (http_match_uri(message, streamed_uris[i]) == 1) return 1;
+    }
+    return 0;
+}
+
+/***********************
+ * The next message in the buffer, if complete: 1 if it is, 0 if more
+ * is to be received (the buffer then has room for its body), some error
+ */
+static int connection_pending(struct connection* connection, struct http_message* message)
+{
+    if (connection->total == 0) return 0;
+
+    const int had_header = connection->parser.header_len != 0;
+    const int ret = http_parser_feed(&connection->parser, connection->rcvbuf, connection->total, message);
+    if (ret != 0) return ret;
+
+    const int content_len = connection->parser.content_len;
+    if (content_len < 0 || content_len > MAX_REQUEST_SIZE) return ERR_IO;
+
+    // Header just received, of a message whose body the callback reads:
+    // handed over with what is received of the body
+    if (!had_header && connection->parser.header_len != 0 && is_streamed(message)) {
+        http_parser_body_start(&connection->parser, connection->rcvbuf, connection->total, message);
+
+        deadline_in(&message->body_deadline, BODY_TIMEOUT_MS + (uint64_t) content_len * 1000 / BODY_MIN_RATE);
+        return 1;
+    }
+
+    // Not complete: make room for the body, if any
+    const size_t needed = MAX_HEADER_SIZE + (size_t) content_len;
+    if (connection->capacity < needed) {
+        char* new_buf = realloc(connection->rcvbuf, needed + 1);
+        if (new_buf == NULL) return ERR_OUT_OF_MEMORY;
+        connection->rcvbuf = new_buf;
+        connection->capacity = needed;
+    }
+    return 0;
+}
+
+/***********************
+ * Drops the message just handled; the bytes received after it (the
+ * next pipelined messages) are moved to the front of the buffer
+ */
+static void connection_consume(struct connection* connection)
+{
+    size_t len = connection->parser.header_len + (size_t) connection->parser.content_len;
+    if (len > connection->total) len = connection->total;
+    connection->total -= len;
+    memmove(connection->rcvbuf, connection->rcvbuf + len, connection->total);
+    connection->rcvbuf[connection->total] = '\0';
+    http_parser_init(&connection->parser);
+
+    // Back to the size of a header once a large body is gone
+    if (connection->capacity > MAX_HEADER_SIZE && connection->total < MAX_HEADER_SIZE) {
+        char* new_buf = realloc(connection->rcvbuf, MAX_HEADER_SIZE + 1);
+        if (new_buf != NULL) {
+            connection->rcvbuf = new_buf;
+            connection->capacity = MAX_HEADER_SIZE;
+        }
+    }
+}
+
+/***********************
+ * Whether the client asked to close the connection after this message
+ */
+static int connection_closing(const struct http_message* message)
+{
+    for (size_t i = 0; i < message->num_headers; ++i) {
+        const struct http_string* key = &message->headers[i].key;
+        const struct http_string* value = &message->headers[i].value;
+        if (key->len == strlen("Connection") && strncasecmp(key->val, "Connection", key->len) == 0
+            && value->len == strlen("close") && strncasecmp(value->val, "close", value->len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/***********************
+ * Watches the connection again, once its last event is handled
+ */
+static int connection_rearm(struct connection* connection)
+{
+    struct epoll_event event = { .events = CONNECTION_EVENTS, .data.ptr = connection };
+    return epoll_ctl(connection->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event) == -1 ? ERR_IO : ERR_NONE;
+}
+
+/***********************
+ * Complete messages waiting for a worker; their connection is not
+ * watched meanwhile, so their buffer is left alone
+ */
+struct job {
+    struct connection* connection;
+    struct http_message message;
+    struct timespec queued;
+};
+
+static struct {
+    pthread_mutex_t lock;     // protects what follows
+    pthread_cond_t not_empty;
+    struct job* jobs;         // circular buffer of capacity jobs
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t nb_workers;
+    size_t max_count;
+    uint64_t dispatched;
+    uint64_t rejected;
+    double total_wait_ms;
+    double max_wait_ms;
+} queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .capacity = DEFAULT_HTTP_QUEUE,
+    .nb_workers = DEFAULT_HTTP_WORKERS
+};
+
+/***********************
+ * Avoid SIGINT and SIGTERM signals (left to the main thread)
+ */
+static void block_signals(void)
 {
-    // Avoid SIGINT and SIGTERM signals (left to the main thread)
     sigset_t mask;
     sigemptyset(&mask);
     sigaddset(&mask, SIGINT );
     sigaddset(&mask, SIGTERM);
     pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
 
-    if (arg == NULL) return &our_ERR_INVALID_ARGUMENT;
+static double elapsed_ms(const struct timespec* since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - since->tv_sec) * 1e3 + (double) (now.tv_nsec - since->tv_nsec) / 1e6;
+}
 
-    // Initialise all variables
-    int client_socket = *(int *)arg;
-    char *rcvbuf = malloc(MAX_HEADER_SIZE + 1);
-    if (rcvbuf == NULL) return &our_ERR_OUT_OF_MEMORY;
-    size_t total = 0;
-    int content_len = 0;
-    char *header_end = NULL;
-    int extended = 0;
+/***********************
+ * Hands a message to the workers, unless the queue is full
+ */
+static int enqueue(struct connection* connection, const struct http_message* message)
+{
+    pthread_mutex_lock(&queue.lock);
+    if (queue.count == queue.capacity) {
+        ++queue.rejected;
+        pthread_mutex_unlock(&queue.lock);
+        return ERR_OUT_OF_MEMORY;
+    }
+    struct job* job = &queue.jobs[(queue.head + queue.count) % queue.capacity];
+    job->connection = connection;
+    job->message = *message;
+    clock_gettime(CLOCK_MONOTONIC, &job->queued);
+    ++queue.count;
+    if (queue.count > queue.max_count) queue.max_count = queue.count;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    return ERR_NONE;
+}
 
-    struct http_message message;
+/***********************
+ * One worker: dispatches the messages, then watches their connection again
+ */
+static void* worker(void* arg)
+{
+    (void) arg;
+    block_signals();
+
+    for (;;) {
+        pthread_mutex_lock(&queue.lock);
+        while (queue.count == 0) pthread_cond_wait(&queue.not_empty, &queue.lock);
+        const struct job job = queue.jobs[queue.head];
+        queue.head = (queue.head + 1) % queue.capacity;
+        --queue.count;
+        const double wait_ms = elapsed_ms(&job.queued);
+        ++queue.dispatched;
+        queue.total_wait_ms += wait_ms;
+        if (wait_ms > queue.max_wait_ms) queue.max_wait_ms = wait_ms;
+        pthread_mutex_unlock(&queue.lock);
+
+        // Then the messages pipelined behind it, in order, before
+        // watching the connection again
+        struct connection* connection = job.connection;
+        struct http_message message = job.message;
+        int ret = 1;
+        while (ret == 1) {
+            // Answered, then closed if the client asked to, or if the
+            // rest of a streamed body is left in the socket
+            if (cb(&message, connection->socket) < 0 || message.body_pending != 0
+                || connection_closing(&message)) {
+                ret = ERR_IO;
+                break;
+            }
+            connection_consume(connection);
+            ret = connection_pending(connection, &message);
+        }
+        if (ret != ERR_NONE || connection_rearm(connection) != ERR_NONE) connection_close(connection);
+    }
+    return NULL;
+}
 
-    while (1) {
-        // Read from the socket
-        ssize_t bytes_read = tcp_read(client_socket,
-                                      rcvbuf + total,
-                                      MAX_HEADER_SIZE + content_len - total);
-        if (bytes_read < 0) {
-            free(rcvbuf);
-            rcvbuf = NULL;
-            close(client_socket);
+/***********************
+ * Pool size
+ */
+int http_set_workers(size_t nb_workers, size_t queue_capacity)
+{
+    if (nb_workers == 0 || queue_capacity == 0) return ERR_INVALID_ARGUMENT;
 
-            return &our_ERR_IO;
+    pthread_mutex_lock(&queue.lock);
+    const int started = queue.jobs != NULL;
+    if (!started) {
+        queue.nb_workers = nb_workers;
+        queue.capacity = queue_capacity;
+    }
+    pthread_mutex_unlock(&queue.lock);
+    return started ? ERR_RUNTIME : ERR_NONE;
+}
+
+/***********************
+ * Streamed bodies
+ */
+int http_stream_uri(const char* uri)
+{
+    M_REQUIRE_NON_NULL(uri);
+
+    pthread_mutex_lock(&queue.lock);
+    const int err = queue.jobs != NULL ? ERR_RUNTIME
+                    : nb_streamed_uris == MAX_STREAMED_URIS ? ERR_OUT_OF_MEMORY : ERR_NONE;
+    if (err == ERR_NONE) streamed_uris[nb_streamed_uris++] = uri;
+    pthread_mutex_unlock(&queue.lock);
+    return err;
+}
+
+int http_read_body(struct http_message* message, int connection, void* buffer, size_t size, size_t* read)
+{
+    M_REQUIRE_NON_NULL(message);
+    M_REQUIRE_NON_NULL(buffer);
+    M_REQUIRE_NON_NULL(read);
+
+    *read = 0;
+    // Received with the header
+    if (message->body.len > 0) {
+        const size_t len = size < message->body.len ? size : message->body.len;
+        memcpy(buffer, message->body.val, len);
+        message->body.val += len;
+        message->body.len -= len;
+        *read = len;
+        return ERR_NONE;
+    }
+    if (message->body_pending == 0 || size == 0) return ERR_NONE;
+
+    const size_t wanted = size < message->body_pending ? size : message->body_pending;
+    for (;;) {
+        // Not wholly received in time: too slow
+        const double left_ms = -elapsed_ms(&message->body_deadline);
+        if (left_ms <= 0) return ERR_IO;
+
+        const ssize_t bytes_read = tcp_read(connection, buffer, wanted);
+        if (bytes_read > 0) {
+            message->body_pending -= (size_t) bytes_read;
+            *read = (size_t) bytes_read;
+            return ERR_NONE;
+        }
+        if (bytes_read < 0 && errno == EINTR) continue;
+        // Not there yet: the socket is non-blocking
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+            && tcp_wait_readable(connection, left_ms < BODY_TIMEOUT_MS ? (int) left_ms + 1
+                                 : BODY_TIMEOUT_MS) == ERR_NONE) {
+            continue;
+        }
+        // Closed by the client, or too slow
+        return ERR_IO;
+    }
+}
+
+/***********************
+ * Statistics of the queue
+ */
+void http_get_stats(struct http_stats* stats)
+{
+    if (stats == NULL) return;
+
+    pthread_mutex_lock(&queue.lock);
+    stats->nb_workers = queue.nb_workers;
+    stats->queue_capacity = queue.capacity;
+    stats->queue_depth = queue.count;
+    stats->max_queue_depth = queue.max_count;
+    stats->dispatched = queue.dispatched;
+    stats->rejected = queue.rejected;
+    stats->mean_wait_ms = queue.dispatched > 0 ? queue.total_wait_ms / (double) queue.dispatched : 0.0;
+    stats->max_wait_ms = queue.max_wait_ms;
+    pthread_mutex_unlock(&queue.lock);
+}
+
+/***********************
+ * Starts the workers
+ */
+static int start_workers(void)
+{
+    queue.jobs = calloc(queue.capacity, sizeof(struct job));
+    if (queue.jobs == NULL) return ERR_OUT_OF_MEMORY;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    size_t started = 0;
+    for (size_t i = 0; i < queue.nb_workers; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, worker, NULL) == 0) ++started;
+    }
+    pthread_attr_destroy(&attr);
+    if (started == 0) return ERR_THREADING;
+    queue.nb_workers = started;
+    return ERR_NONE;
+}
+
+/***********************
+ * Handle the HTTP messages of a connection: reads what is available,
+ * without blocking, and hands a complete message to the workers.
+ * Messages already in the buffer are handled before reading again.
+ * Returns ERR_NONE to keep watching the connection, CONNECTION_QUEUED
+ * when a worker will, some error to close it.
+ */
+static int handle_connection(struct connection* connection)
+{
+    for (;;) {
+        struct http_message message;
+        const int ret_parsed_mess = connection_pending(connection, &message);
+        if (ret_parsed_mess < 0) return ret_parsed_mess;
+        if (ret_parsed_mess == 1) {
+            if (enqueue(connection, &message) == ERR_NONE) return CONNECTION_QUEUED;
+
+            // All the workers busy, and enough waiting already: refused right
+            // away, by a single send which cannot block the event loop
+            (void) send(connection->socket, refused, sizeof(refused) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+            return ERR_IO;
         }
-        if(bytes_read==0) break;
-        // Check if the header is complete
-        if (header_end == NULL) {
-            header_end = strstr(rcvbuf, HTTP_HDR_END_DELIM);
-            if (header_end != NULL) {
-                header_end += strlen(HTTP_HDR_END_DELIM);
+
+        // Header larger than the buffer
+        if (connection->total >= connection->capacity) return ERR_IO;
+
+        // Read from the socket
+        const ssize_t bytes_read = tcp_read(connection->socket, connection->rcvbuf + connection->total,
+                                            connection->capacity - connection->total);
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return ERR_NONE;
+        if (bytes_read < 0 && errno == EINTR) continue;
+        // Closed by the client
+        if (bytes_read <= 0) return ERR_IO;
+
+        // Update total bytes read for the messages in the buffer
+        connection->total += (size_t) bytes_read;
+        connection->rcvbuf[connection->total] = '\0';
+    }
+}
+
+/***********************
+ * Accepts all the pending connections, watched by this event loop
+ */
+static void accept_connections(int epoll_fd)
+{
+    for (;;) {
+        const int client_socket = tcp_accept(passive_socket);
+        // None left (maybe taken by another event loop)
+        if (client_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error accepting connection");
             }
+            return;
         }
 
-        // Update total bytes read for this http message
-        total += bytes_read;
-        // Check if now message is complete
-        int ret_parsed_mess = http_parse_message(rcvbuf,total,&message, &content_len);
-        if (ret_parsed_mess < 0) {
-            free(rcvbuf);
-            rcvbuf = NULL;
+        struct connection* connection = NULL;
+        if (tcp_set_nonblocking(client_socket) != ERR_NONE
+            || (connection = connection_new(client_socket, epoll_fd)) == NULL) {
             close(client_socket);
-            return ret_parsed_mess;
-        } else if (ret_parsed_mess == 0) { // Parsed message is not complete
-            // Check if we need to extend the buffer
-            if (!extended && content_len > 0 && rcvbuf+total -header_end< content_len) {
-                char *new_buf = realloc(rcvbuf, MAX_HEADER_SIZE + content_len);
-                if (!new_buf) {
-                    free(rcvbuf);
-                    rcvbuf = NULL;
-                    close(client_socket);
-
-                    return &our_ERR_OUT_OF_MEMORY;
-                }
-                rcvbuf = new_buf;
-                extended = 1;
-            }
-        } else {
-            // Call the callback function
-            int callback_result = cb(&message, client_socket);
-            if (callback_result < 0) {
-                free(rcvbuf);
-                rcvbuf = NULL;
-                close(client_socket);
-                return &our_ERR_IO;
-
-            } else {
-                total = 0;
-                content_len = 0;
-                extended = 0;
-                header_end = NULL;
-                memset(rcvbuf, 0, MAX_HEADER_SIZE);
-            }
+            continue;
+        }
+        struct epoll_event event = { .events = CONNECTION_EVENTS, .data.ptr = connection };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) == -1) {
+            perror("epoll_ctl() in accept_connections()");
+            connection_close(connection);
         }
     }
+}
 
-    free(rcvbuf);
-    rcvbuf = NULL;
-    close(client_socket);
+/***********************
+ * One event loop: the passive socket is marked by a NULL data.ptr
+ */
+static void* event_loop(void* arg)
+{
+    const int epoll_fd = *(int*) arg;
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        const int nb_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (nb_events < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait() in event_loop()");
+            return &our_ERR_IO;
+        }
 
-    return &our_ERR_NONE;
+        for (int i = 0; i < nb_events; ++i) {
+            struct connection* connection = events[i].data.ptr;
+            if (connection == NULL) {
+                accept_connections(epoll_fd);
+                continue;
+            }
+            const int ret = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0 ? ERR_IO
+                            : handle_connection(connection);
+            if (ret == ERR_NONE && connection_rearm(connection) == ERR_NONE) continue;
+            // Otherwise the worker it was handed to watches it again
+            if (ret != CONNECTION_QUEUED) connection_close(connection);
+        }
+    }
 }
 
+static void* event_loop_thread(void* arg)
+{
+    block_signals();
+    return event_loop(arg);
+}
 
 /***********************
  * Init connection
@@ -132,6 +533,10 @@ static void* handle_connection(void *arg)
 int http_init(uint16_t port, EventCallback callback)
 {
     passive_socket = tcp_server_init(port);
+    if (passive_socket >= 0 && tcp_set_nonblocking(passive_socket) != ERR_NONE) {
+        http_close();
+        return ERR_IO;
+    }
 
     cb = callback;
     return passive_socket;
@@ -151,51 +556,46 @@ void http_close(void)
 }
 
 /*******************************************************************
- * Thread function to handle the connection
- */
-void* thread_func(void* arg)
-{
-    int* client_socket = (int*)arg;
-    printf("client_socket: %d\n", *client_socket);
-    handle_connection(client_socket);
-    return NULL;
-}
-
-/*******************************************************************
- * Receive content
+ * Receive content: runs NB_EVENT_LOOPS event loops, one of them in the
+ * calling thread, and the workers they hand the messages to.
+ * Only returns on error.
  */
 int http_receive(void)
 {
+    const int err = start_workers();
+    if (err != ERR_NONE) {
+        fprintf(stderr, "Error starting the HTTP workers\n");
+        return err;
+    }
+
+    static int epoll_fds[NB_EVENT_LOOPS];
+    for (int i = 0; i < NB_EVENT_LOOPS; ++i) {
+        epoll_fds[i] = epoll_create1(EPOLL_CLOEXEC);
+        // A new connection wakes up one of the loops only
+        struct epoll_event event = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if (epoll_fds[i] == -1 || epoll_ctl(epoll_fds[i], EPOLL_CTL_ADD, passive_socket, &event) == -1) {
+            perror("Error creating the event loops");
+            for (int j = 0; j <= i; ++j) {
+                if (epoll_fds[j] != -1) close(epoll_fds[j]);
+            }
+            return ERR_IO;
+        }
+    }
+
     // All created threads will have same attributes
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    int* active_socket = calloc(1,sizeof(int));
-    if (active_socket == NULL) {
-        perror("Error allocating memory for active socket");
-        pthread_attr_destroy(&attr);
-        return ERR_OUT_OF_MEMORY;
-    }
-    while (1) {
-        // Accept connection
-        *active_socket = tcp_accept(passive_socket);
-        printf("active_socket: %d\n", *active_socket);
-        if (*active_socket < 0) {
-            perror("Error accepting connection");
-            close(*active_socket);
-            continue;
-        }
-        // Create thread
+    for (int i = 1; i < NB_EVENT_LOOPS; ++i) {
         pthread_t thread;
-        if (pthread_create(&thread, &attr, thread_func, active_socket) != 0) {
+        if (pthread_create(&thread, &attr, event_loop_thread, &epoll_fds[i]) != 0) {
             perror("Error creating thread");
-            close(*active_socket);
+            close(epoll_fds[i]);
         }
-
     }
-
     pthread_attr_destroy(&attr);
-    return ERR_NONE;
+
+    return *(int*) event_loop(&epoll_fds[0]);
 }
 
 
@@ -294,3 +694,49 @@ int http_reply(int connection, const char* status, const char* headers, const ch
     free(buffer);
     return our_ERR_NONE;
 }
+
+/***********************
+ * Create and send HTTP reply whose body is read from a file
+ */
+int http_reply_file(int connection, const char* status, const char* headers,
+                    int fd, uint64_t offset, size_t body_len)
+{
+    M_REQUIRE_NON_NULL(status);
+    M_REQUIRE_NON_NULL(headers);
+    if (body_len != 0 && fd < 0) return our_ERR_INVALID_ARGUMENT;
+
+    // Create the HTTP response header
+    const int header_len = snprintf(NULL, 0, "%s%s%s%s%s%zu%s", HTTP_PROTOCOL_ID, status,
+                                    HTTP_LINE_DELIM, headers, "Content-Length: ", body_len, HTTP_HDR_END_DELIM);
+    if (header_len < 0) return our_ERR_INVALID_ARGUMENT;
+
+    char* buffer = malloc((size_t) header_len + 1);
+    if (buffer == NULL) return our_ERR_OUT_OF_MEMORY;
+    snprintf(buffer, (size_t) header_len + 1, "%s%s%s%s%s%zu%s", HTTP_PROTOCOL_ID, status,
+             HTTP_LINE_DELIM, headers, "Content-Length: ", body_len, HTTP_HDR_END_DELIM);
+
+    // Send the header only...
+    size_t total = 0;
+    while (total < (size_t) header_len) {
+        ssize_t sent = tcp_send(connection, buffer + total, (size_t) header_len - total);
+        if (sent < 0) {
+            free(buffer);
+            return ERR_IO;
+        }
+        total += (size_t) sent;
+    }
+    free(buffer);
+
+    // ...then let the kernel copy the body from the file to the socket,
+    // as long as the client reads it fast enough
+    struct timespec deadline;
+    deadline_in(&deadline, SEND_TIMEOUT_MS + (uint64_t) body_len * 1000 / REPLY_MIN_RATE);
+    total = 0;
+    while (total < body_len) {
+        if (elapsed_ms(&deadline) >= 0) return ERR_IO;
+        ssize_t sent = tcp_sendfile(connection, fd, &offset, body_len - total);
+        if (sent <= 0) return ERR_IO;
+        total += (size_t) sent;
+    }
+    return our_ERR_NONE;
+}
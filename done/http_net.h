@@ -7,12 +7,20 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include "http_prot.h" // for structs
 
 #define MAX_REQUEST_SIZE 8388608 // 2^23 -> to handle images up to 8MB
 #define MAX_HEADER_SIZE    16384 // 2^14 -> to handle http headers
 
+#define DEFAULT_HTTP_WORKERS 8   // threads running the callback
+#define DEFAULT_HTTP_QUEUE   64  // messages waiting for them, beyond which 503
+#define MAX_STREAMED_URIS    4
+#define BODY_TIMEOUT_MS  10000   // for the next part of a streamed body
+#define BODY_MIN_RATE    32768   // bytes/s: a streamed body has BODY_TIMEOUT_MS plus its size at that rate
+#define REPLY_MIN_RATE   32768   // bytes/s: a file reply has SEND_TIMEOUT_MS plus its size at that rate
+
 /* **********************************************************************
  * TODO WEEK 11: DEFINE EventCallback HERE
  *               as a pointer to a function taking
@@ -25,10 +33,78 @@ typedef int (*EventCallback)(struct http_message* message, int status);
 
 int http_init(uint16_t port, EventCallback cb);
 
+/**
+ * @brief Sizes the pool running the callback: nb_workers threads, and at
+ *        most queue_capacity complete messages waiting for them; beyond,
+ *        messages are answered 503 right away, as far as the socket takes
+ *        it without blocking, and their connection closed. Before
+ *        http_receive() only.
+ *
+ * @return Some error code. 0 if no error.
+ */
+int http_set_workers(size_t nb_workers, size_t queue_capacity);
+
+/**
+ * @brief Messages whose URI starts with uri are handed to the callback as
+ *        soon as their header is received, with only the part of their body
+ *        received with it: the callback reads the rest with http_read_body(),
+ *        instead of the whole body being buffered first. Before http_receive()
+ *        only.
+ *
+ * @return Some error code. 0 if no error.
+ */
+int http_stream_uri(const char* uri);
+
+/**
+ * @brief Reads the next part of the body of message, at most size bytes:
+ *        first what was received with the header, then from the connection,
+ *        waiting at most BODY_TIMEOUT_MS for each part. The whole body must
+ *        be received within BODY_TIMEOUT_MS plus its size at BODY_MIN_RATE,
+ *        so that a client sending it slowly cannot hold a worker for long.
+ *        Puts their number in read, 0 once the whole body is read. A
+ *        connection whose body is not read wholly by the callback is closed
+ *        after it.
+ *
+ * @return Some error code. 0 if no error.
+ */
+int http_read_body(struct http_message* message, int connection, void* buffer, size_t size, size_t* read);
+
+// To size the pool
+struct http_stats {
+    size_t nb_workers;
+    size_t queue_capacity;
+    size_t queue_depth;      // messages waiting now
+    size_t max_queue_depth;  // since started
+    uint64_t dispatched;     // messages handed to a worker
+    uint64_t rejected;       // messages answered 503
+    double mean_wait_ms;     // time waiting for a worker
+    double max_wait_ms;
+};
+
+/**
+ * @brief Statistics of the pool, since started.
+ */
+void http_get_stats(struct http_stats* stats);
+
+/**
+ * @brief Serves the connections with a fixed number of epoll event loops,
+ *        one of them in the calling thread, on non-blocking sockets, and
+ *        runs the callback in the pool of workers: the number of threads
+ *        does not grow with the number of connections.
+ *        Only returns on error.
+ */
 int http_receive(void);
 
 int http_serve_file(int connection, const char* filename);
 
 int http_reply(int connection, const char* status, const char* headers, const char* body, size_t body_len);
 
+/**
+ * @brief Like http_reply(), but the body is the body_len bytes found at
+ *        offset in the file fd; they are sent with sendfile(), without any
+ *        copy in user space.
+ */
+int http_reply_file(int connection, const char* status, const char* headers,
+                    int fd, uint64_t offset, size_t body_len);
+
 void http_close(void);
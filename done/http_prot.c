@@ -1,5 +1,7 @@
 #include "http_prot.h"
+#include <stdlib.h> // for atoi
 #include <string.h>
+#include <strings.h> // for strncasecmp
 #include "imgfs.h"
 #include "error.h"
 #ifdef IN_CS202_UNIT_TEST
@@ -77,53 +79,91 @@ int http_get_var(const struct http_string* url, const char* name, char* out, siz
 }
 
 /**
- * @brief Accepts a potentially partial TCP stream and parses an HTTP message.
- *
- * Assumes that all characters of stream that are not filled by reading are set to 0.
- *
- * Places the complete HTTP message in out.
- * Also writes the content of header "Content Length" to content_len upon parsing the header in the stream.
- * content_len can be used by the caller to allocate memory to receive the whole HTTP message.
+ * @brief Whether the parameters of one Accept entry (what follows the
+ *        media type, up to the next ',') give it a zero quality.
+ */
+static int has_zero_quality(const char* params, const char* end)
+{
+    for (const char* p = params; p < end; ++p) {
+        if (*p != ';') continue;
+        ++p;
+        while (p < end && *p == ' ') ++p;
+        if (end - p < 2 || (p[0] != 'q' && p[0] != 'Q') || p[1] != '=') continue;
+        // "0", "0.", "0.0"... up to "0.000"
+        p += 2;
+        if (p >= end || *p != '0') return 0;
+        for (++p; p < end && (*p == '.' || *p == '0'); ++p);
+        return p == end || *p == ' ' || *p == ';';
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether the Accept header(s) of message list media_type
+ *        with a non-zero quality.
  *
- * Returns:
- *  a negative int if there was an error
- *  0 if the message has not been received completely (partial treatment) or an error occurred
- *  1 if the message was fully received and parsed
+ * Returns: 1 if it does, 0 if it does not.
  */
-int http_parse_message(const char *stream, size_t bytes_received, struct http_message *out, int *content_len)
+int http_accepts(const struct http_message* message, const char* media_type)
 {
-    M_REQUIRE_NON_NULL(stream);
-    M_REQUIRE_NON_NULL(out);
-    M_REQUIRE_NON_NULL(content_len);
+    M_REQUIRE_NON_NULL(message);
+    M_REQUIRE_NON_NULL(media_type);
+    const size_t type_len = strlen(media_type);
+
+    for (size_t i = 0; i < message->num_headers; ++i) {
+        const struct http_string* key = &message->headers[i].key;
+        if (key->len != strlen("Accept") || strncasecmp(key->val, "Accept", key->len) != 0) continue;
 
+        // Comma-separated entries: "type/subtype;q=0.8, ..."
+        const char* entry = message->headers[i].value.val;
+        const char* const value_end = entry + message->headers[i].value.len;
+        while (entry < value_end) {
+            while (entry < value_end && (*entry == ' ' || *entry == ',')) ++entry;
+            const char* entry_end = entry;
+            while (entry_end < value_end && *entry_end != ',') ++entry_end;
+            const char* type_end = entry;
+            while (type_end < entry_end && *type_end != ';' && *type_end != ' ') ++type_end;
+
+            if ((size_t) (type_end - entry) == type_len && strncasecmp(entry, media_type, type_len) == 0
+                && !has_zero_quality(type_end, entry_end)) {
+                return 1;
+            }
+            entry = entry_end;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Tokenizes a complete header into out, and its "Content-Length"
+ *        into content_len.
+ *
+ * Returns: the start of the body, NULL if the header is not valid.
+ */
+static const char* parse_header(const char* stream, struct http_message* out, int* content_len)
+{
     // Initialize the out structure and content_len
     memset(out, 0, sizeof(struct http_message));
     *content_len = 0;
-    // Check headers have been completely received
-    const char *header_end = strstr(stream, HTTP_HDR_END_DELIM);
-    if (!header_end) {
-        return 0;
-    }
-    const char *start = stream;
     // Parse the first token
     stream = get_next_token(stream, " ", &out->method);
     if (stream == NULL) {
-        return 0;
+        return NULL;
     }
     // Parse the second token
     stream = get_next_token(stream, " ", &out->uri);
     if (stream == NULL) {
-        return 0;
+        return NULL;
     }
     // Check third token
     stream = get_next_token(stream, HTTP_LINE_DELIM, NULL);
     if (stream == NULL) {
-        return 0;
+        return NULL;
     }
     // Parse all the key-value pairs
     stream = http_parse_headers(stream, out);
     if (stream == NULL) {
-        return 0;
+        return NULL;
     }
     // Get the "Content-Length" value from the parsed header lines
     for (size_t i = 0; i < out->num_headers; ++i) {
@@ -132,15 +172,112 @@ int http_parse_message(const char *stream, size_t bytes_received, struct http_me
             break;
         }
     }
-    // If it's present and not 0, store the body
-    if (content_len !=NULL && *content_len != 0 ) {
-        out->body.val = stream;
-        out->body.len = bytes_received - (stream-start);
-        return out->body.len == *content_len;
+    return stream;
+}
+
+/**
+ * @brief Starts (again) a message from its first byte.
+ */
+void http_parser_init(struct http_parser* parser)
+{
+    if (parser == NULL) return;
+    memset(parser, 0, sizeof(struct http_parser));
+}
+
+/**
+ * @brief Parses a message received in several parts, looking only at the
+ *        bytes received since the last call until the header is complete.
+ *
+ * Returns:
+ *  a negative int if there was an error
+ *  0 if the message has not been received completely (partial treatment)
+ *  1 if the message was fully received and parsed
+ */
+int http_parser_feed(struct http_parser* parser, const char* stream, size_t bytes_received,
+                     struct http_message* out)
+{
+    M_REQUIRE_NON_NULL(parser);
+    M_REQUIRE_NON_NULL(stream);
+    M_REQUIRE_NON_NULL(out);
+
+    if (parser->header_len == 0) {
+        // Search the new bytes, and the end of the previous ones in case
+        // the delimiter was split between two parts
+        const size_t delim_len = strlen(HTTP_HDR_END_DELIM);
+        const size_t from = parser->scanned >= delim_len ? parser->scanned - (delim_len - 1) : 0;
+        if (from >= bytes_received) return 0;
+        const char *header_end = strstr(stream + from, HTTP_HDR_END_DELIM);
+        parser->scanned = bytes_received;
+        if (header_end == NULL) {
+            return 0;
+        }
+        const char* body = parse_header(stream, out, &parser->content_len);
+        if (body == NULL) {
+            return 0;
+        }
+        parser->header_len = (size_t) (body - stream);
+    } else if (parser->content_len >= 0
+               && bytes_received - parser->header_len >= (size_t) parser->content_len) {
+        // Complete now: the previous tokens may have been moved with stream
+        if (parse_header(stream, out, &parser->content_len) == NULL) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+
+    // If it's present and not 0, store the body; the bytes beyond it
+    // belong to the next (pipelined) message
+    if (parser->content_len != 0) {
+        if (parser->content_len < 0
+            || bytes_received - parser->header_len < (size_t) parser->content_len) return 0;
+        out->body.val = stream + parser->header_len;
+        out->body.len = (size_t) parser->content_len;
     }
     return 1;
+}
+
+void http_parser_body_start(const struct http_parser* parser, const char* stream, size_t bytes_received,
+                            struct http_message* out)
+{
+    if (parser == NULL || stream == NULL || out == NULL || parser->header_len == 0
+        || parser->content_len < 0 || bytes_received < parser->header_len) return;
+
+    const size_t content_len = (size_t) parser->content_len;
+    const size_t received = bytes_received - parser->header_len;
+    out->body.val = stream + parser->header_len;
+    out->body.len = received < content_len ? received : content_len;
+    out->body_pending = content_len - out->body.len;
+}
 
+/**
+ * @brief Accepts a potentially partial TCP stream and parses an HTTP message.
+ *
+ * Assumes that all characters of stream that are not filled by reading are set to 0.
+ *
+ * Places the complete HTTP message in out; stream may hold the beginning
+ * of the next (pipelined) messages after it.
+ * Also writes the content of header "Content Length" to content_len upon parsing the header in the stream.
+ * content_len can be used by the caller to allocate memory to receive the whole HTTP message.
+ *
+ * Returns:
+ *  a negative int if there was an error
+ *  0 if the message has not been received completely (partial treatment) or an error occurred
+ *  1 if the message was fully received and parsed
+ */
+int http_parse_message(const char *stream, size_t bytes_received, struct http_message *out, int *content_len)
+{
+    M_REQUIRE_NON_NULL(stream);
+    M_REQUIRE_NON_NULL(out);
+    M_REQUIRE_NON_NULL(content_len);
 
+    // From scratch
+    struct http_parser parser;
+    http_parser_init(&parser);
+    memset(out, 0, sizeof(struct http_message));
+    const int ret = http_parser_feed(&parser, stream, bytes_received, out);
+    *content_len = parser.content_len;
+    return ret;
 }
 
 
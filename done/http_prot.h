@@ -15,12 +15,14 @@
 #define HTTP_PROTOCOL_ID   "HTTP/1.1 "
 #define HTTP_OK            "200 OK"
 #define HTTP_BAD_REQUEST   "400 Bad Request"
+#define HTTP_SERVICE_UNAVAILABLE "503 Service Unavailable"
 #ifdef IN_CS202_UNIT_TEST
 #define static_unless_test
 #else
 #define static_unless_test static
 #endif
 #include <stddef.h>
+#include <time.h> // struct timespec
 
 struct http_string {
     const char *val; // Warning! This is *NOT* null-terminated (thus len field below)
@@ -38,6 +40,8 @@ struct http_message {
     struct http_header headers[MAX_HEADERS];
     size_t num_headers;
     struct http_string body;
+    size_t body_pending; // bytes of the body still to be received (see http_read_body())
+    struct timespec body_deadline; // CLOCK_MONOTONIC time by which they must be
 };
 
 /**
@@ -53,7 +57,8 @@ int http_match_uri(const struct http_message *message, const char *target_uri);
  *
  * Assumes that all characters of stream that are not filled by reading are set to 0.
  *
- * Places the complete HTTP message in out.
+ * Places the complete HTTP message in out; stream may hold the beginning
+ * of the next (pipelined) messages after it.
  * Also writes the content of header "Content Length" to content_len upon parsing the header in the stream.
  * content_len can be used by the caller to allocate memory to receive the whole HTTP message.
  *
@@ -64,6 +69,49 @@ int http_match_uri(const struct http_message *message, const char *target_uri);
  */
 int http_parse_message(const char *stream, size_t bytes_received, struct http_message *out, int *content_len);
 
+/**
+ * @brief State of a message received in several parts, kept between two
+ *        calls to http_parser_feed() so that each part is looked at once.
+ */
+struct http_parser {
+    size_t scanned;     // bytes already searched for the end of the header
+    size_t header_len;  // up to the body; 0 until the whole header is received
+    int content_len;    // of the message, once its header is parsed
+};
+
+/**
+ * @brief Starts (again) a message from its first byte.
+ */
+void http_parser_init(struct http_parser* parser);
+
+/**
+ * @brief Same as http_parse_message(), for a stream that grows between
+ *        two calls: only the bytes received since the last call are searched
+ *        for the end of the header, and the header is tokenized once it is
+ *        complete, then once more when the body is. The stream may be moved
+ *        (e.g. reallocated) between two calls, not modified.
+ *
+ * Once it returns 1, the message takes header_len + content_len bytes of
+ * stream; the parser is to be initialized again for the next one.
+ *
+ * Returns:
+ *  a negative int if there was an error
+ *  0 if the message has not been received completely (partial treatment)
+ *  1 if the message was fully received and parsed
+ */
+int http_parser_feed(struct http_parser* parser, const char* stream, size_t bytes_received,
+                     struct http_message* out);
+
+/**
+ * @brief For a message whose body is read by its receiver: once the header
+ *        is parsed (header_len != 0), sets the body of out to the part of it
+ *        already in stream, and body_pending to the number of bytes still to
+ *        be received. Bytes of stream beyond content_len belong to the next
+ *        (pipelined) message, and are left out.
+ */
+void http_parser_body_start(const struct http_parser* parser, const char* stream, size_t bytes_received,
+                            struct http_message* out);
+
 /**
  * @brief Writes the value of parameter name from URL in message to buffer out.
  *
@@ -77,6 +125,16 @@ int http_get_var(const struct http_string* url, const char* name, char* out, siz
  */
 int http_match_verb(const struct http_string* method, const char* verb);
 
+/**
+ * @brief Checks whether the Accept header(s) of message list media_type
+ *        (e.g. "image/webp"), compared case-insensitively, with a non-zero
+ *        quality. Wildcard entries (any type, any image) are not taken into
+ *        account: only the clients naming the type explicitly get it.
+ *
+ * Returns: 1 if it does, 0 if it does not.
+ */
+int http_accepts(const struct http_message* message, const char* media_type);
+
 /**
  * @brief Extract the first substring (= prefix) of a the string before some delimiter:
  *
@@ -2,7 +2,9 @@
 #include "imgfs.h"
 #include "image_content.h"
 #include "error.h"
+#include "imgfs_index.h" // for content_index_next()
 #include <vips/vips.h>
+#include <stdio.h>  // for SEEK_SET, SEEK_CUR, SEEK_END
 #include <stdlib.h>
 
 // Helper function to free memory
@@ -12,6 +14,415 @@ void freeMemory(unsigned char* buffer)
     buffer = NULL;
 }
 
+/*******************************************************************
+ * Whether the box of resolution from is at least CASCADE_MIN_RATIO
+ * times larger, in both dimensions, than width x height: enough for the
+ * JPEG artifacts of the source to vanish in the downscale
+ */
+static int can_resize_from(const struct imgfs_header* header, int from, uint32_t width, uint32_t height)
+{
+    return header->resized_res[2*from] >= CASCADE_MIN_RATIO * width
+           && header->resized_res[(2*from) + 1] >= CASCADE_MIN_RATIO * height;
+}
+
+/*******************************************************************
+ * Whether resolution to can be resized from resolution from
+ */
+static int can_cascade(const struct imgfs_header* header, int from, int to)
+{
+    return can_resize_from(header, from, header->resized_res[2*to], header->resized_res[(2*to) + 1]);
+}
+
+/*******************************************************************
+ * The smallest stored variant that every wanted one can be resized from
+ */
+int resize_source(const struct imgfs_header* header, const struct img_metadata* metadata,
+                  unsigned resolutions)
+{
+    if (header == NULL || metadata == NULL || resolutions == 0) return ORIG_RES;
+
+    for (int from = 0; from < ORIG_RES; ++from) {
+        if ((resolutions & RES_BIT(from)) != 0 || metadata->size[from] == 0) continue;
+        int usable = 1;
+        for (int to = 0; to < ORIG_RES && usable; ++to) {
+            if ((resolutions & RES_BIT(to)) != 0 && !can_cascade(header, from, to)) usable = 0;
+        }
+        if (usable) return from;
+    }
+    return ORIG_RES;
+}
+
+/*******************************************************************
+ * Same, for any size
+ */
+int rendition_source(const struct imgfs_header* header, const struct img_metadata* metadata,
+                     uint32_t width, uint32_t height)
+{
+    if (header == NULL || metadata == NULL) return ORIG_RES;
+
+    for (int from = 0; from < ORIG_RES; ++from) {
+        if (metadata->size[from] != 0 && can_resize_from(header, from, width, height)) return from;
+    }
+    return ORIG_RES;
+}
+
+/*******************************************************************
+ * Encodes a resized image in either codec
+ */
+static int encode(VipsImage* image, enum image_codec codec, void** resized, size_t* resized_size)
+{
+    const int saved = codec == CODEC_WEBP
+                      ? vips_webpsave_buffer(image, resized, resized_size, NULL)
+                      : vips_jpegsave_buffer(image, resized, resized_size, NULL);
+    return saved != 0 ? ERR_IMGLIB : ERR_NONE;
+}
+
+/*******************************************************************
+ * One resize, straight from compressed content, in either codec
+ */
+int resize_content(const void* source, size_t source_size, uint32_t width, uint32_t height,
+                   enum image_codec codec, void** resized, size_t* resized_size)
+{
+    M_REQUIRE_NON_NULL(source);
+    M_REQUIRE_NON_NULL(resized);
+    M_REQUIRE_NON_NULL(resized_size);
+    if (width == 0 || height == 0) return ERR_RESOLUTIONS;
+    if (codec != CODEC_JPEG && codec != CODEC_WEBP) return ERR_INVALID_ARGUMENT;
+
+    // Load and resize the image to the requested resolution
+    VipsImage *resized_image = NULL;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+    if (vips_thumbnail_buffer((void*) source, source_size, &resized_image, (int) width, "height",
+                              (int) height, NULL) != ERR_NONE) {
+        return ERR_IMGLIB;
+    }
+#pragma GCC diagnostic pop
+
+    // Save the resized image to a buffer
+    const int err = encode(resized_image, codec, resized, resized_size);
+    g_object_unref(resized_image);
+    return err;
+}
+
+/*******************************************************************
+ * A content stored in the imgFS file, read by libvips as it decodes
+ */
+struct stored_stream {
+    const struct imgfs_file* imgfs_file;
+    uint64_t offset;   // of the content in the file
+    uint32_t size;     // of the content
+    uint32_t position; // within the content
+};
+
+static gint64 stream_read(VipsSourceCustom* source, void* buffer, gint64 length, void* user)
+{
+    (void) source;
+    struct stored_stream* stream = user;
+    const uint32_t left = stream->size - stream->position;
+    const uint32_t count = length < (gint64) left ? (uint32_t) length : left;
+    if (count == 0) return 0;
+
+    // pread(): no file position shared with the other readers
+    if (read_at(stream->imgfs_file, buffer, count, stream->offset + stream->position) != ERR_NONE) {
+        return -1;
+    }
+    stream->position += count;
+    return count;
+}
+
+static gint64 stream_seek(VipsSourceCustom* source, gint64 offset, int whence, void* user)
+{
+    (void) source;
+    struct stored_stream* stream = user;
+    const gint64 base = whence == SEEK_SET ? 0
+                        : whence == SEEK_CUR ? (gint64) stream->position
+                        : whence == SEEK_END ? (gint64) stream->size : -1;
+    if (base == -1 || base + offset < 0 || base + offset > (gint64) stream->size) return -1;
+
+    stream->position = (uint32_t) (base + offset);
+    return stream->position;
+}
+
+/*******************************************************************
+ * One resize of a content stored in the imgFS file: decoded with
+ * sequential access, as it is read, so never wholly in memory
+ */
+static int resize_streamed(const struct imgfs_file* imgfs_file, uint64_t offset, uint32_t size,
+                           uint32_t width, uint32_t height, enum image_codec codec,
+                           void** resized, size_t* resized_size)
+{
+    struct stored_stream stream = { imgfs_file, offset, size, 0 };
+    VipsSourceCustom* source = vips_source_custom_new();
+    if (source == NULL) return ERR_IMGLIB;
+    g_signal_connect(source, "read", G_CALLBACK(stream_read), &stream);
+    g_signal_connect(source, "seek", G_CALLBACK(stream_seek), &stream);
+
+    // The pipeline only pulls the source while being encoded
+    VipsImage* resized_image = NULL;
+    int err = ERR_NONE;
+    if (vips_thumbnail_source(VIPS_SOURCE(source), &resized_image, (int) width, "height", (int) height,
+                              NULL) != 0) {
+        err = ERR_IMGLIB;
+    } else {
+        err = encode(resized_image, codec, resized, resized_size);
+        g_object_unref(resized_image);
+    }
+    g_object_unref(source);
+    return err;
+}
+
+int resize_stored_content(const struct imgfs_file* imgfs_file, uint64_t offset, uint32_t size,
+                          uint32_t width, uint32_t height, enum image_codec codec,
+                          void** resized, size_t* resized_size)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(resized);
+    M_REQUIRE_NON_NULL(resized_size);
+    if (width == 0 || height == 0) return ERR_RESOLUTIONS;
+    if (codec != CODEC_JPEG && codec != CODEC_WEBP) return ERR_INVALID_ARGUMENT;
+
+    return resize_streamed(imgfs_file, offset, size, width, height, codec, resized, resized_size);
+}
+
+/*******************************************************************
+ * Where the source of the resizes is: in memory, or in the imgFS file
+ */
+struct resize_from {
+    const void* content;                 // NULL: stored in imgfs_file
+    const struct imgfs_file* imgfs_file;
+    uint64_t offset;
+    size_t size;
+};
+
+/*******************************************************************
+ * Resizes straight from compressed content, for each requested
+ * resolution: libvips then decodes the JPEG already shrunk (shrink-on-load),
+ * which costs much less than decoding it at full size. The largest
+ * resolutions go first, so that the smaller ones can cascade from them.
+ */
+static int resize_cascade(const struct imgfs_header* header, unsigned resolutions, int source_res,
+                          const struct resize_from* source,
+                          void* resized[NB_RES], size_t resized_size[NB_RES])
+{
+    if (resolutions == 0 || (resolutions & RES_BIT(ORIG_RES)) != 0 || resolutions >= RES_BIT(NB_RES)
+        || source_res < 0 || source_res > ORIG_RES) {
+        return ERR_RESOLUTIONS;
+    }
+    // Never upscale, nor lose quality, from a variant
+    for (int res = 0; res < ORIG_RES && source_res != ORIG_RES; ++res) {
+        if ((resolutions & RES_BIT(res)) != 0 && !can_cascade(header, source_res, res)) {
+            return ERR_RESOLUTIONS;
+        }
+    }
+    for (int res = 0; res < NB_RES; ++res) {
+        resized[res] = NULL;
+        resized_size[res] = 0;
+    }
+
+    int err = ERR_NONE;
+    for (int res = ORIG_RES - 1; res >= 0 && err == ERR_NONE; --res) {
+        if ((resolutions & RES_BIT(res)) == 0) continue;
+        const uint32_t width = header->resized_res[2*res];
+        const uint32_t height = header->resized_res[(2*res) + 1];
+
+        // From the smallest suitable variant just created, if any
+        const void* from = source->content;
+        size_t from_size = source->size;
+        for (int larger = res + 1; larger < ORIG_RES; ++larger) {
+            if (resized[larger] != NULL && can_cascade(header, larger, res)) {
+                from = resized[larger];
+                from_size = resized_size[larger];
+                break;
+            }
+        }
+
+        err = from != NULL
+              ? resize_content(from, from_size, width, height, CODEC_JPEG, &resized[res], &resized_size[res])
+              : resize_streamed(source->imgfs_file, source->offset, (uint32_t) source->size, width, height,
+                                CODEC_JPEG, &resized[res], &resized_size[res]);
+    }
+
+    // Clean up resources
+    if (err != ERR_NONE) {
+        for (int res = 0; res < NB_RES; ++res) {
+            g_free(resized[res]);
+            resized[res] = NULL;
+            resized_size[res] = 0;
+        }
+    }
+    return err;
+}
+
+int resize_contents(const struct imgfs_header* header, unsigned resolutions, int source_res,
+                    const void* source, size_t source_size,
+                    void* resized[NB_RES], size_t resized_size[NB_RES])
+{
+    M_REQUIRE_NON_NULL(header);
+    M_REQUIRE_NON_NULL(source);
+    M_REQUIRE_NON_NULL(resized);
+    M_REQUIRE_NON_NULL(resized_size);
+
+    const struct resize_from from = { source, NULL, 0, source_size };
+    return resize_cascade(header, resolutions, source_res, &from, resized, resized_size);
+}
+
+int resize_stored(const struct imgfs_file* imgfs_file, const struct imgfs_header* header,
+                  unsigned resolutions, int source_res, uint64_t source_offset, uint32_t source_size,
+                  void* resized[NB_RES], size_t resized_size[NB_RES])
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(header);
+    M_REQUIRE_NON_NULL(resized);
+    M_REQUIRE_NON_NULL(resized_size);
+
+    const struct resize_from from = { NULL, imgfs_file, source_offset, source_size };
+    return resize_cascade(header, resolutions, source_res, &from, resized, resized_size);
+}
+
+/*******************************************************************
+ * Variants belong to a content: every image with that content gets them
+ */
+int share_variants(struct imgfs_file* imgfs_file, size_t index)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    if (index >= imgfs_file->header.max_files || imgfs_file->metadata[index].is_valid != NON_EMPTY) {
+        return ERR_INVALID_IMGID;
+    }
+
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+    const uint32_t orig_size = image->size[ORIG_RES];
+
+    // The variants found among the aliases...
+    uint64_t offsets[NB_RES] = {0};
+    uint32_t sizes[NB_RES] = {0};
+    int missing = 0;
+    uint32_t cursor = 0;
+    for (int j; (j = content_index_next(imgfs_file, image->SHA, &cursor)) != -1; ) {
+        const struct img_metadata* alias = &imgfs_file->metadata[j];
+        if (alias->size[ORIG_RES] != orig_size) continue;
+        for (int res = 0; res < ORIG_RES; ++res) {
+            if (alias->size[res] == 0) {
+                missing = 1;
+            } else if (sizes[res] == 0) {
+                offsets[res] = alias->offset[res];
+                sizes[res] = alias->size[res];
+            }
+        }
+    }
+    if (!missing) return ERR_NONE;
+
+    // ...given to the ones lacking them
+    int err = ERR_NONE;
+    cursor = 0;
+    for (int j; err == ERR_NONE && (j = content_index_next(imgfs_file, image->SHA, &cursor)) != -1; ) {
+        struct img_metadata* alias = &imgfs_file->metadata[j];
+        if (alias->size[ORIG_RES] != orig_size) continue;
+        int changed = 0;
+        for (int res = 0; res < ORIG_RES; ++res) {
+            if (alias->size[res] == 0 && sizes[res] != 0) {
+                alias->offset[res] = offsets[res];
+                alias->size[res] = sizes[res];
+                changed = 1;
+            }
+        }
+        if (changed) err = write_metadata_hot(imgfs_file, (uint32_t) j);
+    }
+    return err;
+}
+
+/*******************************************************************
+ * Gives back the space of the contents appended for resolutions
+ * below end, latest first, so that each one is at the end of the file
+ */
+static void release_variants(struct imgfs_file* imgfs_file, int end, const uint64_t offsets[NB_RES],
+                             void* const contents[NB_RES], const size_t sizes[NB_RES])
+{
+    for (int res = end - 1; res >= 0; --res) {
+        if (contents[res] != NULL) release_data(imgfs_file, offsets[res], sizes[res]);
+    }
+}
+
+/*******************************************************************
+ * Appends the resized contents and records them with a single metadata write
+ */
+int store_variants(struct imgfs_file* imgfs_file, size_t index,
+                   void* const contents[NB_RES], const size_t sizes[NB_RES])
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(contents);
+    M_REQUIRE_NON_NULL(sizes);
+    if (index >= imgfs_file->header.max_files) return ERR_INVALID_IMGID;
+    if (contents[ORIG_RES] != NULL) return ERR_RESOLUTIONS;
+
+    // Append the buffers to the end of imgFS file
+    uint64_t offsets[NB_RES] = {0};
+    int stored = 0;
+    for (int res = 0; res < ORIG_RES; ++res) {
+        if (contents[res] == NULL) continue;
+        if (append_data(imgfs_file, contents[res], sizes[res], &offsets[res]) != ERR_NONE) {
+            // The ones appended before are not recorded either
+            release_variants(imgfs_file, res, offsets, contents, sizes);
+            return ERR_IO;
+        }
+        ++stored;
+    }
+    if (stored == 0) return ERR_NONE;
+
+    // Update metadata in memory and on disk
+    const struct img_metadata previous = imgfs_file->metadata[index];
+    for (int res = 0; res < ORIG_RES; ++res) {
+        if (contents[res] == NULL) continue;
+        imgfs_file->metadata[index].size[res] = (uint32_t) sizes[res];
+        imgfs_file->metadata[index].offset[res] = offsets[res];
+    }
+    const int err = write_metadata_hot(imgfs_file, (uint32_t) index);
+    if (err != ERR_NONE) {
+        imgfs_file->metadata[index] = previous;
+        refresh_hot(imgfs_file, (uint32_t) index, 1);
+        release_variants(imgfs_file, ORIG_RES, offsets, contents, sizes);
+        return err;
+    }
+    if (imgfs_file->metadata[index].is_valid != NON_EMPTY) return ERR_NONE;
+
+    // The images with the same content can use them right away
+    return share_variants(imgfs_file, index);
+}
+
+/*******************************************************************
+ * Creates the missing variants among resolutions, from a single pass over the source
+ */
+static int create_variants(struct imgfs_file* imgfs_file, size_t index, unsigned resolutions)
+{
+    // Maybe already created for the same content
+    int err = share_variants(imgfs_file, index);
+    if (err != ERR_NONE) return err;
+
+    for (int res = 0; res < ORIG_RES; ++res) {
+        if (imgfs_file->metadata[index].size[res] != 0) resolutions &= ~RES_BIT(res);
+    }
+    if (resolutions == 0) return ERR_NONE;
+
+    // Resize from the original or a larger variant, streamed from the disk
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+    const int source_res = resize_source(&imgfs_file->header, image, resolutions);
+
+    void* resized[NB_RES];
+    size_t resized_size[NB_RES];
+    err = resize_stored(imgfs_file, &imgfs_file->header, resolutions, source_res,
+                        image->offset[source_res], image->size[source_res], resized, resized_size);
+    if (err != ERR_NONE) return err;
+
+    err = store_variants(imgfs_file, index, resized, resized_size);
+    for (int res = 0; res < NB_RES; ++res) {
+        g_free(resized[res]);
+    }
+    return err;
+}
+
 /**
  * @brief Lazily resizes an image to the requested resolution.
  *
@@ -37,84 +448,85 @@ int lazily_resize(int resolution, struct imgfs_file* imgfs_file, size_t index)
     // If the requested image already exists in the corresponding resolution, do nothing;
     if (resolution == ORIG_RES) return ERR_NONE;
 
-    // Check if the image already exists in the requested resolution
-    if (imgfs_file->metadata[index].size[resolution] != 0) return ERR_NONE;
+    return create_variants(imgfs_file, index, RES_BIT(resolution));
+}
 
+/*******************************************************************
+ * All the resized resolutions at once
+ */
+int resize_all(struct imgfs_file* imgfs_file, size_t index)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
 
-    // Read the original image from disk into buffer and allocate space for buffer
-    VipsImage *original_image;
-    unsigned char *buffer = malloc(imgfs_file->metadata[index].size[ORIG_RES]);
-    if (buffer == NULL) {
-        freeMemory(buffer);
-        return ERR_OUT_OF_MEMORY;
-    }
-    //Seek offset at which image is stored
-    if (fseek(imgfs_file->file,(long)imgfs_file->metadata[index].offset[ORIG_RES],SEEK_SET) != ERR_NONE) {
-        freeMemory(buffer);
-        return ERR_IO;
-    }
-    if (fread(buffer,imgfs_file->metadata[index].size[ORIG_RES],1,imgfs_file->file) != 1) {
-        freeMemory(buffer);
-        return ERR_IO;
+    if (index >= imgfs_file->header.max_files || imgfs_file->metadata[index].is_valid == 0) {
+        return ERR_INVALID_IMGID;
     }
-    //Create VipsImage from buffer
-    if (vips_jpegload_buffer(buffer,imgfs_file->metadata[index].size[ORIG_RES],&original_image, NULL)!=ERR_NONE) {
-        freeMemory(buffer);
-        return ERR_IO;
-    };
-
 
+    return create_variants(imgfs_file, index, RES_BIT(THUMB_RES) | RES_BIT(SMALL_RES));
+}
 
-    // Resize the image to the requested resolution
-    VipsImage *resized_image = NULL;
-    if (vips_thumbnail_image(original_image, &resized_image, imgfs_file->header.resized_res[2*resolution], "height",
-                             imgfs_file->header.resized_res[(2*resolution) + 1],NULL) != ERR_NONE) {
-        freeMemory(buffer);
-        g_object_unref(original_image);
-        return ERR_IMGLIB;
-    }
 
-    // Save the resized image to a buffer
-    unsigned char *buffer2 = NULL;
-    size_t buffer_size = 0;
+/*******************************************************************
+ * JPEG markers (ITU T.81, B.1.1.3)
+ */
+#define JPEG_MARKER       0xFF
+#define JPEG_SOI          0xD8 // start of image
+#define JPEG_EOI          0xD9 // end of image
+#define JPEG_SOS          0xDA // start of scan: the compressed data follows
+#define JPEG_SOF_FIRST    0xC0 // SOF0 (baseline) ... SOF15...
+#define JPEG_SOF_LAST     0xCF
+#define JPEG_DHT          0xC4 // ...except these three, in the same range
+#define JPEG_JPG          0xC8
+#define JPEG_DAC          0xCC
+#define JPEG_TEM          0x01 // standalone markers, without length
+#define JPEG_RST_FIRST    0xD0
+#define JPEG_RST_LAST     0xD7
+// Length, precision, height and width of a SOF segment
+#define JPEG_SOF_MIN_LENGTH 7
 
-    if (vips_jpegsave_buffer(resized_image, (void**)&buffer2, (size_t *)&buffer_size, NULL) != 0) {
-        freeMemory(buffer);
-        g_object_unref(original_image);
-        g_object_unref(resized_image);
-        return ERR_IMGLIB;
-    }
+/*******************************************************************
+ * Reads the dimensions from the frame header (SOF segment) of a JPEG,
+ * without decoding anything. Fails on anything unexpected, leaving
+ * the decision to libvips.
+ */
+static int jpeg_dimensions(const unsigned char* jpeg, size_t size, uint32_t* height, uint32_t* width)
+{
+    if (size < 2 || jpeg[0] != JPEG_MARKER || jpeg[1] != JPEG_SOI) return -1;
 
-    // Clean up resources
-    g_object_unref(original_image);
-    g_object_unref(resized_image);
-    freeMemory(buffer);
+    size_t pos = 2;
+    while (pos + 1 < size) {
+        if (jpeg[pos] != JPEG_MARKER) return -1;
+        // Any number of fill bytes may precede a marker
+        while (pos + 1 < size && jpeg[pos + 1] == JPEG_MARKER) ++pos;
+        if (pos + 1 >= size) return -1;
 
-    // Append the buffer to the end of imgFS file
-    if (fseek(imgfs_file->file, 0, SEEK_END) != ERR_NONE) {
-        return ERR_IO;
-    }
-    // Update metadata in memory and on disk
-    imgfs_file->metadata[index].size[resolution] = buffer_size;
-    imgfs_file->metadata[index].offset[resolution] = (uint64_t) ftell(imgfs_file->file);
-    if (fwrite(buffer2, buffer_size, 1, imgfs_file->file) != 1) {
-        freeMemory(buffer2);
-        return ERR_IO;
-    }
+        const unsigned char marker = jpeg[pos + 1];
+        pos += 2;
+        if (marker == JPEG_TEM || (marker >= JPEG_RST_FIRST && marker <= JPEG_RST_LAST)) continue;
+        if (marker == JPEG_SOI || marker == JPEG_EOI || marker == JPEG_SOS) return -1;
 
-    freeMemory(buffer2);
+        // All other segments start with their length, itself included
+        if (pos + 2 > size) return -1;
+        const size_t length = ((size_t) jpeg[pos] << 8) | jpeg[pos + 1];
+        if (length < 2 || pos + length > size) return -1;
 
-    if (fseek(imgfs_file->file, (long)(sizeof(struct imgfs_header) + (index * sizeof(struct img_metadata))), SEEK_SET) != 0) {
-        return ERR_IO;
+        if (marker >= JPEG_SOF_FIRST && marker <= JPEG_SOF_LAST
+            && marker != JPEG_DHT && marker != JPEG_JPG && marker != JPEG_DAC) {
+            if (length < JPEG_SOF_MIN_LENGTH) return -1;
+            const uint32_t h = ((uint32_t) jpeg[pos + 3] << 8) | jpeg[pos + 4];
+            const uint32_t w = ((uint32_t) jpeg[pos + 5] << 8) | jpeg[pos + 6];
+            // A zero height is given later, by a DNL segment
+            if (h == 0 || w == 0) return -1;
+            *height = h;
+            *width = w;
+            return 0;
+        }
+        pos += length;
     }
-    if (fwrite(&imgfs_file->metadata[index], sizeof(struct img_metadata), 1, imgfs_file->file) != 1) {
-        return ERR_IO;
-    }
-
-    return ERR_NONE;
+    return -1;
 }
 
-
 /**
  * @brief Gets the resolution of an image.
  *
@@ -132,6 +544,11 @@ int get_resolution(uint32_t *height, uint32_t *width,
     M_REQUIRE_NON_NULL(width);
     M_REQUIRE_NON_NULL(image_buffer);
 
+    // Straight from the header for the usual JPEG files
+    if (jpeg_dimensions((const unsigned char*) image_buffer, image_size, height, width) == 0) {
+        return ERR_NONE;
+    }
+
     VipsImage *original = NULL;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-qual"
@@ -146,3 +563,51 @@ int get_resolution(uint32_t *height, uint32_t *width,
     g_object_unref(VIPS_OBJECT(original));
     return ERR_NONE;
 }
+
+// Where the frame header of the usual JPEG files is, after their EXIF data
+#define RESOLUTION_HEAD_SIZE 65536u
+
+/**
+ * @brief Gets the resolution of an image stored in the imgFS file.
+ *
+ * @param imgfs_file The imgFS file the content is stored in
+ * @param offset The offset of the content in the file
+ * @param size The size of the content
+ * @param height Where to put the image height.
+ * @param width Where to put the image width.
+ * @return Some error code. 0 if no error.
+ */
+int get_stored_resolution(const struct imgfs_file* imgfs_file, uint64_t offset, uint32_t size,
+                          uint32_t* height, uint32_t* width)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(height);
+    M_REQUIRE_NON_NULL(width);
+    if (size == 0) return ERR_INVALID_ARGUMENT;
+
+    const uint32_t head_size = size < RESOLUTION_HEAD_SIZE ? size : RESOLUTION_HEAD_SIZE;
+    unsigned char* head = malloc(head_size);
+    if (head == NULL) return ERR_OUT_OF_MEMORY;
+    int err = read_at(imgfs_file, head, head_size, offset);
+    const int found = err == ERR_NONE && jpeg_dimensions(head, head_size, height, width) == 0;
+    free(head);
+    if (err != ERR_NONE || found) return err;
+
+    // The whole content, read by libvips as it needs
+    struct stored_stream stream = { imgfs_file, offset, size, 0 };
+    VipsSourceCustom* source = vips_source_custom_new();
+    if (source == NULL) return ERR_IMGLIB;
+    g_signal_connect(source, "read", G_CALLBACK(stream_read), &stream);
+    g_signal_connect(source, "seek", G_CALLBACK(stream_seek), &stream);
+
+    VipsImage* original = NULL;
+    if (vips_jpegload_source(VIPS_SOURCE(source), &original, NULL) != 0) {
+        err = ERR_IMGLIB;
+    } else {
+        *height = (uint32_t) vips_image_get_height(original);
+        *width = (uint32_t) vips_image_get_width(original);
+        g_object_unref(original);
+    }
+    g_object_unref(source);
+    return err;
+}
@@ -16,8 +16,23 @@
 extern "C" {
 #endif
 
+// Bit of a resolution in a set of resolutions
+#define RES_BIT(res) (1u << (res))
+
+// A variant is only resized from another one at least that many times larger
+#define CASCADE_MIN_RATIO 2
+
+// Encodings of the resized contents
+enum image_codec {
+    CODEC_JPEG,
+    CODEC_WEBP,
+    NB_CODECS
+};
+
 /**
  * @brief Gets the resolution of an image.
+ *        Read from the frame header of the JPEG when possible, without
+ *        decoding the image; libvips is only used for the other files.
  *
  * @param height Where to put the calculated image height.
  * @param width Where to put the calculated image width.
@@ -27,6 +42,21 @@ extern "C" {
  */
 int get_resolution(uint32_t *height, uint32_t *width, const char *image_buffer, size_t image_size);
 
+/**
+ * @brief Like get_resolution(), for a content stored in the imgFS file:
+ *        only its beginning is read for the usual JPEG files, and libvips
+ *        reads the others as it needs. Only reads the file, with pread().
+ *
+ * @param imgfs_file The imgFS file the content is stored in
+ * @param offset The offset of the content in the file
+ * @param size The size of the content
+ * @param height Where to put the image height.
+ * @param width Where to put the image width.
+ * @return Some error code. 0 if no error.
+ */
+int get_stored_resolution(const struct imgfs_file* imgfs_file, uint64_t offset, uint32_t size,
+                          uint32_t* height, uint32_t* width);
+
 /**
  * @brief Resize the image to the given resolution, if it does not already
  * exists, and updates the metadata on the disk.
@@ -38,6 +68,151 @@ int get_resolution(uint32_t *height, uint32_t *width, const char *image_buffer,
  */
 int lazily_resize(int resolution, struct imgfs_file* imgfs_file, size_t index);
 
+/**
+ * @brief Creates all the missing resized variants of an image at once:
+ *        the original is read a single time, and the metadata written
+ *        a single time.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @return Some error code. 0 if no error.
+ */
+int resize_all(struct imgfs_file* imgfs_file, size_t index);
+
+/**
+ * @brief Gives the image the variants already created for another image
+ *        with the same content, and its own variants to those lacking them.
+ *        Variants are thus created once per content, not per image ID.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @return Some error code. 0 if no error.
+ */
+int share_variants(struct imgfs_file* imgfs_file, size_t index);
+
+/**
+ * @brief Chooses what to resize an image from: the smallest of its stored
+ *        variants at least CASCADE_MIN_RATIO times larger (in both dimensions)
+ *        than every wanted resolution, the original otherwise.
+ *
+ * @param header The header giving the resized resolutions
+ * @param metadata The metadata of the image
+ * @param resolutions The set of resolutions wanted (RES_BIT() of THUMB_RES and/or SMALL_RES)
+ * @return The resolution of the source, ORIG_RES if no variant fits (or on NULL arguments).
+ */
+int resize_source(const struct imgfs_header* header, const struct img_metadata* metadata,
+                  unsigned resolutions);
+
+/**
+ * @brief Chooses what to resize an image to any width x height from:
+ *        the smallest of its stored variants at least CASCADE_MIN_RATIO
+ *        times larger (in both dimensions), the original otherwise.
+ *
+ * @param header The header giving the resized resolutions
+ * @param metadata The metadata of the image
+ * @param width The width of the box to fit the image in
+ * @param height The height of the box to fit the image in
+ * @return The resolution of the source, ORIG_RES if no variant fits (or on NULL arguments).
+ */
+int rendition_source(const struct imgfs_header* header, const struct img_metadata* metadata,
+                     uint32_t width, uint32_t height);
+
+/**
+ * @brief Resizes (JPEG) content to fit in width x height, keeping its aspect ratio.
+ *        Decoded already shrunk by the JPEG decoder (shrink-on-load).
+ *
+ * @param source The (JPEG) content to resize
+ * @param source_size The size of the source content
+ * @param width The width of the box to fit the image in
+ * @param height The height of the box to fit the image in
+ * @param codec The encoding of the resized content
+ * @param resized Where to put the resized content; to be freed with g_free()
+ * @param resized_size Where to put the size of the resized content
+ * @return Some error code. 0 if no error.
+ */
+int resize_content(const void* source, size_t source_size, uint32_t width, uint32_t height,
+                   enum image_codec codec, void** resized, size_t* resized_size);
+
+/**
+ * @brief Like resize_content(), from a content stored in the imgFS file.
+ *        It is streamed from the file to the decoder, never read wholly
+ *        in memory. Only reads the file, with pread(), so it can run
+ *        without holding the lock, as long as the contents are not moved
+ *        meanwhile (see do_grow()).
+ *
+ * @param imgfs_file The imgFS file the source is stored in
+ * @param offset The offset of the source in the file
+ * @param size The size of the source
+ * @param width The width of the box to fit the image in
+ * @param height The height of the box to fit the image in
+ * @param codec The encoding of the resized content
+ * @param resized Where to put the resized content; to be freed with g_free()
+ * @param resized_size Where to put the size of the resized content
+ * @return Some error code. 0 if no error.
+ */
+int resize_stored_content(const struct imgfs_file* imgfs_file, uint64_t offset, uint32_t size,
+                          uint32_t width, uint32_t height, enum image_codec codec,
+                          void** resized, size_t* resized_size);
+
+/**
+ * @brief Computes the content of an image at smaller resolutions.
+ *        Each one is decoded from compressed content, already shrunk by
+ *        the JPEG decoder (shrink-on-load), instead of from a full-size decode.
+ *        The smaller resolutions are resized from the larger ones created
+ *        in the same call, when at least CASCADE_MIN_RATIO times larger.
+ *        Does not use the imgFS file, so it can run without holding any lock on it.
+ *
+ * @param header The header giving the resized resolutions
+ * @param resolutions The set of resolutions wanted (RES_BIT() of THUMB_RES and/or SMALL_RES)
+ * @param source_res The resolution of source, see resize_source()
+ * @param source The (JPEG) content to resize
+ * @param source_size The size of the source content
+ * @param resized Where to put the resized (JPEG) content of each resolution,
+ *        NULL for the ones not wanted; to be freed with g_free()
+ * @param resized_size Where to put the size of each resized content
+ * @return Some error code. 0 if no error.
+ */
+int resize_contents(const struct imgfs_header* header, unsigned resolutions, int source_res,
+                    const void* source, size_t source_size,
+                    void* resized[NB_RES], size_t resized_size[NB_RES]);
+
+/**
+ * @brief Like resize_contents(), from a content stored in the imgFS file.
+ *        It is streamed from the file to the decoder with sequential
+ *        access, never read wholly in memory: the memory used does not
+ *        depend on the size of the original. Only reads the file, with
+ *        pread(), so it can run without holding the lock, as long as the
+ *        contents are not moved meanwhile (see do_grow()).
+ *
+ * @param imgfs_file The imgFS file the source is stored in
+ * @param header The header giving the resized resolutions
+ * @param resolutions The set of resolutions wanted (RES_BIT() of THUMB_RES and/or SMALL_RES)
+ * @param source_res The resolution of the source, see resize_source()
+ * @param source_offset The offset of the source in the file
+ * @param source_size The size of the source
+ * @param resized Where to put the resized (JPEG) content of each resolution,
+ *        NULL for the ones not wanted; to be freed with g_free()
+ * @param resized_size Where to put the size of each resized content
+ * @return Some error code. 0 if no error.
+ */
+int resize_stored(const struct imgfs_file* imgfs_file, const struct imgfs_header* header,
+                  unsigned resolutions, int source_res, uint64_t source_offset, uint32_t source_size,
+                  void* resized[NB_RES], size_t resized_size[NB_RES]);
+
+/**
+ * @brief Appends resized contents to the imgFS file and records them in
+ *        the metadata of the image, in memory and on the disk (a single write),
+ *        then shares them with the images having the same content.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @param contents The resized content of each resolution, NULL for the ones to leave as is
+ * @param sizes The size of each resized content
+ * @return Some error code. 0 if no error.
+ */
+int store_variants(struct imgfs_file* imgfs_file, size_t index,
+                   void* const contents[NB_RES], const size_t sizes[NB_RES]);
+
 #ifdef __cplusplus
 }
 #endif
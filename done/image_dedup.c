@@ -1,4 +1,5 @@
 #include "imgfs.h"  // for struct imgfs_file
+#include "imgfs_index.h" // for name_index_find(), content_index_find()
 #include <string.h>
 #define true 1
 #define false 0
@@ -26,19 +27,19 @@ int do_name_and_content_dedup(struct imgfs_file* imgfs_file, uint32_t index)
 
     struct img_metadata* image_i = &imgfs_file->metadata[index];
 
-    // Iterate through the metadata array to find duplicates
-    for(int i=0; i < max_files; i++) {
-        struct img_metadata* metadata = &imgfs_file->metadata[i];
-        if(metadata->is_valid && i!=index) {
-            if(strcmp(metadata->img_id,image_i->img_id)==0 ) return ERR_DUPLICATE_ID ;
-            // Copy resolution, offset, and size information from the duplicate
-            if(memcmp(metadata->SHA,image_i->SHA,SHA256_DIGEST_LENGTH)==0) {
-                memcpy(image_i->orig_res, metadata->orig_res, sizeof(metadata->orig_res));
-                memcpy(image_i->offset, metadata->offset, sizeof(metadata->offset));
-                memcpy(image_i->size, metadata->size, sizeof(metadata->size));
-                return ERR_NONE;
-            }
-        }
+    // Same ID already used by another valid image
+    int same_id = name_index_find(imgfs_file, image_i->img_id);
+    if (same_id != -1 && (uint32_t) same_id != index) return ERR_DUPLICATE_ID;
+
+    // Same content already stored by another valid image
+    int same_content = content_index_find(imgfs_file, image_i->SHA);
+    if (same_content != -1 && (uint32_t) same_content != index) {
+        // Copy resolution, offset, and size information from the duplicate
+        const struct img_metadata* metadata = &imgfs_file->metadata[same_content];
+        memcpy(image_i->orig_res, metadata->orig_res, sizeof(metadata->orig_res));
+        memcpy(image_i->offset, metadata->offset, sizeof(metadata->offset));
+        memcpy(image_i->size, metadata->size, sizeof(metadata->size));
+        return ERR_NONE;
     }
 
     // No duplicate found, set the original resolution offset to 0
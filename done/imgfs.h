@@ -11,6 +11,16 @@
  * should be stored as raw bytes appended at the end of the imgFS
  * file and addressed by offsets in the metadata structure.
  *
+ * Format v2 (imgfs_header.unused_32 == IMGFS_FORMAT_V2) stores the same
+ * metadata split in three regions after the header: the frequently
+ * accessed fields (struct img_metadata_hot) of all the images, then all
+ * the image IDs, then all the SHA digests. In memory, both formats use
+ * the same array of struct img_metadata; v2 also keeps the hot fields in
+ * an array of their own (imgfs_file.hot), which the slot scans (listing,
+ * free-slot search, index builds) walk instead of the full entries. An
+ * update of the hot fields only writes 48 bytes instead of a whole entry.
+ * v2 files cannot be mapped (see do_open_mmap()).
+ *
  * @author Mia Primorac
  */
 
@@ -21,6 +31,7 @@
                     * all the functions of this lib.
                     */
 #include <openssl/sha.h>   // for SHA256_DIGEST_LENGTH
+#include <stddef.h>        // for size_t
 #include <stdint.h>        // for uint32_t, uint64_t
 #include <stdio.h>         // for FILE
 
@@ -34,6 +45,10 @@
 #define EMPTY     0
 #define NON_EMPTY 1
 
+// On-disk format versions, stored in imgfs_header.unused_32
+#define IMGFS_FORMAT_V1 0
+#define IMGFS_FORMAT_V2 2
+
 // imgFS library internal codes for different image resolutions
 #define THUMB_RES 0
 #define SMALL_RES 1
@@ -66,13 +81,50 @@ struct img_metadata {
     uint16_t unused_16;
 };
 
+// Frequently accessed part of struct img_metadata, as stored by format v2
+struct img_metadata_hot {
+    uint64_t offset[NB_RES];
+    uint32_t size[NB_RES];
+    uint32_t orig_res[2];
+    uint16_t is_valid;
+    uint16_t unused_16;
+};
+
+struct imgfs_index; // see imgfs_index.h
+struct imgfs_slots; // see imgfs_index.h
+struct imgfs_batch; // see imgfs_batch.h
+struct img_codec_variants; // see imgfs_codecs.h
+
 // Structure representing the ImgFS file
 struct imgfs_file {
     FILE* file;
     struct imgfs_header header;
     struct img_metadata* metadata;
+    struct img_metadata_hot* hot;      // format v2: copy of the hot fields of metadata, or NULL
+    struct imgfs_index* name_index;    // img_id -> metadata slot, in memory only
+    struct imgfs_index* content_index; // SHA -> metadata slot, in memory only
+    struct imgfs_slots* empty_slots;   // bitmap of the EMPTY slots, in memory only
+    void* mapping;                     // header + metadata region mapped by do_open_mmap(), or NULL
+    size_t mapping_size;               // length of that mapping in bytes
+    struct imgfs_batch* batch;         // pending header/metadata writes, or NULL to write through
+    struct img_codec_variants* codecs; // codec region (WebP variants) read at opening, or NULL
 };
 
+/**
+ * @brief Tells whether a slot is EMPTY or NON_EMPTY, from the hot array
+ *        when there is one, so that scans over all the slots do not
+ *        touch the image IDs and SHAs.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param index The index of the slot, below header.max_files.
+ * @return The is_valid field of that slot.
+ */
+static inline uint16_t slot_state(const struct imgfs_file* imgfs_file, uint32_t index)
+{
+    return imgfs_file->hot != NULL ? imgfs_file->hot[index].is_valid
+           : imgfs_file->metadata[index].is_valid;
+}
+
 
 /**
  * @brief Prints imgFS header informations.
@@ -99,6 +151,160 @@ int do_open(const char* imgfs_filename,
             const char* open_mode,
             struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Open imgFS file and map its header and metadata region in memory.
+ *        The metadata array then points into the mapping: pages are only
+ *        read from disk when first touched, and metadata updates go to the
+ *        file through the mapping (see write_metadata()).
+ *        Files opened read-only get a private mapping, which is never written back.
+ *        Format v2 files are not mapped, but read as with do_open().
+ *
+ * @param imgfs_filename Path to the imgFS file
+ * @param open_mode Mode for fopen(), eg.: "rb", "rb+", etc.
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @return Some error code. 0 if no error.
+ */
+int do_open_mmap(const char* imgfs_filename,
+                 const char* open_mode,
+                 struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Reads size bytes at the given offset of the imgFS file.
+ *        Uses positional I/O: the file cursor is neither used nor moved,
+ *        so concurrent calls on the same imgfs_file are safe.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param buffer Where to put the bytes read.
+ * @param size The number of bytes to read.
+ * @param offset The position of the first byte in the file.
+ * @return Some error code. 0 if no error.
+ */
+int read_at(const struct imgfs_file* imgfs_file, void* buffer, size_t size, uint64_t offset);
+
+/**
+ * @brief Writes size bytes at the given offset of the imgFS file.
+ *        Uses positional I/O, like read_at().
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param buffer The bytes to write.
+ * @param size The number of bytes to write.
+ * @param offset The position of the first byte in the file.
+ * @return Some error code. 0 if no error.
+ */
+int write_at(struct imgfs_file* imgfs_file, const void* buffer, size_t size, uint64_t offset);
+
+/**
+ * @brief Appends size bytes at the end of the imgFS file.
+ *        Appends must not run concurrently with one another.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param buffer The bytes to write.
+ * @param size The number of bytes to write.
+ * @param offset Where to put the offset at which the bytes were written.
+ * @return Some error code. 0 if no error.
+ */
+int append_data(struct imgfs_file* imgfs_file, const void* buffer, size_t size, uint64_t* offset);
+
+/**
+ * @brief Reserves size bytes at the end of the imgFS file, for a content
+ *        to be written later with write_at(), possibly without holding
+ *        the lock: the following appends go after them. Reservations must
+ *        not run concurrently with appends, nor with one another.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param size The number of bytes to reserve.
+ * @param offset Where to put the offset of the reserved bytes.
+ * @return Some error code. 0 if no error.
+ */
+int reserve_data(struct imgfs_file* imgfs_file, size_t size, uint64_t* offset);
+
+/**
+ * @brief Gives back the bytes reserved by reserve_data() and left unused,
+ *        if nothing was appended after them; they are left to do_gbcollect()
+ *        otherwise.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param offset The offset of the reserved bytes.
+ * @param size The number of reserved bytes.
+ */
+void release_data(struct imgfs_file* imgfs_file, uint64_t offset, size_t size);
+
+/**
+ * @brief Size of the metadata region(s) following the header on disk,
+ *        according to the format and max_files of the given header.
+ *
+ * @param header The header of the imgFS file.
+ * @return The size in bytes; the image contents start right after.
+ */
+uint64_t metadata_region_size(const struct imgfs_header* header);
+
+/**
+ * @brief Reads count metadata entries, starting at first, from the imgFS
+ *        file into the in-memory metadata array (and the hot array, if any),
+ *        whatever the format.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param first The index of the first entry.
+ * @param count The number of entries.
+ * @return Some error code. 0 if no error.
+ */
+int read_metadata_range(struct imgfs_file* imgfs_file, uint32_t first, uint32_t count);
+
+/**
+ * @brief Copies the hot fields of count metadata entries, starting at
+ *        first, into the hot array. Does nothing when there is none.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param first The index of the first entry.
+ * @param count The number of entries.
+ */
+void refresh_hot(struct imgfs_file* imgfs_file, uint32_t first, uint32_t count);
+
+/**
+ * @brief Writes count metadata entries, starting at first, from the
+ *        in-memory metadata array to the imgFS file, whatever the format.
+ *        Refreshes the hot array first (see refresh_hot()).
+ *        Does not go through batching, nor through the mapping.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param first The index of the first entry.
+ * @param count The number of entries.
+ * @param hot_only With format v2, only write the struct img_metadata_hot part.
+ * @return Some error code. 0 if no error.
+ */
+int write_metadata_range(struct imgfs_file* imgfs_file, uint32_t first, uint32_t count, int hot_only);
+
+/**
+ * @brief Writes the in-memory header back to the imgFS file.
+ *        With batching enabled (see imgfs_batch.h), only records that it has to be.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @return Some error code. 0 if no error.
+ */
+int write_header(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Writes one metadata entry back to the imgFS file.
+ *        For a mapped file, the entry is already in place and only the
+ *        access mode is checked. With batching enabled (see imgfs_batch.h),
+ *        only records that it has to be written.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param index The index of the entry in the metadata array.
+ * @return Some error code. 0 if no error.
+ */
+int write_metadata(struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Like write_metadata(), for an update which left the image ID
+ *        and SHA unchanged: format v2 then only writes the hot part.
+ *
+ * @param imgfs_file Structure for header, metadata and file pointer.
+ * @param index The index of the entry in the metadata array.
+ * @return Some error code. 0 if no error.
+ */
+int write_metadata_hot(struct imgfs_file* imgfs_file, uint32_t index);
+
 /**
  * @brief Do some clean-up for imgFS file handling.
  *
@@ -174,6 +380,21 @@ int resolution_atoi(const char* resolution);
 int do_read(const char* img_id, int resolution, char** image_buffer,
             uint32_t* image_size, struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Finds where the content of an image is stored in the imgFS file,
+ *        creating the requested resolution first if needed.
+ *        Lets callers send the content without reading it (e.g. with sendfile()).
+ *
+ * @param img_id The ID of the image to be located.
+ * @param resolution The desired resolution for the image.
+ * @param offset Location of the offset of the image content in the file
+ * @param size Location of the image size variable
+ * @param imgfs_file The main in-memory data structure
+ * @return Some error code. 0 if no error.
+ */
+int do_locate(const char* img_id, int resolution, uint64_t* offset,
+              uint32_t* size, struct imgfs_file* imgfs_file);
+
 /**
  * @brief Insert image in the imgFS file
  *
@@ -185,6 +406,67 @@ int do_read(const char* img_id, int resolution, char** image_buffer,
 int do_insert(const char* image_buffer, size_t image_size,
               const char* img_id, struct imgfs_file* imgfs_file);
 
+/**
+ * @brief Source of a content read in parts: puts at most size bytes in
+ *        buffer and their number in read, 0 once the whole content is read.
+ *
+ * @return Some error code. 0 if no error.
+ */
+typedef int (*content_reader)(void* arg, void* buffer, size_t size, size_t* read);
+
+/**
+ * @brief First step of the insertion of an image whose content is read
+ *        in parts (e.g. from a connection), with imgfs_file locked:
+ *        checks that the image can be inserted, and reserves the space of
+ *        its content at the end of the file.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param img_id Image ID
+ * @param image_size Image size, as announced
+ * @param offset Set to the offset of the reserved space
+ * @return Some error code. 0 if no error.
+ */
+int do_insert_reserve(struct imgfs_file* imgfs_file, const char* img_id, size_t image_size, uint64_t* offset);
+
+/**
+ * @brief Second step, without the lock: each part of the content read
+ *        from reader is written in the reserved space and hashed as it
+ *        comes, so the content is never held wholly in memory. The caller
+ *        must not let do_grow() move contents meanwhile. If it fails, the
+ *        reserved space is given back with release_data(), under the lock.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param offset The offset given by do_insert_reserve()
+ * @param image_size Image size, as announced
+ * @param reader What reads the content
+ * @param arg Given to reader
+ * @param SHA Set to the SHA-256 digest of the content
+ * @param width Set to the image width
+ * @param height Set to the image height
+ * @return Some error code. 0 if no error.
+ */
+int do_insert_stream(struct imgfs_file* imgfs_file, uint64_t offset, size_t image_size,
+                     content_reader reader, void* arg,
+                     unsigned char* SHA, uint32_t* width, uint32_t* height);
+
+/**
+ * @brief Last step, with imgfs_file locked again: records the image
+ *        streamed by do_insert_stream(). The reserved space is given back
+ *        when the image cannot be recorded, or when the same content was
+ *        stored already.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param img_id Image ID
+ * @param SHA The SHA-256 digest given by do_insert_stream()
+ * @param image_size Image size
+ * @param width The image width given by do_insert_stream()
+ * @param height The image height given by do_insert_stream()
+ * @param offset The offset given by do_insert_reserve()
+ * @return Some error code. 0 if no error.
+ */
+int do_insert_commit(struct imgfs_file* imgfs_file, const char* img_id, const unsigned char* SHA,
+                     size_t image_size, uint32_t width, uint32_t height, uint64_t offset);
+
 /**
  * @brief Removes the deleted images by moving the existing ones
  *
@@ -194,6 +476,19 @@ int do_insert(const char* image_buffer, size_t image_size,
  */
 int do_gbcollect(const char* imgfs_path, const char* imgfs_tmp_bkp_path);
 
+/**
+ * @brief Increases the maximum number of images of an open imgFS file,
+ *        without rewriting it: the metadata region grows in place, and
+ *        only the contents stored where it now goes are moved to the end.
+ *        Format v2 files cannot grow this way (NOT_IMPLEMENTED): all
+ *        their regions move, so a crash in the middle would lose them.
+ *
+ * @param imgfs_file The main in-memory data structure
+ * @param max_files The new maximum number of images (larger than the current one)
+ * @return Some error code. 0 if no error.
+ */
+int do_grow(struct imgfs_file* imgfs_file, uint32_t max_files);
+
 #ifdef __cplusplus
 }
 #endif
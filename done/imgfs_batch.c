@@ -0,0 +1,319 @@
+/**
+ * @file imgfs_batch.c
+ * @brief implementation of the batched writes of header and metadata
+ *
+ * Modified metadata entries are tracked in a bitmap, together with the
+ * range of slots they span, so that a flush only looks at that range.
+ * A second bitmap tells which of them were only staged by
+ * write_metadata_hot(), so that format v2 writes only their hot part.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_batch.h"
+
+#include <stdlib.h> // for calloc, realloc, free
+#include <string.h> // for memset
+#include <time.h>   // for clock_gettime
+#include <unistd.h> // for sysconf
+#include <sys/mman.h> // for msync
+
+#define SLOTS_PER_WORD 64u
+// Clean entries between two modified ones are rewritten as well when
+// there are at most that many: one larger write beats two small ones
+#define MAX_GAP 8u
+
+struct imgfs_batch {
+    uint64_t* dirty;       // bit set <=> metadata entry to be written
+    uint64_t* hot_only;    // bit set <=> and only its hot part changed
+    uint32_t nb_words;
+    uint32_t nb_dirty;
+    uint32_t lowest;       // range of the dirty entries (if nb_dirty > 0)
+    uint32_t highest;
+    int header_dirty;
+    uint32_t max_pending;
+    uint32_t interval_ms;
+    struct timespec last_flush;
+};
+
+static uint64_t ms_since(const struct timespec* then)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const int64_t ms = (int64_t) (now.tv_sec - then->tv_sec) * 1000
+                       + (now.tv_nsec - then->tv_nsec) / 1000000;
+    return ms < 0 ? 0 : (uint64_t) ms;
+}
+
+static int test_bit(const uint64_t* bits, uint32_t index)
+{
+    return (bits[index / SLOTS_PER_WORD] >> (index % SLOTS_PER_WORD)) & 1u;
+}
+
+static int is_dirty(const struct imgfs_batch* batch, uint32_t index)
+{
+    return test_bit(batch->dirty, index);
+}
+
+/*******************************************************************
+ * Mapped file: writes the pages holding bytes offset..offset+size back,
+ * or only adds them to the pages to_sync, when there is one
+ */
+static int sync_mapping(struct imgfs_file* imgfs_file, size_t offset, size_t size,
+                        struct imgfs_batch_sync* to_sync)
+{
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset - offset % page;
+    size_t end = offset + size;
+    if (end > imgfs_file->mapping_size) end = imgfs_file->mapping_size;
+    if (end <= start) return ERR_NONE;
+
+    if (to_sync == NULL) {
+        return msync((char*) imgfs_file->mapping + start, end - start, MS_SYNC) == 0 ? ERR_NONE : ERR_IO;
+    }
+
+    // A single range covering all of them: msync() skips the clean pages
+    if (to_sync->size > 0) {
+        const size_t synced = (size_t) (to_sync->start - (char*) imgfs_file->mapping);
+        if (synced < start) start = synced;
+        if (synced + to_sync->size > end) end = synced + to_sync->size;
+    }
+    to_sync->start = (char*) imgfs_file->mapping + start;
+    to_sync->size = end - start;
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Writes the metadata entries first..last (included)
+ */
+static int write_run(struct imgfs_file* imgfs_file, uint32_t first, uint32_t last, int hot_only,
+                     struct imgfs_batch_sync* to_sync)
+{
+    // Mapped: the entries are already in place, only their pages are synced
+    if (imgfs_file->mapping != NULL) {
+        const int err = write_metadata(imgfs_file, first); // checks the mode
+        if (err != ERR_NONE) return err;
+        return sync_mapping(imgfs_file, sizeof(struct imgfs_header) + (size_t) first * sizeof(struct img_metadata),
+                            (size_t) (last - first + 1) * sizeof(struct img_metadata), to_sync);
+    }
+
+    return write_metadata_range(imgfs_file, first, last - first + 1, hot_only);
+}
+
+/*******************************************************************
+ * Flush when enough is waiting, or when the last flush is old enough
+ */
+static int maybe_flush(struct imgfs_file* imgfs_file)
+{
+    const struct imgfs_batch* batch = imgfs_file->batch;
+    if (batch->nb_dirty >= batch->max_pending
+        || (batch->interval_ms > 0 && ms_since(&batch->last_flush) >= batch->interval_ms)) {
+        return imgfs_batch_flush(imgfs_file);
+    }
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Enable batching
+ */
+int imgfs_batch_begin(struct imgfs_file* imgfs_file, uint32_t max_pending, uint32_t interval_ms)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    if (max_pending == 0) return ERR_INVALID_ARGUMENT;
+    if (imgfs_file->batch != NULL) return ERR_INVALID_ARGUMENT;
+
+    struct imgfs_batch* batch = calloc(1, sizeof(struct imgfs_batch));
+    if (batch == NULL) return ERR_OUT_OF_MEMORY;
+    batch->nb_words = (uint32_t) (((uint64_t) imgfs_file->header.max_files + SLOTS_PER_WORD - 1) / SLOTS_PER_WORD);
+    batch->dirty = calloc(batch->nb_words == 0 ? 1 : batch->nb_words, sizeof(uint64_t));
+    batch->hot_only = calloc(batch->nb_words == 0 ? 1 : batch->nb_words, sizeof(uint64_t));
+    if (batch->dirty == NULL || batch->hot_only == NULL) {
+        free(batch->dirty);
+        free(batch->hot_only);
+        free(batch);
+        return ERR_OUT_OF_MEMORY;
+    }
+    batch->max_pending = max_pending;
+    batch->interval_ms = interval_ms;
+    clock_gettime(CLOCK_MONOTONIC, &batch->last_flush);
+
+    imgfs_file->batch = batch;
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Write everything that is pending; the mapped pages are synced right
+ * away, or left in to_sync when there is one
+ */
+static int flush(struct imgfs_file* imgfs_file, struct imgfs_batch_sync* to_sync)
+{
+    struct imgfs_batch* batch = imgfs_file->batch;
+    if (batch == NULL) return ERR_NONE;
+
+    // Plain writes while flushing
+    imgfs_file->batch = NULL;
+    int err = ERR_NONE;
+
+    // Metadata first, in runs of nearby entries (hot parts only if that
+    // is all that changed in each of them)...
+    if (batch->nb_dirty > 0) {
+        uint32_t first = batch->lowest;
+        uint32_t last = batch->lowest;
+        int hot_only = test_bit(batch->hot_only, batch->lowest);
+        for (uint32_t i = batch->lowest + 1; i <= batch->highest && err == ERR_NONE; ++i) {
+            if (!is_dirty(batch, i)) continue;
+            if (i - last > MAX_GAP) {
+                err = write_run(imgfs_file, first, last, hot_only, to_sync);
+                first = i;
+                hot_only = 1;
+            }
+            last = i;
+            hot_only = hot_only && test_bit(batch->hot_only, i);
+        }
+        if (err == ERR_NONE) err = write_run(imgfs_file, first, last, hot_only, to_sync);
+    }
+
+    // ...then the header, which counts them
+    if (err == ERR_NONE && batch->header_dirty) {
+        err = write_header(imgfs_file);
+        if (err == ERR_NONE && imgfs_file->mapping != NULL) {
+            err = sync_mapping(imgfs_file, 0, sizeof(struct imgfs_header), to_sync);
+        }
+    }
+
+    imgfs_file->batch = batch;
+    if (err != ERR_NONE) return err;
+
+    // All written: start over
+    for (uint32_t w = batch->lowest / SLOTS_PER_WORD;
+         batch->nb_dirty > 0 && w <= batch->highest / SLOTS_PER_WORD; ++w) {
+        batch->dirty[w] = 0;
+        batch->hot_only[w] = 0;
+    }
+    batch->nb_dirty = 0;
+    batch->header_dirty = 0;
+    clock_gettime(CLOCK_MONOTONIC, &batch->last_flush);
+    return ERR_NONE;
+}
+
+int imgfs_batch_flush(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    return flush(imgfs_file, NULL);
+}
+
+/*******************************************************************
+ * Flush if something waits since longer than the interval
+ */
+int imgfs_batch_collect(struct imgfs_file* imgfs_file, struct imgfs_batch_sync* to_sync)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(to_sync);
+    to_sync->start = NULL;
+    to_sync->size = 0;
+
+    const struct imgfs_batch* batch = imgfs_file->batch;
+    if (batch == NULL || (batch->nb_dirty == 0 && !batch->header_dirty)) return ERR_NONE;
+    if (batch->interval_ms > 0 && ms_since(&batch->last_flush) < batch->interval_ms) return ERR_NONE;
+
+    return flush(imgfs_file, to_sync);
+}
+
+int imgfs_batch_sync(const struct imgfs_batch_sync* to_sync)
+{
+    M_REQUIRE_NON_NULL(to_sync);
+    if (to_sync->size == 0) return ERR_NONE;
+
+    return msync(to_sync->start, to_sync->size, MS_SYNC) == 0 ? ERR_NONE : ERR_IO;
+}
+
+int imgfs_batch_tick(struct imgfs_file* imgfs_file)
+{
+    struct imgfs_batch_sync to_sync;
+    const int err = imgfs_batch_collect(imgfs_file, &to_sync);
+    return err != ERR_NONE ? err : imgfs_batch_sync(&to_sync);
+}
+
+/*******************************************************************
+ * Disable batching
+ */
+int imgfs_batch_end(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    if (imgfs_file->batch == NULL) return ERR_NONE;
+
+    const int err = imgfs_batch_flush(imgfs_file);
+
+    free(imgfs_file->batch->dirty);
+    free(imgfs_file->batch->hot_only);
+    free(imgfs_file->batch);
+    imgfs_file->batch = NULL;
+    return err;
+}
+
+/*******************************************************************
+ * Larger bitmap, for a grown imgFS
+ */
+int imgfs_batch_reserve(struct imgfs_file* imgfs_file, uint32_t max_files)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+
+    struct imgfs_batch* batch = imgfs_file->batch;
+    if (batch == NULL) return ERR_NONE;
+
+    const uint32_t nb_words = (uint32_t) (((uint64_t) max_files + SLOTS_PER_WORD - 1) / SLOTS_PER_WORD);
+    if (nb_words <= batch->nb_words) return ERR_NONE;
+
+    uint64_t* dirty = realloc(batch->dirty, nb_words * sizeof(uint64_t));
+    if (dirty == NULL) return ERR_OUT_OF_MEMORY;
+    memset(dirty + batch->nb_words, 0, (nb_words - batch->nb_words) * sizeof(uint64_t));
+    batch->dirty = dirty;
+
+    uint64_t* hot_only = realloc(batch->hot_only, nb_words * sizeof(uint64_t));
+    if (hot_only == NULL) return ERR_OUT_OF_MEMORY;
+    memset(hot_only + batch->nb_words, 0, (nb_words - batch->nb_words) * sizeof(uint64_t));
+    batch->hot_only = hot_only;
+    batch->nb_words = nb_words;
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Staging
+ */
+int imgfs_batch_stage_header(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->batch);
+
+    imgfs_file->batch->header_dirty = 1;
+    return maybe_flush(imgfs_file);
+}
+
+int imgfs_batch_stage_metadata(struct imgfs_file* imgfs_file, uint32_t index, int hot_only)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->batch);
+    if (index >= imgfs_file->header.max_files) return ERR_INVALID_ARGUMENT;
+
+    struct imgfs_batch* batch = imgfs_file->batch;
+    const uint64_t bit = UINT64_C(1) << (index % SLOTS_PER_WORD);
+    // Only hot as long as no full write was staged since the last flush
+    if (!is_dirty(batch, index) && hot_only) {
+        batch->hot_only[index / SLOTS_PER_WORD] |= bit;
+    } else if (!hot_only) {
+        batch->hot_only[index / SLOTS_PER_WORD] &= ~bit;
+    }
+    if (!is_dirty(batch, index)) {
+        batch->dirty[index / SLOTS_PER_WORD] |= bit;
+        if (batch->nb_dirty == 0) {
+            batch->lowest = batch->highest = index;
+        } else {
+            if (index < batch->lowest) batch->lowest = index;
+            if (index > batch->highest) batch->highest = index;
+        }
+        ++batch->nb_dirty;
+    }
+    return maybe_flush(imgfs_file);
+}
@@ -0,0 +1,137 @@
+/**
+ * @file imgfs_batch.h
+ * @brief Batched (group commit) writes of the header and metadata.
+ *
+ * Once batching is enabled on an imgfs_file, write_header() and
+ * write_metadata() only record what changed. The changes are written
+ * together by imgfs_batch_flush(): one header write, and one write per
+ * run of (nearly) contiguous modified metadata entries.
+ *
+ * A flush happens automatically once max_pending metadata entries are
+ * waiting, or on the first write after interval_ms milliseconds since
+ * the previous flush, and always in do_close(). Writers that may stay
+ * idle call imgfs_batch_tick() periodically, so that nothing waits much
+ * longer than interval_ms; or imgfs_batch_collect() with the file locked
+ * and then imgfs_batch_sync(), which does not need the lock. Image contents are still written right away,
+ * so a crash before a flush only loses the metadata of the staged
+ * images; their contents are reclaimed by do_gbcollect().
+ *
+ * On a file opened with do_open_mmap(), header and metadata changes land
+ * in the shared mapping right away, where other readers of the file see
+ * them; a flush then syncs the pages of the modified entries and of the
+ * header to disk (msync()), instead of letting them go whenever the
+ * kernel writes them back.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#pragma once
+
+#include "imgfs.h" // for struct imgfs_file
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pages of the mapping left to sync by imgfs_batch_collect()
+struct imgfs_batch_sync {
+    char* start;  // page aligned
+    size_t size;  // 0 if nothing to sync
+};
+
+/**
+ * @brief Enables batched writes on imgfs_file.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param max_pending Number of modified metadata entries that triggers a flush (at least 1)
+ * @param interval_ms Maximum time between flushes, checked at each write and by
+ *                    imgfs_batch_tick(); 0 to disable
+ * @return Some error code. 0 if no error.
+ */
+int imgfs_batch_begin(struct imgfs_file* imgfs_file, uint32_t max_pending, uint32_t interval_ms);
+
+/**
+ * @brief Writes all the pending changes of imgfs_file to disk.
+ *        Does nothing if batching is not enabled.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int imgfs_batch_flush(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Writes the pending changes of imgfs_file if they wait since the
+ *        last flush for interval_ms or longer. Does nothing if batching is
+ *        not enabled or nothing is pending.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code (of the flush). 0 if no error.
+ */
+int imgfs_batch_tick(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Like imgfs_batch_tick(), but for a mapped file, leaves the pages
+ *        written to be synced by imgfs_batch_sync().
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param to_sync Set to the pages to sync (size 0 if none)
+ * @return Some error code (of the flush). 0 if no error.
+ */
+int imgfs_batch_collect(struct imgfs_file* imgfs_file, struct imgfs_batch_sync* to_sync);
+
+/**
+ * @brief Syncs the pages left by imgfs_batch_collect() to disk. Needs no
+ *        lock on the file, only that it stays mapped meanwhile.
+ *
+ * @param to_sync The pages to sync
+ * @return Some error code. 0 if no error.
+ */
+int imgfs_batch_sync(const struct imgfs_batch_sync* to_sync);
+
+/**
+ * @brief Flushes the pending changes and goes back to immediate writes.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code (of the flush). 0 if no error.
+ */
+int imgfs_batch_end(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Makes room to track max_files metadata entries, for when the
+ *        imgFS grows (see do_grow()). Does nothing if batching is not enabled.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param max_files The number of metadata entries to track
+ * @return Some error code. 0 if no error.
+ */
+int imgfs_batch_reserve(struct imgfs_file* imgfs_file, uint32_t max_files);
+
+/**
+ * @brief Records that the header has to be written.
+ *        Called by write_header() when batching is enabled.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code (of a triggered flush). 0 if no error.
+ */
+int imgfs_batch_stage_header(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Records that a metadata entry has to be written.
+ *        Called by write_metadata() and write_metadata_hot() when
+ *        batching is enabled.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the entry in the metadata array
+ * @param hot_only Whether only the hot part changed (see write_metadata_hot());
+ *                 the entry is written in full if any of its stagings
+ *                 since the last flush was not hot only
+ * @return Some error code (of a triggered flush). 0 if no error.
+ */
+int imgfs_batch_stage_metadata(struct imgfs_file* imgfs_file, uint32_t index, int hot_only);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,219 @@
+/**
+ * @file imgfs_codecs.c
+ * @brief implementation of the variants in other codecs
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_codecs.h"
+#include "image_content.h" // for resize_source(), resize_stored_content(), RES_BIT()
+#include "imgfs_index.h"   // for name_index_find(), content_index_next()
+
+#include <stdlib.h>     // for calloc, free
+#include <string.h>     // for memcmp, memcpy, memset
+#include <vips/vips.h>  // for g_free
+
+static const char* const content_types[NB_CODECS] = { "image/jpeg", "image/webp" };
+
+const char* codec_content_type(enum image_codec codec)
+{
+    return codec >= 0 && codec < NB_CODECS ? content_types[codec] : content_types[CODEC_JPEG];
+}
+
+static size_t region_size(const struct imgfs_file* imgfs_file)
+{
+    return (size_t) imgfs_file->header.max_files * sizeof(struct img_codec_variants);
+}
+
+/*******************************************************************
+ * Load and free
+ */
+int codec_variants_load(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+
+    imgfs_file->codecs = NULL;
+    if (imgfs_file->header.unused_64 == 0) return ERR_NONE;
+
+    struct img_codec_variants* codecs = calloc(imgfs_file->header.max_files, sizeof(struct img_codec_variants));
+    if (codecs == NULL) return ERR_OUT_OF_MEMORY;
+
+    const int err = read_at(imgfs_file, codecs, region_size(imgfs_file), imgfs_file->header.unused_64);
+    if (err != ERR_NONE) {
+        free(codecs);
+        return err;
+    }
+    imgfs_file->codecs = codecs;
+    return ERR_NONE;
+}
+
+void codec_variants_free(struct imgfs_file* imgfs_file)
+{
+    if (imgfs_file == NULL) return;
+
+    free(imgfs_file->codecs);
+    imgfs_file->codecs = NULL;
+}
+
+/*******************************************************************
+ * Lookup: the entry of the image, or of any image with the same content
+ */
+static const struct img_codec_variants* entry_of(const struct imgfs_file* imgfs_file, size_t index,
+                                                 int resolution)
+{
+    const struct img_codec_variants* entry = &imgfs_file->codecs[index];
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+    return entry->size[resolution] != 0
+           && memcmp(entry->SHA, image->SHA, SHA256_DIGEST_LENGTH) == 0 ? entry : NULL;
+}
+
+int codec_variants_find(const struct imgfs_file* imgfs_file, size_t index, int resolution,
+                        uint64_t* offset, uint32_t* size)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(offset);
+    M_REQUIRE_NON_NULL(size);
+    if (index >= imgfs_file->header.max_files || imgfs_file->metadata[index].is_valid != NON_EMPTY) {
+        return ERR_INVALID_IMGID;
+    }
+    if (resolution != THUMB_RES && resolution != SMALL_RES) return ERR_RESOLUTIONS;
+    if (imgfs_file->codecs == NULL) return ERR_IMAGE_NOT_FOUND;
+
+    const struct img_codec_variants* found = entry_of(imgfs_file, index, resolution);
+    uint32_t cursor = 0;
+    for (int j; found == NULL && (j = content_index_next(imgfs_file, imgfs_file->metadata[index].SHA,
+                                      &cursor)) != -1; ) {
+        found = entry_of(imgfs_file, (size_t) j, resolution);
+    }
+    if (found == NULL) return ERR_IMAGE_NOT_FOUND;
+
+    *offset = found->offset[resolution];
+    *size = found->size[resolution];
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Storage
+ */
+static int create_region(struct imgfs_file* imgfs_file)
+{
+    struct img_codec_variants* codecs = calloc(imgfs_file->header.max_files, sizeof(struct img_codec_variants));
+    if (codecs == NULL) return ERR_OUT_OF_MEMORY;
+
+    uint64_t offset = 0;
+    int err = append_data(imgfs_file, codecs, region_size(imgfs_file), &offset);
+    if (err == ERR_NONE) {
+        imgfs_file->header.unused_64 = offset;
+        err = write_header(imgfs_file);
+        if (err != ERR_NONE) {
+            // Not recorded: the file ends as before
+            imgfs_file->header.unused_64 = 0;
+            release_data(imgfs_file, offset, region_size(imgfs_file));
+        }
+    }
+    if (err != ERR_NONE) {
+        free(codecs);
+        return err;
+    }
+    imgfs_file->codecs = codecs;
+    return ERR_NONE;
+}
+
+int codec_variants_store(struct imgfs_file* imgfs_file, size_t index, int resolution,
+                         const void* content, size_t size)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(content);
+    if (index >= imgfs_file->header.max_files || imgfs_file->metadata[index].is_valid != NON_EMPTY) {
+        return ERR_INVALID_IMGID;
+    }
+    if (resolution != THUMB_RES && resolution != SMALL_RES) return ERR_RESOLUTIONS;
+
+    int err = imgfs_file->codecs == NULL ? create_region(imgfs_file) : ERR_NONE;
+    uint64_t offset = 0;
+    if (err == ERR_NONE) err = append_data(imgfs_file, content, size, &offset);
+    if (err != ERR_NONE) return err;
+
+    // Left by another content: start afresh
+    struct img_codec_variants* entry = &imgfs_file->codecs[index];
+    const unsigned char* SHA = imgfs_file->metadata[index].SHA;
+    if (memcmp(entry->SHA, SHA, SHA256_DIGEST_LENGTH) != 0) {
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->SHA, SHA, SHA256_DIGEST_LENGTH);
+    }
+    entry->offset[resolution] = offset;
+    entry->size[resolution] = (uint32_t) size;
+
+    return write_at(imgfs_file, entry, sizeof(*entry),
+                    imgfs_file->header.unused_64 + index * sizeof(struct img_codec_variants));
+}
+
+int codec_locate(struct imgfs_file* imgfs_file, pthread_mutex_t* lock, const char* img_id,
+                 int resolution, uint64_t* offset, uint32_t* size)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(lock);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(offset);
+    M_REQUIRE_NON_NULL(size);
+    if (resolution != THUMB_RES && resolution != SMALL_RES) return ERR_RESOLUTIONS;
+
+    pthread_mutex_lock(lock);
+    int index = name_index_find(imgfs_file, img_id);
+    int err = index == -1 ? ERR_IMAGE_NOT_FOUND
+              : codec_variants_find(imgfs_file, (size_t) index, resolution, offset, size);
+    if (err != ERR_IMAGE_NOT_FOUND || index == -1) {
+        pthread_mutex_unlock(lock);
+        return err;
+    }
+
+    // Streamed from the file and encoded without the lock
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    memcpy(SHA, imgfs_file->metadata[index].SHA, SHA256_DIGEST_LENGTH);
+    const uint16_t width = imgfs_file->header.resized_res[2 * resolution];
+    const uint16_t height = imgfs_file->header.resized_res[2 * resolution + 1];
+    const uint32_t max_files = imgfs_file->header.max_files;
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+    const int source_res = resize_source(&imgfs_file->header, image, RES_BIT(resolution));
+    const uint64_t source_offset = image->offset[source_res];
+    const uint32_t source_size = image->size[source_res];
+    pthread_mutex_unlock(lock);
+
+    void* encoded = NULL;
+    size_t encoded_size = 0;
+    err = resize_stored_content(imgfs_file, source_offset, source_size, width, height, CODEC_WEBP,
+                                &encoded, &encoded_size);
+
+    pthread_mutex_lock(lock);
+    // Grown meanwhile: the source may have been moved while read, so start again
+    if (imgfs_file->header.max_files != max_files) {
+        pthread_mutex_unlock(lock);
+        g_free(encoded);
+        return codec_locate(imgfs_file, lock, img_id, resolution, offset, size);
+    }
+    if (err != ERR_NONE) {
+        pthread_mutex_unlock(lock);
+        return err;
+    }
+
+    // Same image still there, and still without it
+    index = name_index_find(imgfs_file, img_id);
+    if (index == -1 || memcmp(imgfs_file->metadata[index].SHA, SHA, SHA256_DIGEST_LENGTH) != 0) {
+        err = ERR_IMAGE_NOT_FOUND;
+    } else {
+        err = codec_variants_find(imgfs_file, (size_t) index, resolution, offset, size);
+        if (err == ERR_IMAGE_NOT_FOUND) {
+            err = codec_variants_store(imgfs_file, (size_t) index, resolution, encoded, encoded_size);
+            if (err == ERR_NONE) {
+                err = codec_variants_find(imgfs_file, (size_t) index, resolution, offset, size);
+            }
+        }
+    }
+    pthread_mutex_unlock(lock);
+
+    g_free(encoded);
+    return err;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file imgfs_codecs.h
+ * @brief Resized variants in another codec (WebP) than the JPEG ones.
+ *
+ * The layout of struct img_metadata is fixed, so these variants are
+ * recorded in a codec region of max_files struct img_codec_variants,
+ * appended to the data region the first time one is stored; its offset
+ * is kept in imgfs_header.unused_64 (0: no such region). Each entry
+ * records the SHA of the content its variants were made from, so that
+ * an entry left by a deleted image is never served for another content,
+ * and is shared by the images with the same content.
+ *
+ * The region is kept by do_grow(), which writes it again with room for
+ * the new entries, and by do_gbcollect(), which copies the variants of
+ * the valid images along with their other contents.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#pragma once
+
+#include "imgfs.h"         // for struct imgfs_file, SHA256_DIGEST_LENGTH
+#include "image_content.h" // for enum image_codec
+
+#include <pthread.h> // for pthread_mutex_t
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One entry of the codec region
+struct img_codec_variants {
+    unsigned char SHA[SHA256_DIGEST_LENGTH]; // content the variants were made from
+    uint64_t offset[ORIG_RES];
+    uint32_t size[ORIG_RES];
+};
+
+/**
+ * @brief The MIME type of a codec.
+ *
+ * @param codec The codec
+ * @return "image/jpeg", "image/webp"...
+ */
+const char* codec_content_type(enum image_codec codec);
+
+/**
+ * @brief Reads the codec region, if the file has one.
+ *        Called when opening an imgFS file.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int codec_variants_load(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Frees the in-memory codec region. Called when closing an imgFS file.
+ *
+ * @param imgfs_file The main in-memory structure
+ */
+void codec_variants_free(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Where the WebP variant of an image is stored, if any.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @param resolution THUMB_RES or SMALL_RES
+ * @param offset Where to put the offset of the variant
+ * @param size Where to put the size of the variant
+ * @return Some error code: ERR_IMAGE_NOT_FOUND if not created yet. 0 if no error.
+ */
+int codec_variants_find(const struct imgfs_file* imgfs_file, size_t index, int resolution,
+                        uint64_t* offset, uint32_t* size);
+
+/**
+ * @brief Appends a WebP variant to the imgFS file and records it, in
+ *        memory and on the disk, creating the codec region if needed.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @param resolution THUMB_RES or SMALL_RES
+ * @param content The (WebP) content
+ * @param size The size of the content
+ * @return Some error code. 0 if no error.
+ */
+int codec_variants_store(struct imgfs_file* imgfs_file, size_t index, int resolution,
+                         const void* content, size_t size);
+
+/**
+ * @brief Like do_locate(), for the WebP variant of a resized resolution:
+ *        created if needed, without holding the lock while encoding.
+ *        Must be called without holding the lock.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param lock The lock protecting imgfs_file
+ * @param img_id The ID of the image
+ * @param resolution THUMB_RES or SMALL_RES
+ * @param offset Where to put the offset of the variant
+ * @param size Where to put the size of the variant
+ * @return Some error code. 0 if no error.
+ */
+int codec_locate(struct imgfs_file* imgfs_file, pthread_mutex_t* lock, const char* img_id,
+                 int resolution, uint64_t* offset, uint32_t* size);
+
+#ifdef __cplusplus
+}
+#endif
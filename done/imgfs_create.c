@@ -1,4 +1,5 @@
 #include "imgfs.h"
+#include "imgfs_index.h"
 
 #include <stdlib.h>        // for calloc
 #include "string.h"
@@ -15,6 +16,16 @@ int do_create(const char* imgfs_filename, struct imgfs_file* imgfs_file)
     M_REQUIRE_NON_NULL(imgfs_filename);
     M_REQUIRE_NON_NULL(imgfs_file);
 
+    imgfs_file->name_index = NULL;
+    imgfs_file->content_index = NULL;
+    imgfs_file->empty_slots = NULL;
+    imgfs_file->mapping = NULL;
+    imgfs_file->mapping_size = 0;
+    imgfs_file->batch = NULL;
+    imgfs_file->codecs = NULL;
+    imgfs_file->hot = NULL;
+    imgfs_file->header.unused_64 = 0; // no WebP variants yet
+
     FILE *filePointer;
     // Set imgfs_file name to CAT_TXT
     strncpy(imgfs_file->header.name, CAT_TXT, sizeof(imgfs_file->header.name) - 1);
@@ -24,26 +35,38 @@ int do_create(const char* imgfs_filename, struct imgfs_file* imgfs_file)
     if (filePointer== NULL) {
         return ERR_IO;
     }
+    imgfs_file->file= filePointer;
     // Allocate sufficient space for the maximum possible number of entries in metadata
     uint32_t num_files = imgfs_file->header.max_files;
     imgfs_file->metadata = calloc(num_files,sizeof(struct img_metadata));
-    if (imgfs_file->metadata == NULL) {
+    if (imgfs_file->header.unused_32 == IMGFS_FORMAT_V2) {
+        imgfs_file->hot = calloc(num_files, sizeof(struct img_metadata_hot));
+    }
+    if (imgfs_file->metadata == NULL
+        || (imgfs_file->header.unused_32 == IMGFS_FORMAT_V2 && imgfs_file->hot == NULL)) {
         do_close(imgfs_file);
         return ERR_OUT_OF_MEMORY;
     }
     // Write to disk the header
-    imgfs_file->file= filePointer;
-    size_t bytes_w = fwrite(&imgfs_file->header, sizeof(struct imgfs_header),  1,filePointer);
-    if (bytes_w != 1) {
+    if (write_at(imgfs_file, &imgfs_file->header, sizeof(struct imgfs_header), 0) != ERR_NONE) {
         do_close(imgfs_file);
         return ERR_IO;
     }
+    size_t bytes_w = 1;
     //Write metadata to disk
-    bytes_w += fwrite(imgfs_file->metadata, sizeof(struct img_metadata),num_files,filePointer);
-    if (bytes_w != num_files+1) {
+    if (write_metadata_range(imgfs_file, 0, num_files, 0) != ERR_NONE) {
         do_close(imgfs_file);
         return ERR_IO;
     }
+    bytes_w += num_files;
+    // Empty indexes, so that the freshly created imgFS can be used right away
+    int err = name_index_build(imgfs_file);
+    if (err == ERR_NONE) err = content_index_build(imgfs_file);
+    if (err == ERR_NONE) err = empty_slots_build(imgfs_file);
+    if (err != ERR_NONE) {
+        do_close(imgfs_file);
+        return err;
+    }
     printf("%zu item(s) written", bytes_w);
     return ERR_NONE;
 }
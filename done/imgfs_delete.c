@@ -1,4 +1,5 @@
 #include "imgfs.h"
+#include "imgfs_index.h"
 #include "error.h"
 #include <string.h>
 
@@ -19,44 +20,31 @@ int do_delete(const char* img_id, struct imgfs_file* imgfs_file)
 
 
 
-    int img_found = -1;
-    uint32_t i = 0;
-    uint32_t j = 0;
     // Find image reference in the metadata
-    while (j<imgfs_file->header.nb_files && i < imgfs_file->header.max_files) {
-        if (imgfs_file->metadata[i].is_valid == NON_EMPTY) {
-            ++j;
-            if (strcmp(img_id, imgfs_file->metadata[i].img_id) == 0) {
-                img_found = i;
-                break;
-            }
-        }
-        ++i;
-    }
+    int img_found = name_index_find(imgfs_file, img_id);
 
     // Image reference does not exist
     if (img_found == -1) return ERR_IMAGE_NOT_FOUND;
 
     // Image deleted by invalidating the reference
+    name_index_remove(imgfs_file, (uint32_t) img_found);
+    content_index_remove(imgfs_file, (uint32_t) img_found);
     imgfs_file->metadata[img_found].is_valid = EMPTY;
 
-    // Set the position to write the updated metadata to the file
-    fseek(imgfs_file->file, (long)(sizeof(struct imgfs_header) + (unsigned long)(img_found) * sizeof(struct img_metadata)), SEEK_SET);
-    if (fwrite(&imgfs_file->metadata[img_found], sizeof(struct img_metadata), 1, imgfs_file->file) != 1) {
-        return ERR_IO;
-    }
+    // Write the updated metadata to the file
+    int err = write_metadata_hot(imgfs_file, (uint32_t) img_found);
+    if (err != ERR_NONE) return err;
 
-    // Move the file pointer to the beginning of the file
-    rewind(imgfs_file->file);
+    // The slot can be reused
+    empty_slots_release(imgfs_file, (uint32_t) img_found);
 
     // Update the header
     imgfs_file->header.nb_files--;
     imgfs_file->header.version++;
 
     // Write updated header to disk
-    if (fwrite(&imgfs_file->header, sizeof(struct imgfs_header), 1, imgfs_file->file) != 1) {
-        return ERR_IO;
-    }
+    err = write_header(imgfs_file);
+    if (err != ERR_NONE) return err;
 
     // All good
     return ERR_NONE;
@@ -0,0 +1,212 @@
+/**
+ * @file imgfs_format.c
+ * @brief On-disk layout of the metadata, for both format versions
+ *
+ * Format v1 stores the struct img_metadata array as is. Format v2 splits
+ * it into three regions: the hot parts, the image IDs and the SHAs, so
+ * that updating the hot fields of an entry does not rewrite its 160 cold
+ * bytes. Entries are converted from and to the in-memory struct
+ * img_metadata by chunks, through a bounded buffer; the hot region is
+ * also kept as is in imgfs_file.hot, for the scans over all the slots.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "util.h"   // for MIN
+
+#include <stdlib.h> // for malloc, free
+#include <string.h> // for memcpy
+
+// Entries converted at once
+#define CHUNK_ENTRIES 1024u
+
+#define ID_SIZE (MAX_IMG_ID + 1)
+
+/*******************************************************************
+ * Where the regions start (format v2)
+ */
+static uint64_t hot_region(void)
+{
+    return sizeof(struct imgfs_header);
+}
+
+static uint64_t id_region(const struct imgfs_header* header)
+{
+    return hot_region() + (uint64_t) header->max_files * sizeof(struct img_metadata_hot);
+}
+
+static uint64_t sha_region(const struct imgfs_header* header)
+{
+    return id_region(header) + (uint64_t) header->max_files * ID_SIZE;
+}
+
+uint64_t metadata_region_size(const struct imgfs_header* header)
+{
+    if (header == NULL) return 0;
+
+    if (header->unused_32 == IMGFS_FORMAT_V2) {
+        return sha_region(header) + (uint64_t) header->max_files * SHA256_DIGEST_LENGTH
+               - sizeof(struct imgfs_header);
+    }
+    return (uint64_t) header->max_files * sizeof(struct img_metadata);
+}
+
+/*******************************************************************
+ * Hot part <-> full entry
+ */
+static void to_hot(const struct img_metadata* md, struct img_metadata_hot* hot)
+{
+    memcpy(hot->offset, md->offset, sizeof(hot->offset));
+    memcpy(hot->size, md->size, sizeof(hot->size));
+    memcpy(hot->orig_res, md->orig_res, sizeof(hot->orig_res));
+    hot->is_valid = md->is_valid;
+    hot->unused_16 = md->unused_16;
+}
+
+static void from_hot(const struct img_metadata_hot* hot, struct img_metadata* md)
+{
+    memcpy(md->offset, hot->offset, sizeof(md->offset));
+    memcpy(md->size, hot->size, sizeof(md->size));
+    memcpy(md->orig_res, hot->orig_res, sizeof(md->orig_res));
+    md->is_valid = hot->is_valid;
+    md->unused_16 = hot->unused_16;
+}
+
+static int check_range(const struct imgfs_file* imgfs_file, uint32_t first, uint32_t count)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    if ((uint64_t) first + count > imgfs_file->header.max_files) return ERR_INVALID_ARGUMENT;
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Reading
+ */
+int read_metadata_range(struct imgfs_file* imgfs_file, uint32_t first, uint32_t count)
+{
+    int err = check_range(imgfs_file, first, count);
+    if (err != ERR_NONE) return err;
+
+    const struct imgfs_header* header = &imgfs_file->header;
+    if (header->unused_32 == IMGFS_FORMAT_V1) {
+        return read_at(imgfs_file, &imgfs_file->metadata[first], (size_t) count * sizeof(struct img_metadata),
+                       sizeof(struct imgfs_header) + (uint64_t) first * sizeof(struct img_metadata));
+    }
+    if (header->unused_32 != IMGFS_FORMAT_V2) return ERR_IO;
+
+    // Large enough for a chunk of any of the three regions
+    char* buffer = malloc(CHUNK_ENTRIES * ID_SIZE);
+    if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    for (uint32_t done = 0; done < count && err == ERR_NONE; ) {
+        const uint32_t n = MIN(count - done, CHUNK_ENTRIES);
+        const uint64_t at = (uint64_t) first + done;
+        struct img_metadata* md = &imgfs_file->metadata[at];
+
+        err = read_at(imgfs_file, buffer, n * sizeof(struct img_metadata_hot),
+                      hot_region() + at * sizeof(struct img_metadata_hot));
+        for (uint32_t i = 0; err == ERR_NONE && i < n; ++i) {
+            struct img_metadata_hot hot;
+            memcpy(&hot, buffer + i * sizeof(hot), sizeof(hot));
+            from_hot(&hot, &md[i]);
+            if (imgfs_file->hot != NULL) imgfs_file->hot[at + i] = hot;
+        }
+
+        if (err == ERR_NONE) err = read_at(imgfs_file, buffer, n * ID_SIZE, id_region(header) + at * ID_SIZE);
+        for (uint32_t i = 0; err == ERR_NONE && i < n; ++i) {
+            memcpy(md[i].img_id, buffer + i * ID_SIZE, ID_SIZE);
+        }
+
+        if (err == ERR_NONE) err = read_at(imgfs_file, buffer, n * SHA256_DIGEST_LENGTH,
+                                               sha_region(header) + at * SHA256_DIGEST_LENGTH);
+        for (uint32_t i = 0; err == ERR_NONE && i < n; ++i) {
+            memcpy(md[i].SHA, buffer + i * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH);
+        }
+
+        done += n;
+    }
+
+    free(buffer);
+    return err;
+}
+
+/*******************************************************************
+ * Writing
+ */
+void refresh_hot(struct imgfs_file* imgfs_file, uint32_t first, uint32_t count)
+{
+    if (imgfs_file == NULL || imgfs_file->hot == NULL || imgfs_file->metadata == NULL) return;
+
+    for (uint32_t i = 0; i < count && (uint64_t) first + i < imgfs_file->header.max_files; ++i) {
+        to_hot(&imgfs_file->metadata[first + i], &imgfs_file->hot[first + i]);
+    }
+}
+
+int write_metadata_range(struct imgfs_file* imgfs_file, uint32_t first, uint32_t count, int hot_only)
+{
+    int err = check_range(imgfs_file, first, count);
+    if (err != ERR_NONE) return err;
+    refresh_hot(imgfs_file, first, count);
+
+    const struct imgfs_header* header = &imgfs_file->header;
+    if (header->unused_32 == IMGFS_FORMAT_V1) {
+        return write_at(imgfs_file, &imgfs_file->metadata[first], (size_t) count * sizeof(struct img_metadata),
+                        sizeof(struct imgfs_header) + (uint64_t) first * sizeof(struct img_metadata));
+    }
+    if (header->unused_32 != IMGFS_FORMAT_V2) return ERR_IO;
+
+    // A single hot entry needs no buffer
+    if (count == 1 && hot_only) {
+        struct img_metadata_hot hot;
+        to_hot(&imgfs_file->metadata[first], &hot);
+        return write_at(imgfs_file, &hot, sizeof(hot),
+                        hot_region() + (uint64_t) first * sizeof(struct img_metadata_hot));
+    }
+    // Neither does the hot region, when it is kept in memory
+    if (imgfs_file->hot != NULL) {
+        err = write_at(imgfs_file, &imgfs_file->hot[first], (size_t) count * sizeof(struct img_metadata_hot),
+                       hot_region() + (uint64_t) first * sizeof(struct img_metadata_hot));
+        if (err != ERR_NONE || hot_only) return err;
+    }
+
+    char* buffer = malloc(CHUNK_ENTRIES * ID_SIZE);
+    if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    for (uint32_t done = 0; done < count && err == ERR_NONE; ) {
+        const uint32_t n = MIN(count - done, CHUNK_ENTRIES);
+        const uint64_t at = (uint64_t) first + done;
+        const struct img_metadata* md = &imgfs_file->metadata[at];
+
+        if (imgfs_file->hot == NULL) {
+            for (uint32_t i = 0; i < n; ++i) {
+                struct img_metadata_hot hot;
+                to_hot(&md[i], &hot);
+                memcpy(buffer + i * sizeof(hot), &hot, sizeof(hot));
+            }
+            err = write_at(imgfs_file, buffer, n * sizeof(struct img_metadata_hot),
+                           hot_region() + at * sizeof(struct img_metadata_hot));
+        }
+
+        if (err == ERR_NONE && !hot_only) {
+            for (uint32_t i = 0; i < n; ++i) {
+                memcpy(buffer + i * ID_SIZE, md[i].img_id, ID_SIZE);
+            }
+            err = write_at(imgfs_file, buffer, n * ID_SIZE, id_region(header) + at * ID_SIZE);
+        }
+
+        if (err == ERR_NONE && !hot_only) {
+            for (uint32_t i = 0; i < n; ++i) {
+                memcpy(buffer + i * SHA256_DIGEST_LENGTH, md[i].SHA, SHA256_DIGEST_LENGTH);
+            }
+            err = write_at(imgfs_file, buffer, n * SHA256_DIGEST_LENGTH,
+                           sha_region(header) + at * SHA256_DIGEST_LENGTH);
+        }
+
+        done += n;
+    }
+
+    free(buffer);
+    return err;
+}
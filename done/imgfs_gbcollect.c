@@ -0,0 +1,257 @@
+/**
+ * @file imgfs_gbcollect.c
+ * @brief Garbage collection (compaction) of an imgFS file.
+ *
+ * Only the contents still referenced by a valid image, and its WebP
+ * variants, are copied to a new imgFS file, which then atomically
+ * replaces the original one.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_codecs.h" // for struct img_codec_variants
+#include "imgfs_index.h" // for content_index_find()
+#include "util.h"        // for zero_init_var, MIN
+
+#include <inttypes.h>    // for PRIu64
+#include <stdio.h>       // for printf, rename, remove
+#include <stdlib.h>      // for calloc, qsort
+#include <string.h>      // for memcmp, memcpy, memset
+#include <sys/stat.h>    // for fstat
+#include <time.h>        // for clock_gettime
+#include <unistd.h>      // for fsync
+
+// Size of the copy buffer: contents are copied in large sequential chunks
+#define GC_BUFFER_SIZE (4u << 20)
+
+// One content to be copied: where it is and who refers to it
+struct gc_blob {
+    uint64_t offset;  // in the original file
+    uint32_t size;
+    uint64_t* target; // offset to update in the compacted metadata or codec region
+};
+
+/*******************************************************************
+ * Sort by offset, so that the original file is read sequentially and
+ * contents shared by several images end up next to each other
+ */
+static int blob_cmp(const void* a, const void* b)
+{
+    const struct gc_blob* x = a;
+    const struct gc_blob* y = b;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    return 0;
+}
+
+/*******************************************************************
+ * Lists the contents referred to by the valid images
+ */
+static size_t collect_blobs(const struct imgfs_file* src, struct imgfs_file* dst, struct gc_blob* blobs)
+{
+    size_t nb_blobs = 0;
+    for (uint32_t i = 0; i < src->header.max_files; ++i) {
+        const struct img_metadata* md = &src->metadata[i];
+        if (md->is_valid != NON_EMPTY) continue;
+
+        for (int res = 0; res < NB_RES; ++res) {
+            if (md->size[res] == 0) continue;
+
+            uint64_t offset = md->offset[res];
+            // Same content as another image: share a single copy
+            if (res == ORIG_RES) {
+                const int same = content_index_find(src, md->SHA);
+                if (same != -1 && src->metadata[same].size[ORIG_RES] == md->size[ORIG_RES]) {
+                    offset = src->metadata[same].offset[ORIG_RES];
+                }
+            }
+            blobs[nb_blobs].offset = offset;
+            blobs[nb_blobs].size = md->size[res];
+            blobs[nb_blobs].target = &dst->metadata[i].offset[res];
+            ++nb_blobs;
+        }
+
+        // WebP variants, still of this content
+        if (dst->codecs == NULL || memcmp(src->codecs[i].SHA, md->SHA, SHA256_DIGEST_LENGTH) != 0) continue;
+        memcpy(dst->codecs[i].SHA, md->SHA, SHA256_DIGEST_LENGTH);
+        for (int res = 0; res < ORIG_RES; ++res) {
+            if (src->codecs[i].size[res] == 0) continue;
+
+            dst->codecs[i].size[res] = src->codecs[i].size[res];
+            blobs[nb_blobs].offset = src->codecs[i].offset[res];
+            blobs[nb_blobs].size = src->codecs[i].size[res];
+            blobs[nb_blobs].target = &dst->codecs[i].offset[res];
+            ++nb_blobs;
+        }
+    }
+    return nb_blobs;
+}
+
+/*******************************************************************
+ * Copies the listed contents, buffering the writes
+ */
+static int copy_blobs(struct imgfs_file* src, struct imgfs_file* dst,
+                      const struct gc_blob* blobs, size_t nb_blobs, uint64_t* end)
+{
+    char* buffer = malloc(GC_BUFFER_SIZE);
+    if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+
+    size_t used = 0;        // bytes waiting in buffer
+    uint64_t buffer_at = *end; // where they go in dst
+    int err = ERR_NONE;
+
+    for (size_t k = 0; k < nb_blobs && err == ERR_NONE; ++k) {
+        const struct gc_blob* blob = &blobs[k];
+
+        // Shared with the previous one: already copied
+        if (k > 0 && blob_cmp(blob, &blobs[k - 1]) == 0) {
+            *blob->target = *blobs[k - 1].target;
+            continue;
+        }
+
+        *blob->target = buffer_at + used;
+        uint64_t from = blob->offset;
+        size_t left = blob->size;
+        while (left > 0 && err == ERR_NONE) {
+            if (used == GC_BUFFER_SIZE) {
+                err = write_at(dst, buffer, used, buffer_at);
+                buffer_at += used;
+                used = 0;
+                if (err != ERR_NONE) break;
+            }
+            const size_t chunk = MIN(left, GC_BUFFER_SIZE - used);
+            err = read_at(src, buffer + used, chunk, from);
+            used += chunk;
+            from += chunk;
+            left -= chunk;
+        }
+    }
+
+    if (err == ERR_NONE && used > 0) {
+        err = write_at(dst, buffer, used, buffer_at);
+    }
+    *end = buffer_at + used;
+
+    free(buffer);
+    return err;
+}
+
+/*******************************************************************
+ * Writes the compacted imgFS to imgfs_tmp_bkp_path
+ */
+static int write_compacted(struct imgfs_file* src, const char* imgfs_tmp_bkp_path,
+                           uint64_t* new_size)
+{
+    struct imgfs_file dst;
+    zero_init_var(dst);
+    dst.header = src->header;
+
+    // Same slots, with the contents moved; the codec region as well
+    dst.metadata = calloc(src->header.max_files, sizeof(struct img_metadata));
+    if (src->codecs != NULL) dst.codecs = calloc(src->header.max_files, sizeof(struct img_codec_variants));
+    struct gc_blob* blobs = calloc((size_t) src->header.max_files * (NB_RES + ORIG_RES), sizeof(struct gc_blob));
+    if (dst.metadata == NULL || blobs == NULL || (src->codecs != NULL && dst.codecs == NULL)) {
+        free(blobs);
+        do_close(&dst);
+        return ERR_OUT_OF_MEMORY;
+    }
+    dst.header.nb_files = 0;
+    for (uint32_t i = 0; i < src->header.max_files; ++i) {
+        if (src->metadata[i].is_valid != NON_EMPTY) continue;
+        dst.metadata[i] = src->metadata[i];
+        memset(dst.metadata[i].offset, 0, sizeof(dst.metadata[i].offset));
+        ++dst.header.nb_files;
+    }
+    ++dst.header.version;
+    dst.header.unused_64 = 0;
+
+    const size_t nb_blobs = collect_blobs(src, &dst, blobs);
+    qsort(blobs, nb_blobs, sizeof(struct gc_blob), blob_cmp);
+
+    dst.file = fopen(imgfs_tmp_bkp_path, "wb+");
+    if (dst.file == NULL) {
+        free(blobs);
+        do_close(&dst);
+        return ERR_IO;
+    }
+
+    // Contents first, then the header and metadata pointing to them
+    uint64_t end = sizeof(struct imgfs_header) + metadata_region_size(&dst.header);
+    int err = copy_blobs(src, &dst, blobs, nb_blobs, &end);
+    free(blobs);
+    if (err == ERR_NONE && dst.codecs != NULL) {
+        const size_t region_size = (size_t) dst.header.max_files * sizeof(struct img_codec_variants);
+        dst.header.unused_64 = end;
+        err = write_at(&dst, dst.codecs, region_size, end);
+        end += region_size;
+    }
+    if (err == ERR_NONE) {
+        err = write_metadata_range(&dst, 0, dst.header.max_files, 0);
+    }
+    if (err == ERR_NONE) err = write_header(&dst);
+    // On disk before it replaces the original
+    if (err == ERR_NONE && (fflush(dst.file) != 0 || fsync(fileno(dst.file)) != 0)) {
+        err = ERR_IO;
+    }
+    *new_size = end;
+
+    do_close(&dst);
+    return err;
+}
+
+static double elapsed_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Removes the deleted images by moving the existing ones
+ *
+ * @param imgfs_path The path to the imgFS file
+ * @param imgfs_tmp_bkp_path The path to the a (to be created) temporary imgFS backup file
+ * @return Some error code. 0 if no error.
+ */
+int do_gbcollect(const char* imgfs_path, const char* imgfs_tmp_bkp_path)
+{
+    M_REQUIRE_NON_NULL(imgfs_path);
+    M_REQUIRE_NON_NULL(imgfs_tmp_bkp_path);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct imgfs_file src;
+    int err = do_open(imgfs_path, "rb", &src);
+    if (err != ERR_NONE) return err;
+
+    struct stat st;
+    if (fstat(fileno(src.file), &st) != 0) {
+        do_close(&src);
+        return ERR_IO;
+    }
+    const uint64_t old_size = (uint64_t) st.st_size;
+
+    uint64_t new_size = 0;
+    err = write_compacted(&src, imgfs_tmp_bkp_path, &new_size);
+    do_close(&src);
+
+    // Atomically replace the original file
+    if (err == ERR_NONE && rename(imgfs_tmp_bkp_path, imgfs_path) != 0) {
+        err = ERR_IO;
+    }
+    if (err != ERR_NONE) {
+        remove(imgfs_tmp_bkp_path);
+        return err;
+    }
+
+    const double seconds = elapsed_since(&start);
+    const uint64_t copied = new_size - sizeof(struct imgfs_header) - metadata_region_size(&src.header);
+    printf("reclaimed %" PRIu64 " bytes (%" PRIu64 " -> %" PRIu64 "), copied %" PRIu64
+           " bytes in %.3f s (%.1f MB/s)\n",
+           old_size > new_size ? old_size - new_size : 0, old_size, new_size, copied,
+           seconds, seconds > 0 ? (double) copied / seconds / 1e6 : 0.0);
+
+    return ERR_NONE;
+}
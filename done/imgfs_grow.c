@@ -0,0 +1,258 @@
+/**
+ * @file imgfs_grow.c
+ * @brief Growing the metadata capacity of an open imgFS file.
+ *
+ * The metadata region gets larger in place. The only contents moved are
+ * the ones stored where the larger region now goes: they are copied to
+ * the end of the file, and every image referring to them is updated.
+ * All other contents stay where they are. The codec region, if any, is
+ * written again after them, with as many entries as the metadata.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_batch.h"  // for imgfs_batch_flush(), imgfs_batch_reserve()
+#include "imgfs_codecs.h" // for struct img_codec_variants, codec_variants_free()
+#include "imgfs_index.h"  // for the *_build() and *_free() functions
+#include "util.h"         // for MIN
+
+#include <stdlib.h>      // for calloc, malloc, free
+#include <string.h>      // for memcmp, memcpy, memset
+#include <sys/mman.h>    // for mmap, munmap
+#include <sys/stat.h>    // for fstat
+
+// Size of the copy buffer used to move contents
+#define GROW_BUFFER_SIZE (1u << 20)
+
+/*******************************************************************
+ * Copies size bytes from offset from to offset to, through buffer
+ */
+static int move_content(struct imgfs_file* imgfs_file, char* buffer,
+                        uint64_t from, uint64_t to, uint32_t size)
+{
+    int err = ERR_NONE;
+    while (size > 0 && err == ERR_NONE) {
+        const uint32_t chunk = MIN(size, GROW_BUFFER_SIZE);
+        err = read_at(imgfs_file, buffer, chunk, from);
+        if (err == ERR_NONE) err = write_at(imgfs_file, buffer, chunk, to);
+        from += chunk;
+        to += chunk;
+        size -= chunk;
+    }
+    return err;
+}
+
+/*******************************************************************
+ * Where new data goes: never inside the region to be freed, even for
+ * an almost empty file
+ */
+static int data_end(struct imgfs_file* imgfs_file, uint64_t data_start, uint64_t* end)
+{
+    struct stat st;
+    if (fstat(fileno(imgfs_file->file), &st) != 0) return ERR_IO;
+    *end = (uint64_t) st.st_size > data_start ? (uint64_t) st.st_size : data_start;
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Moves the contents starting before data_start to the end of the
+ * file, updating the offsets in metadata (nb_entries entries)
+ */
+static int move_contents(struct imgfs_file* imgfs_file, struct img_metadata* metadata,
+                         uint32_t nb_entries, uint64_t data_start)
+{
+    uint64_t end = 0;
+    if (data_end(imgfs_file, data_start, &end) != ERR_NONE) return ERR_IO;
+
+    char* buffer = NULL;
+    int err = ERR_NONE;
+
+    for (uint32_t i = 0; i < nb_entries && err == ERR_NONE; ++i) {
+        if (metadata[i].is_valid != NON_EMPTY) continue;
+
+        for (int res = 0; res < NB_RES && err == ERR_NONE; ++res) {
+            const uint64_t offset = metadata[i].offset[res];
+            const uint32_t size = metadata[i].size[res];
+            if (size == 0 || offset >= data_start) continue;
+
+            if (buffer == NULL) {
+                buffer = malloc(GROW_BUFFER_SIZE);
+                if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+            }
+            err = move_content(imgfs_file, buffer, offset, end, size);
+            if (err != ERR_NONE) break;
+
+            // Shared contents are moved once, for all the images using them
+            for (uint32_t j = i; j < nb_entries; ++j) {
+                if (metadata[j].is_valid != NON_EMPTY) continue;
+                for (int r = 0; r < NB_RES; ++r) {
+                    if (metadata[j].size[r] != 0 && metadata[j].offset[r] == offset) {
+                        metadata[j].offset[r] = end;
+                    }
+                }
+            }
+            end += size;
+        }
+    }
+
+    free(buffer);
+    return err;
+}
+
+/*******************************************************************
+ * Same for the WebP variants (never shared), then writes the codec
+ * region, with room for max_files entries, after them
+ */
+static int move_codecs(struct imgfs_file* imgfs_file, struct img_codec_variants* codecs,
+                       uint32_t max_files, uint64_t data_start, uint64_t* region)
+{
+    uint64_t end = 0;
+    if (data_end(imgfs_file, data_start, &end) != ERR_NONE) return ERR_IO;
+
+    char* buffer = NULL;
+    int err = ERR_NONE;
+
+    for (uint32_t i = 0; i < imgfs_file->header.max_files && err == ERR_NONE; ++i) {
+        // Left by a deleted image: not worth moving
+        const struct img_metadata* image = &imgfs_file->metadata[i];
+        if (image->is_valid != NON_EMPTY || memcmp(codecs[i].SHA, image->SHA, SHA256_DIGEST_LENGTH) != 0) {
+            memset(&codecs[i], 0, sizeof(codecs[i]));
+            continue;
+        }
+        for (int res = 0; res < ORIG_RES && err == ERR_NONE; ++res) {
+            const uint32_t size = codecs[i].size[res];
+            if (size == 0 || codecs[i].offset[res] >= data_start) continue;
+
+            if (buffer == NULL) {
+                buffer = malloc(GROW_BUFFER_SIZE);
+                if (buffer == NULL) return ERR_OUT_OF_MEMORY;
+            }
+            err = move_content(imgfs_file, buffer, codecs[i].offset[res], end, size);
+            codecs[i].offset[res] = end;
+            end += size;
+        }
+    }
+    free(buffer);
+
+    if (err == ERR_NONE) err = write_at(imgfs_file, codecs, (size_t) max_files * sizeof(*codecs), end);
+    *region = end;
+    return err;
+}
+
+/*******************************************************************
+ * Maps the grown metadata region again; keeps the plain array if not possible
+ */
+static void remap(struct imgfs_file* imgfs_file, struct img_metadata* metadata)
+{
+    munmap(imgfs_file->mapping, imgfs_file->mapping_size);
+    imgfs_file->mapping = NULL;
+    imgfs_file->mapping_size = 0;
+    imgfs_file->metadata = metadata;
+
+    const size_t size = sizeof(struct imgfs_header)
+                        + (size_t) imgfs_file->header.max_files * sizeof(struct img_metadata);
+    // Written just before, so the file is writable and large enough
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(imgfs_file->file), 0);
+    if (mapping == MAP_FAILED) return;
+
+    imgfs_file->mapping = mapping;
+    imgfs_file->mapping_size = size;
+    imgfs_file->metadata = (struct img_metadata*) ((char*) mapping + sizeof(struct imgfs_header));
+    free(metadata);
+}
+
+/*******************************************************************
+ * The indexes are sized after max_files
+ */
+static int rebuild_indexes(struct imgfs_file* imgfs_file)
+{
+    name_index_free(imgfs_file);
+    content_index_free(imgfs_file);
+    empty_slots_free(imgfs_file);
+
+    int err = name_index_build(imgfs_file);
+    if (err == ERR_NONE) err = content_index_build(imgfs_file);
+    if (err == ERR_NONE) err = empty_slots_build(imgfs_file);
+    return err;
+}
+
+/**
+ * @brief Increases the maximum number of images of an open imgFS file.
+ *
+ * @param imgfs_file The main in-memory data structure
+ * @param max_files The new maximum number of images
+ * @return Some error code. 0 if no error.
+ */
+int do_grow(struct imgfs_file* imgfs_file, uint32_t max_files)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    const struct imgfs_header old_header = imgfs_file->header;
+    if (max_files <= old_header.max_files) return ERR_MAX_FILES;
+    // The v2 regions all move: the new hot region would overwrite the
+    // image IDs still referred to by the old header
+    if (old_header.unused_32 != IMGFS_FORMAT_V1) return NOT_IMPLEMENTED;
+
+    // Pending writes refer to the current layout
+    int err = imgfs_batch_flush(imgfs_file);
+    if (err == ERR_NONE) err = imgfs_batch_reserve(imgfs_file, max_files);
+    if (err != ERR_NONE) return err;
+
+    struct img_metadata* metadata = calloc(max_files, sizeof(struct img_metadata));
+    if (metadata == NULL) return ERR_OUT_OF_MEMORY;
+    memcpy(metadata, imgfs_file->metadata, (size_t) old_header.max_files * sizeof(struct img_metadata));
+
+    // The codec region gets as many entries as the metadata
+    struct img_codec_variants* codecs = NULL;
+    if (imgfs_file->codecs != NULL) {
+        codecs = calloc(max_files, sizeof(struct img_codec_variants));
+        if (codecs == NULL) {
+            free(metadata);
+            return ERR_OUT_OF_MEMORY;
+        }
+        memcpy(codecs, imgfs_file->codecs, (size_t) old_header.max_files * sizeof(struct img_codec_variants));
+    }
+
+    struct imgfs_header header = old_header;
+    header.max_files = max_files;
+    ++header.version;
+    const uint64_t data_start = sizeof(struct imgfs_header) + metadata_region_size(&header);
+
+    // Contents first, to their new place...
+    err = move_contents(imgfs_file, metadata, old_header.max_files, data_start);
+    if (err == ERR_NONE && codecs != NULL) {
+        err = move_codecs(imgfs_file, codecs, max_files, data_start, &header.unused_64);
+    }
+
+    // ...then the metadata referring to them: the old entries stay valid
+    // for the old header until the new one is written
+    struct img_metadata* old_metadata = imgfs_file->metadata;
+    if (err == ERR_NONE) {
+        imgfs_file->header = header;
+        imgfs_file->metadata = metadata;
+        err = write_metadata_range(imgfs_file, 0, max_files, 0);
+        if (err == ERR_NONE) err = write_at(imgfs_file, &header, sizeof(header), 0);
+        if (err != ERR_NONE) {
+            imgfs_file->header = old_header;
+            imgfs_file->metadata = old_metadata;
+        }
+    }
+    if (err != ERR_NONE) {
+        free(codecs);
+        free(metadata);
+        return err;
+    }
+
+    if (imgfs_file->mapping != NULL) {
+        remap(imgfs_file, metadata);
+    } else {
+        free(old_metadata);
+    }
+    codec_variants_free(imgfs_file);
+    imgfs_file->codecs = codecs;
+
+    return rebuild_indexes(imgfs_file);
+}
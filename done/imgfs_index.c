@@ -0,0 +1,397 @@
+/**
+ * @file imgfs_index.c
+ * @brief implementation of the in-memory indexes over the metadata array
+ *
+ * Open addressing with linear probing. Buckets hold (slot + 1), so that
+ * a zeroed table is empty; removed entries are marked with a tombstone
+ * and the table is rebuilt from the metadata once too many of them pile up.
+ *
+ * Both indexes share the same table code, only the key differs: the
+ * image ID for the name index, the SHA-256 digest for the content index.
+ *
+ * Empty slots are tracked in a bitmap (one bit set per empty slot),
+ * together with the first word that may still hold a set bit.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_index.h"
+
+#include <stdlib.h> // for calloc, free
+#include <string.h> // for strncmp, memcmp, memcpy
+
+#define BUCKET_FREE     0
+#define BUCKET_REMOVED  UINT32_MAX
+#define MIN_BUCKETS     16u
+#define MAX_INDEXED_FILES (UINT32_MAX >> 2)
+
+enum index_key {
+    BY_NAME,
+    BY_CONTENT
+};
+
+struct imgfs_index {
+    uint32_t* buckets; // slot + 1, BUCKET_FREE or BUCKET_REMOVED
+    uint32_t mask;     // number of buckets - 1 (a power of two)
+    uint32_t used;     // buckets that are not BUCKET_FREE
+};
+
+#define SLOTS_PER_WORD 64u
+
+struct imgfs_slots {
+    uint64_t* words;   // bit set <=> slot is empty
+    uint32_t nb_words;
+    uint32_t hint;     // no set bit in the words before this one
+};
+
+/*******************************************************************
+ * Where each kind of index lives in the imgFS structure
+ */
+static struct imgfs_index** index_of(struct imgfs_file* imgfs_file, enum index_key key)
+{
+    return key == BY_NAME ? &imgfs_file->name_index : &imgfs_file->content_index;
+}
+
+/*******************************************************************
+ * The key of a slot
+ */
+static const void* key_of(const struct imgfs_file* imgfs_file, enum index_key key, uint32_t slot)
+{
+    const struct img_metadata* metadata = &imgfs_file->metadata[slot];
+    return key == BY_NAME ? (const void*) metadata->img_id : (const void*) metadata->SHA;
+}
+
+/*******************************************************************
+ * FNV-1a hash of an image ID; a digest is already uniformly spread
+ */
+static uint32_t hash_key(enum index_key key, const void* value)
+{
+    uint32_t hash = 2166136261u;
+    if (key == BY_CONTENT) {
+        memcpy(&hash, value, sizeof(hash));
+        return hash;
+    }
+
+    const char* img_id = value;
+    for (size_t i = 0; i <= MAX_IMG_ID && img_id[i] != '\0'; ++i) {
+        hash ^= (unsigned char) img_id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*******************************************************************
+ * Does the given slot hold a valid image with that key?
+ */
+static int slot_matches(const struct imgfs_file* imgfs_file, enum index_key key,
+                        uint32_t slot, const void* value)
+{
+    if (slot >= imgfs_file->header.max_files
+        || imgfs_file->metadata[slot].is_valid != NON_EMPTY) return 0;
+
+    return key == BY_NAME
+           ? strncmp(imgfs_file->metadata[slot].img_id, value, MAX_IMG_ID + 1) == 0
+           : memcmp(imgfs_file->metadata[slot].SHA, value, SHA256_DIGEST_LENGTH) == 0;
+}
+
+/*******************************************************************
+ * Inserts a slot in the table, without any load check
+ */
+static void index_put(struct imgfs_index* index, uint32_t hash, uint32_t slot)
+{
+    uint32_t pos = hash & index->mask;
+    while (index->buckets[pos] != BUCKET_FREE && index->buckets[pos] != BUCKET_REMOVED) {
+        pos = (pos + 1) & index->mask;
+    }
+    if (index->buckets[pos] == BUCKET_FREE) ++index->used;
+    index->buckets[pos] = slot + 1;
+}
+
+/*******************************************************************
+ * Frees one index
+ */
+static void index_free(struct imgfs_file* imgfs_file, enum index_key key)
+{
+    if (imgfs_file == NULL) return;
+
+    struct imgfs_index** index = index_of(imgfs_file, key);
+    if (*index == NULL) return;
+
+    free((*index)->buckets);
+    free(*index);
+    *index = NULL;
+}
+
+/*******************************************************************
+ * Builds one index from the metadata array
+ */
+static int index_build(struct imgfs_file* imgfs_file, enum index_key key)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    index_free(imgfs_file, key);
+
+    const uint32_t max_files = imgfs_file->header.max_files;
+    if (max_files > MAX_INDEXED_FILES) return ERR_MAX_FILES;
+
+    // At least twice as many buckets as slots keeps the probe chains short
+    uint32_t nb_buckets = MIN_BUCKETS;
+    while (nb_buckets < 2 * max_files) nb_buckets <<= 1;
+
+    struct imgfs_index* index = calloc(1, sizeof(struct imgfs_index));
+    if (index == NULL) return ERR_OUT_OF_MEMORY;
+    index->buckets = calloc(nb_buckets, sizeof(uint32_t));
+    if (index->buckets == NULL) {
+        free(index);
+        return ERR_OUT_OF_MEMORY;
+    }
+    index->mask = nb_buckets - 1;
+
+    for (uint32_t i = 0; i < max_files; ++i) {
+        if (slot_state(imgfs_file, i) == NON_EMPTY) {
+            index_put(index, hash_key(key, key_of(imgfs_file, key, i)), i);
+        }
+    }
+
+    *index_of(imgfs_file, key) = index;
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Looks a valid image up by its key
+ */
+static int index_find(const struct imgfs_file* imgfs_file, enum index_key key, const void* value)
+{
+    if (imgfs_file == NULL || imgfs_file->metadata == NULL || value == NULL) return -1;
+
+    const struct imgfs_index* index = key == BY_NAME ? imgfs_file->name_index : imgfs_file->content_index;
+    if (index == NULL) {
+        // No index (e.g. structure not set up by do_open): plain scan
+        for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+            if (slot_matches(imgfs_file, key, i, value)) return (int) i;
+        }
+        return -1;
+    }
+
+    uint32_t pos = hash_key(key, value) & index->mask;
+    while (index->buckets[pos] != BUCKET_FREE) {
+        if (index->buckets[pos] != BUCKET_REMOVED
+            && slot_matches(imgfs_file, key, index->buckets[pos] - 1, value)) {
+            return (int) (index->buckets[pos] - 1);
+        }
+        pos = (pos + 1) & index->mask;
+    }
+    return -1;
+}
+
+/*******************************************************************
+ * Adds a (valid) slot to one index
+ */
+static int index_add(struct imgfs_file* imgfs_file, enum index_key key, uint32_t slot)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    if (slot >= imgfs_file->header.max_files) return ERR_INVALID_ARGUMENT;
+
+    struct imgfs_index* index = *index_of(imgfs_file, key);
+    if (index == NULL) return ERR_NONE;
+
+    // Too many tombstones: rebuilding also picks the new slot up
+    if (4 * (uint64_t) (index->used + 1) > 3 * ((uint64_t) index->mask + 1)) {
+        return index_build(imgfs_file, key);
+    }
+
+    index_put(index, hash_key(key, key_of(imgfs_file, key, slot)), slot);
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Removes a slot from one index
+ */
+static void index_remove(struct imgfs_file* imgfs_file, enum index_key key, uint32_t slot)
+{
+    if (imgfs_file == NULL || imgfs_file->metadata == NULL
+        || slot >= imgfs_file->header.max_files) return;
+
+    struct imgfs_index* index = *index_of(imgfs_file, key);
+    if (index == NULL) return;
+
+    uint32_t pos = hash_key(key, key_of(imgfs_file, key, slot)) & index->mask;
+    while (index->buckets[pos] != BUCKET_FREE) {
+        if (index->buckets[pos] == slot + 1) {
+            index->buckets[pos] = BUCKET_REMOVED;
+            return;
+        }
+        pos = (pos + 1) & index->mask;
+    }
+}
+
+/*******************************************************************
+ * Name index
+ */
+int name_index_build(struct imgfs_file* imgfs_file)
+{
+    return index_build(imgfs_file, BY_NAME);
+}
+
+void name_index_free(struct imgfs_file* imgfs_file)
+{
+    index_free(imgfs_file, BY_NAME);
+}
+
+int name_index_find(const struct imgfs_file* imgfs_file, const char* img_id)
+{
+    return index_find(imgfs_file, BY_NAME, img_id);
+}
+
+int name_index_add(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    return index_add(imgfs_file, BY_NAME, index);
+}
+
+void name_index_remove(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    index_remove(imgfs_file, BY_NAME, index);
+}
+
+/*******************************************************************
+ * Content index
+ */
+int content_index_build(struct imgfs_file* imgfs_file)
+{
+    return index_build(imgfs_file, BY_CONTENT);
+}
+
+void content_index_free(struct imgfs_file* imgfs_file)
+{
+    index_free(imgfs_file, BY_CONTENT);
+}
+
+int content_index_find(const struct imgfs_file* imgfs_file, const unsigned char* SHA)
+{
+    return index_find(imgfs_file, BY_CONTENT, SHA);
+}
+
+int content_index_next(const struct imgfs_file* imgfs_file, const unsigned char* SHA, uint32_t* cursor)
+{
+    if (imgfs_file == NULL || imgfs_file->metadata == NULL || SHA == NULL || cursor == NULL) return -1;
+
+    const struct imgfs_index* index = imgfs_file->content_index;
+    if (index == NULL) {
+        // No index: the cursor is the next slot to look at
+        while (*cursor < imgfs_file->header.max_files) {
+            const uint32_t slot = (*cursor)++;
+            if (slot_matches(imgfs_file, BY_CONTENT, slot, SHA)) return (int) slot;
+        }
+        return -1;
+    }
+
+    // The cursor is the number of buckets of the probe chain already seen
+    const uint32_t start = hash_key(BY_CONTENT, SHA);
+    while (*cursor <= index->mask) {
+        const uint32_t pos = (start + (*cursor)++) & index->mask;
+        if (index->buckets[pos] == BUCKET_FREE) break;
+        if (index->buckets[pos] != BUCKET_REMOVED
+            && slot_matches(imgfs_file, BY_CONTENT, index->buckets[pos] - 1, SHA)) {
+            return (int) (index->buckets[pos] - 1);
+        }
+    }
+    *cursor = index->mask + 1;
+    return -1;
+}
+
+int content_index_add(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    return index_add(imgfs_file, BY_CONTENT, index);
+}
+
+void content_index_remove(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    index_remove(imgfs_file, BY_CONTENT, index);
+}
+
+/*******************************************************************
+ * Empty slots bitmap
+ */
+int empty_slots_build(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+    empty_slots_free(imgfs_file);
+
+    const uint32_t max_files = imgfs_file->header.max_files;
+    struct imgfs_slots* slots = calloc(1, sizeof(struct imgfs_slots));
+    if (slots == NULL) return ERR_OUT_OF_MEMORY;
+    slots->nb_words = (uint32_t) (((uint64_t) max_files + SLOTS_PER_WORD - 1) / SLOTS_PER_WORD);
+    slots->words = calloc(slots->nb_words == 0 ? 1 : slots->nb_words, sizeof(uint64_t));
+    if (slots->words == NULL) {
+        free(slots);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < max_files; ++i) {
+        if (slot_state(imgfs_file, i) == EMPTY) {
+            slots->words[i / SLOTS_PER_WORD] |= UINT64_C(1) << (i % SLOTS_PER_WORD);
+        }
+    }
+
+    imgfs_file->empty_slots = slots;
+    return ERR_NONE;
+}
+
+void empty_slots_free(struct imgfs_file* imgfs_file)
+{
+    if (imgfs_file == NULL || imgfs_file->empty_slots == NULL) return;
+
+    free(imgfs_file->empty_slots->words);
+    free(imgfs_file->empty_slots);
+    imgfs_file->empty_slots = NULL;
+}
+
+int empty_slots_first(struct imgfs_file* imgfs_file)
+{
+    if (imgfs_file == NULL || imgfs_file->metadata == NULL) return -1;
+
+    struct imgfs_slots* slots = imgfs_file->empty_slots;
+    if (slots == NULL) {
+        // No bitmap (e.g. structure not set up by do_open): plain scan
+        for (uint32_t i = 0; i < imgfs_file->header.max_files; ++i) {
+            if (slot_state(imgfs_file, i) == EMPTY) return (int) i;
+        }
+        return -1;
+    }
+
+    while (slots->hint < slots->nb_words) {
+        uint64_t* word = &slots->words[slots->hint];
+        while (*word != 0) {
+            const uint32_t slot = slots->hint * SLOTS_PER_WORD + (uint32_t) __builtin_ctzll(*word);
+            if (slot < imgfs_file->header.max_files
+                && slot_state(imgfs_file, slot) == EMPTY) return (int) slot;
+            // Stale bit (slot filled behind the bitmap's back)
+            *word &= *word - 1;
+        }
+        ++slots->hint;
+    }
+    return -1;
+}
+
+void empty_slots_take(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    if (imgfs_file == NULL || imgfs_file->empty_slots == NULL
+        || index >= imgfs_file->header.max_files) return;
+
+    imgfs_file->empty_slots->words[index / SLOTS_PER_WORD] &= ~(UINT64_C(1) << (index % SLOTS_PER_WORD));
+}
+
+void empty_slots_release(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    if (imgfs_file == NULL || imgfs_file->empty_slots == NULL
+        || index >= imgfs_file->header.max_files) return;
+
+    struct imgfs_slots* slots = imgfs_file->empty_slots;
+    slots->words[index / SLOTS_PER_WORD] |= UINT64_C(1) << (index % SLOTS_PER_WORD);
+    if (index / SLOTS_PER_WORD < slots->hint) slots->hint = index / SLOTS_PER_WORD;
+}
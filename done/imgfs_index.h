@@ -0,0 +1,168 @@
+/**
+ * @file imgfs_index.h
+ * @brief In-memory indexes over the metadata array.
+ *
+ * The indexes are built by do_open() from the metadata array and kept in
+ * sync by do_insert() and do_delete(), so that finding an image by its
+ * ID, or an image with the same content (SHA-256), costs a hash probe
+ * instead of a scan of the whole metadata array. Likewise, a bitmap of
+ * the empty slots gives the first free slot without scanning.
+ *
+ * The indexes only store slot numbers: every hit is checked against the
+ * metadata itself, so an entry can never return an image that has been
+ * invalidated in the meantime.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#pragma once
+
+#include "imgfs.h" // for struct imgfs_file
+
+#include <stdint.h> // for uint32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Builds the name index of imgfs_file from its metadata array.
+ *        Any previous index is freed first.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int name_index_build(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Frees the name index of imgfs_file (if any).
+ *
+ * @param imgfs_file The main in-memory structure
+ */
+void name_index_free(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Finds the slot of a valid image given its ID.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param img_id The ID of the image to look for
+ * @return The index of the image in the metadata array, or -1 if not found.
+ */
+int name_index_find(const struct imgfs_file* imgfs_file, const char* img_id);
+
+/**
+ * @brief Adds the image stored at the given slot to the name index.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @return Some error code. 0 if no error.
+ */
+int name_index_add(struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Removes the image stored at the given slot from the name index.
+ *        Must be called while metadata[index].img_id is still set.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ */
+void name_index_remove(struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Builds the content index of imgfs_file from its metadata array.
+ *        Any previous index is freed first.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int content_index_build(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Frees the content index of imgfs_file (if any).
+ *
+ * @param imgfs_file The main in-memory structure
+ */
+void content_index_free(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Finds the slot of a valid image given its SHA-256 digest.
+ *        When several images share that content, any of them is returned.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param SHA The SHA256_DIGEST_LENGTH bytes digest to look for
+ * @return The index of the image in the metadata array, or -1 if not found.
+ */
+int content_index_find(const struct imgfs_file* imgfs_file, const unsigned char* SHA);
+
+/**
+ * @brief Iterates over all the valid images sharing a SHA-256 digest.
+ *        The metadata must not change during the iteration.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param SHA The SHA256_DIGEST_LENGTH bytes digest to look for
+ * @param cursor The iteration state, to be set to 0 before the first call
+ * @return The index of the next such image in the metadata array, or -1 if no more.
+ */
+int content_index_next(const struct imgfs_file* imgfs_file, const unsigned char* SHA, uint32_t* cursor);
+
+/**
+ * @brief Adds the image stored at the given slot to the content index.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ * @return Some error code. 0 if no error.
+ */
+int content_index_add(struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Removes the image stored at the given slot from the content index.
+ *        Must be called while metadata[index].SHA is still set.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the image in the metadata array
+ */
+void content_index_remove(struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Builds the empty slots bitmap of imgfs_file from its metadata array.
+ *        Any previous bitmap is freed first.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return Some error code. 0 if no error.
+ */
+int empty_slots_build(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Frees the empty slots bitmap of imgfs_file (if any).
+ *
+ * @param imgfs_file The main in-memory structure
+ */
+void empty_slots_free(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Finds the first (lowest) empty slot of the metadata array.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @return The index of the slot, or -1 if the metadata array is full.
+ */
+int empty_slots_first(struct imgfs_file* imgfs_file);
+
+/**
+ * @brief Marks the given slot as used.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the slot in the metadata array
+ */
+void empty_slots_take(struct imgfs_file* imgfs_file, uint32_t index);
+
+/**
+ * @brief Marks the given slot as empty again.
+ *
+ * @param imgfs_file The main in-memory structure
+ * @param index The index of the slot in the metadata array
+ */
+void empty_slots_release(struct imgfs_file* imgfs_file, uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,57 +1,37 @@
 #include "imgfs.h"  // for struct imgfs_file
 #include <string.h> // for strncmp
+#include <stdlib.h> // for malloc, free
+#include <openssl/evp.h> // for EVP_DigestUpdate()
 #include "error.h" // for error codes
+#include "image_content.h" // for get_resolution(), get_stored_resolution()
 #include "image_dedup.h" // for do_name_and_content_dedup()
-/**
- * @brief Insert image in the imgFS file
- *
- * @param buffer Pointer to the raw image content
- * @param size Image size
- * @param img_id Image ID
- * @return Some error code. 0 if no error.
- */
-int do_insert(const char* image_buffer, size_t image_size,
-              const char* img_id, struct imgfs_file* imgfs_file)
-{
-    // Checking the validity of the parameters
-    M_REQUIRE_NON_NULL(image_buffer);
-    M_REQUIRE_NON_NULL(img_id);
-    M_REQUIRE_NON_NULL(imgfs_file);
-    M_REQUIRE_NON_NULL(imgfs_file->metadata);
-
-
-    if(image_size <= 0) return ERR_INVALID_ARGUMENT;
+#include "imgfs_index.h" // for empty_slots_first(), name_index_add(), content_index_add()
 
+// Parts in which a streamed content is read, hashed and written
+#define STREAM_CHUNK_SIZE 65536u
 
+/*******************************************************************
+ * Records a new image, under the lock: its content is either given,
+ * and appended unless the same is stored already, or already written
+ * at stored_offset
+ */
+static int add_image(struct imgfs_file* imgfs_file, const char* img_id, const unsigned char* SHA,
+                     uint32_t image_size, uint32_t width, uint32_t height,
+                     const char* image_buffer, uint64_t stored_offset, int* stored_used)
+{
     // Check if the image file system is full
     uint32_t max_files=imgfs_file->header.max_files;
     if(imgfs_file->header.nb_files >= max_files) return ERR_IMGFS_FULL;
 
-
-
-    int index = -1;
-    for (int i = 0; i < max_files; ++i) {
-        if (imgfs_file->metadata[i].is_valid == EMPTY) {
-            index = i;
-            break;
-        }
-    }
+    // First empty slot
+    int index = empty_slots_first(imgfs_file);
     if (index == -1) return ERR_IMGFS_FULL;
 
     struct img_metadata previous = imgfs_file->metadata[index];
-    // Compute the SHA-256 hash of the image
-    SHA256( (const unsigned char*) image_buffer, image_size, imgfs_file->metadata[index].SHA);
+    memcpy(imgfs_file->metadata[index].SHA, SHA, SHA256_DIGEST_LENGTH);
     strcpy(imgfs_file->metadata[index].img_id, img_id);
 
-    imgfs_file->metadata[index].size[ORIG_RES] = (uint32_t) image_size;
-
-    uint32_t width ;
-    uint32_t height ;
-
-    // Get the resolution of the image
-    int err = get_resolution(&height, &width, image_buffer, image_size);
-    if (err != ERR_NONE) return err;
-
+    imgfs_file->metadata[index].size[ORIG_RES] = image_size;
 
     //Initializing variables
     imgfs_file->metadata[index].unused_16 = EMPTY;
@@ -67,9 +47,6 @@ int do_insert(const char* image_buffer, size_t image_size,
     imgfs_file->metadata[index].offset[SMALL_RES] = EMPTY;
 
 
-    imgfs_file->header.nb_files++;
-    imgfs_file->header.version++;
-
     // Perform deduplication
     int dedup = do_name_and_content_dedup(imgfs_file, index);
     if (dedup != ERR_NONE) {
@@ -77,22 +54,162 @@ int do_insert(const char* image_buffer, size_t image_size,
         return dedup;
     }
 
+    imgfs_file->header.nb_files++;
+    imgfs_file->header.version++;
+
     // Write the image to the file if not already present
+    int appended = 0;
     if (imgfs_file->metadata[index].offset[ORIG_RES] == EMPTY) {
-        fseek(imgfs_file->file, EMPTY, SEEK_END);
-        uint64_t pos = ftell(imgfs_file->file);
-        size_t write = fwrite(image_buffer, NON_EMPTY, image_size, imgfs_file->file);
-        if (write != image_size) return ERR_IO;
+        uint64_t pos = stored_offset;
+        if (image_buffer != NULL && append_data(imgfs_file, image_buffer, image_size, &pos) != ERR_NONE) {
+            // The metadata array may be the file itself (do_open_mmap): undo
+            memcpy(&imgfs_file->metadata[index], &previous, sizeof(struct img_metadata));
+            imgfs_file->header.nb_files--;
+            imgfs_file->header.version--;
+            return ERR_IO;
+        }
 
         imgfs_file->metadata[index].offset[ORIG_RES] = pos;
+        appended = image_buffer != NULL;
+        if (stored_used != NULL) *stored_used = image_buffer == NULL;
+    }
+    // Update the header, then the metadata
+    int err_write = write_header(imgfs_file);
+    if (err_write == ERR_NONE) err_write = write_metadata(imgfs_file, (uint32_t) index);
+    if (err_write != ERR_NONE) {
+        // Not recorded: undo, on disk as well as far as it goes
+        if (appended) release_data(imgfs_file, imgfs_file->metadata[index].offset[ORIG_RES], image_size);
+        memcpy(&imgfs_file->metadata[index], &previous, sizeof(struct img_metadata));
+        refresh_hot(imgfs_file, (uint32_t) index, 1);
+        imgfs_file->header.nb_files--;
+        imgfs_file->header.version--;
+        (void) write_header(imgfs_file);
+        if (stored_used != NULL) *stored_used = 0;
+        return err_write;
     }
-    // Update the header
-    if(fseek(imgfs_file->file, EMPTY, SEEK_SET) )   return ERR_IO;
-    if ((fwrite(&imgfs_file->header, sizeof(char), sizeof(struct imgfs_header), imgfs_file->file)) != sizeof(struct imgfs_header)) return ERR_IO;
 
-    //Update the metadta
-    if(fseek(imgfs_file->file, sizeof(struct imgfs_header) +  sizeof(struct img_metadata)*index, SEEK_SET) ) return ERR_IO;
-    if ((fwrite(&imgfs_file->metadata[index], sizeof(char), sizeof(struct img_metadata), imgfs_file->file)) != sizeof(struct img_metadata)) return ERR_IO;
+    // The image can now be found by its ID and by its content
+    empty_slots_take(imgfs_file, (uint32_t) index);
+    int err_index = name_index_add(imgfs_file, (uint32_t) index);
+    if (err_index != ERR_NONE) return err_index;
+    return content_index_add(imgfs_file, (uint32_t) index);
+}
 
-    return ERR_NONE;
-}
\ No newline at end of file
+/**
+ * @brief Insert image in the imgFS file
+ *
+ * @param buffer Pointer to the raw image content
+ * @param size Image size
+ * @param img_id Image ID
+ * @return Some error code. 0 if no error.
+ */
+int do_insert(const char* image_buffer, size_t image_size,
+              const char* img_id, struct imgfs_file* imgfs_file)
+{
+    // Checking the validity of the parameters
+    M_REQUIRE_NON_NULL(image_buffer);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+
+
+    if(image_size <= 0) return ERR_INVALID_ARGUMENT;
+
+
+    // Check if the image file system is full
+    uint32_t max_files=imgfs_file->header.max_files;
+    if(imgfs_file->header.nb_files >= max_files) return ERR_IMGFS_FULL;
+
+    // Compute the SHA-256 hash of the image
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    SHA256( (const unsigned char*) image_buffer, image_size, SHA);
+
+    uint32_t width ;
+    uint32_t height ;
+
+    // Get the resolution of the image
+    int err = get_resolution(&height, &width, image_buffer, image_size);
+    if (err != ERR_NONE) return err;
+
+    return add_image(imgfs_file, img_id, SHA, (uint32_t) image_size, width, height, image_buffer, 0, NULL);
+}
+
+/*******************************************************************
+ * Copies a content from its reader to the file, hashing it on the way
+ */
+static int stream_content(struct imgfs_file* imgfs_file, uint64_t offset, size_t image_size,
+                          content_reader reader, void* arg, unsigned char* SHA)
+{
+    char* chunk = malloc(STREAM_CHUNK_SIZE);
+    EVP_MD_CTX* sha = EVP_MD_CTX_new();
+    int err = chunk == NULL || sha == NULL ? ERR_OUT_OF_MEMORY
+              : EVP_DigestInit_ex(sha, EVP_sha256(), NULL) != 1 ? ERR_RUNTIME : ERR_NONE;
+
+    size_t written = 0;
+    while (err == ERR_NONE && written < image_size) {
+        const size_t wanted = image_size - written < STREAM_CHUNK_SIZE ? image_size - written : STREAM_CHUNK_SIZE;
+        size_t got = 0;
+        err = reader(arg, chunk, wanted, &got);
+        // Shorter than announced
+        if (err == ERR_NONE && (got == 0 || got > wanted)) err = ERR_IO;
+        if (err == ERR_NONE && EVP_DigestUpdate(sha, chunk, got) != 1) err = ERR_RUNTIME;
+        if (err == ERR_NONE) err = write_at(imgfs_file, chunk, got, offset + written);
+        written += got;
+    }
+    if (err == ERR_NONE && EVP_DigestFinal_ex(sha, SHA, NULL) != 1) err = ERR_RUNTIME;
+
+    EVP_MD_CTX_free(sha);
+    free(chunk);
+    return err;
+}
+
+/*******************************************************************
+ * Insertion of a content read in parts, in three steps: the caller
+ * holds its lock for the first and the last one only
+ */
+int do_insert_reserve(struct imgfs_file* imgfs_file, const char* img_id, size_t image_size, uint64_t* offset)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(offset);
+    if (image_size == 0 || image_size > UINT32_MAX) return ERR_INVALID_ARGUMENT;
+
+    // Refused before reading anything when it cannot be inserted anyway
+    if (imgfs_file->header.nb_files >= imgfs_file->header.max_files) return ERR_IMGFS_FULL;
+    if (name_index_find(imgfs_file, img_id) != -1) return ERR_DUPLICATE_ID;
+    return reserve_data(imgfs_file, image_size, offset);
+}
+
+int do_insert_stream(struct imgfs_file* imgfs_file, uint64_t offset, size_t image_size,
+                     content_reader reader, void* arg,
+                     unsigned char* SHA, uint32_t* width, uint32_t* height)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(reader);
+    M_REQUIRE_NON_NULL(SHA);
+    M_REQUIRE_NON_NULL(width);
+    M_REQUIRE_NON_NULL(height);
+    if (image_size == 0 || image_size > UINT32_MAX) return ERR_INVALID_ARGUMENT;
+
+    const int err = stream_content(imgfs_file, offset, image_size, reader, arg, SHA);
+    if (err != ERR_NONE) return err;
+    return get_stored_resolution(imgfs_file, offset, (uint32_t) image_size, height, width);
+}
+
+int do_insert_commit(struct imgfs_file* imgfs_file, const char* img_id, const unsigned char* SHA,
+                     size_t image_size, uint32_t width, uint32_t height, uint64_t offset)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(SHA);
+    if (image_size == 0 || image_size > UINT32_MAX) return ERR_INVALID_ARGUMENT;
+
+    int stored_used = 0;
+    const int err = add_image(imgfs_file, img_id, SHA, (uint32_t) image_size, width, height, NULL, offset,
+                              &stored_used);
+    // Failed, or the same content was stored already
+    if (!stored_used) release_data(imgfs_file, offset, image_size);
+    return err;
+}
@@ -28,7 +28,7 @@ int do_list(const struct imgfs_file *imgfs_file,
         int i = 0;
         // Print metadata of all valid images
         while (i < (int)(imgfs_file->header.max_files) && valid_images < (int)(imgfs_file->header.nb_files)) {
-            if (imgfs_file->metadata[i].is_valid == NON_EMPTY) {
+            if (slot_state(imgfs_file, i) == NON_EMPTY) {
                 print_metadata(&(imgfs_file->metadata[i]));
                 valid_images++;
             }
@@ -58,7 +58,7 @@ int do_list(const struct imgfs_file *imgfs_file,
         int i = 0;
         int valid_images = 0;
         while (i < (int)(imgfs_file->header.max_files) && valid_images < (int)(imgfs_file->header.nb_files)) {
-            if (imgfs_file->metadata[i].is_valid == NON_EMPTY) {
+            if (slot_state(imgfs_file, i) == NON_EMPTY) {
                 struct json_object* imgid = json_object_new_string(imgfs_file->metadata[i].img_id);
                 if (imgid == NULL) {
                     perror("json_object_new_string");
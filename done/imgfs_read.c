@@ -1,33 +1,23 @@
 
 #include "imgfs.h"
+#include "imgfs_index.h"
 #include "error.h"
+#include "image_content.h" // for lazily_resize()
 #include <stdlib.h>  // for malloc, free
 #include <string.h>  // for memcpy
 
-int do_read(const char* img_id, int resolution, char** image_buffer, uint32_t* image_size, struct imgfs_file* imgfs_file)
+int do_locate(const char* img_id, int resolution, uint64_t* offset, uint32_t* size, struct imgfs_file* imgfs_file)
 {
     //Checking the validity of the parameters
     M_REQUIRE_NON_NULL(img_id);
     M_REQUIRE_NON_NULL(imgfs_file);
     M_REQUIRE_NON_NULL(imgfs_file->metadata);
-    M_REQUIRE_NON_NULL(image_buffer);
-    M_REQUIRE_NON_NULL(image_size);
+    M_REQUIRE_NON_NULL(offset);
+    M_REQUIRE_NON_NULL(size);
+    if (resolution < THUMB_RES || resolution > ORIG_RES) return ERR_RESOLUTIONS;
 
     // Find the image in metadata
-    int i = 0;
-    int j = 0;
-    int index = -1;
-    while (j<imgfs_file->header.nb_files && i < imgfs_file->header.max_files) {
-        if (imgfs_file->metadata[i].is_valid) {
-            if(strcmp(imgfs_file->metadata[i].img_id, img_id) == 0) {
-                index = i;
-                break;
-            }
-            j++;
-        }
-        i++;
-    }
-
+    int index = name_index_find(imgfs_file, img_id);
     if (index == -1) {
         return ERR_IMAGE_NOT_FOUND;
     }
@@ -39,8 +29,23 @@ int do_read(const char* img_id, int resolution, char** image_buffer, uint32_t* i
         }
     }
 
-    // Set image size for output
-    *image_size = imgfs_file->metadata[index].size[resolution];
+    // Where the image content is stored
+    *offset = imgfs_file->metadata[index].offset[resolution];
+    *size = imgfs_file->metadata[index].size[resolution];
+
+    return ERR_NONE;
+}
+
+int do_read(const char* img_id, int resolution, char** image_buffer, uint32_t* image_size, struct imgfs_file* imgfs_file)
+{
+    //Checking the validity of the parameters
+    M_REQUIRE_NON_NULL(image_buffer);
+    M_REQUIRE_NON_NULL(image_size);
+
+    // Find the image content (resizing it if needed)
+    uint64_t offset = 0;
+    int err = do_locate(img_id, resolution, &offset, image_size, imgfs_file);
+    if (err != ERR_NONE) return err;
 
     // Allocate memory for the image buffer
     *image_buffer = malloc(*image_size);
@@ -48,13 +53,12 @@ int do_read(const char* img_id, int resolution, char** image_buffer, uint32_t* i
         return ERR_OUT_OF_MEMORY;
     }
 
-    // Position file pointer and read the image
-    fseek(imgfs_file->file, imgfs_file->metadata[index].offset[resolution], SEEK_SET);
-    if (fread(*image_buffer, 1, *image_size, imgfs_file->file) != *image_size) {
+    // Read the image at its offset
+    if (read_at(imgfs_file, *image_buffer, *image_size, offset) != ERR_NONE) {
         free(*image_buffer);
         *image_buffer = NULL;
         return ERR_IO;
     }
 
     return ERR_NONE;
-}
\ No newline at end of file
+}
@@ -0,0 +1,300 @@
+/**
+ * @file imgfs_renditions.c
+ * @brief implementation of the cache of renditions
+ *
+ * The renditions are chained in hash buckets, for the lookups, and in a
+ * doubly linked list from the most to the least recently used, for the
+ * evictions. A single lock protects both; the contents are copied in and
+ * out, so that an eviction never frees what a reader still uses.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_renditions.h"
+#include "image_content.h" // for rendition_source(), resize_stored_content()
+#include "imgfs_index.h"   // for name_index_find()
+
+#include <stdlib.h>     // for calloc, malloc, free
+#include <string.h>     // for memcpy, memcmp
+#include <vips/vips.h>  // for g_free
+
+#define NB_BUCKETS 256u
+
+struct rendition {
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    uint32_t width;
+    uint32_t height;
+    void* content;
+    size_t size;
+    struct rendition* newer;  // LRU list
+    struct rendition* older;
+    struct rendition* chain;  // same bucket
+};
+
+struct rendition_cache {
+    pthread_mutex_t lock;     // protects what follows
+    struct rendition* buckets[NB_BUCKETS];
+    struct rendition* newest;
+    struct rendition* oldest;
+    size_t capacity;
+    size_t used;
+};
+
+/*******************************************************************
+ * Hashing: the SHA is already uniformly distributed
+ */
+static size_t bucket_of(const unsigned char* SHA, uint32_t width, uint32_t height)
+{
+    const size_t h = ((size_t) SHA[0] << 8 | SHA[1]) ^ (width * 31u) ^ height;
+    return h % NB_BUCKETS;
+}
+
+static struct rendition** find(struct rendition_cache* cache, const unsigned char* SHA,
+                               uint32_t width, uint32_t height)
+{
+    struct rendition** link = &cache->buckets[bucket_of(SHA, width, height)];
+    while (*link != NULL && ((*link)->width != width || (*link)->height != height
+                             || memcmp((*link)->SHA, SHA, SHA256_DIGEST_LENGTH) != 0)) {
+        link = &(*link)->chain;
+    }
+    return link;
+}
+
+/*******************************************************************
+ * LRU list
+ */
+static void unlink_lru(struct rendition_cache* cache, struct rendition* r)
+{
+    if (r->newer != NULL) r->newer->older = r->older;
+    else cache->newest = r->older;
+    if (r->older != NULL) r->older->newer = r->newer;
+    else cache->oldest = r->newer;
+    r->newer = r->older = NULL;
+}
+
+static void push_newest(struct rendition_cache* cache, struct rendition* r)
+{
+    r->older = cache->newest;
+    r->newer = NULL;
+    if (cache->newest != NULL) cache->newest->newer = r;
+    cache->newest = r;
+    if (cache->oldest == NULL) cache->oldest = r;
+}
+
+static void evict(struct rendition_cache* cache, struct rendition* r)
+{
+    unlink_lru(cache, r);
+    struct rendition** link = find(cache, r->SHA, r->width, r->height);
+    *link = r->chain;
+    cache->used -= r->size;
+    free(r->content);
+    free(r);
+}
+
+/*******************************************************************
+ * Create and free
+ */
+int rendition_cache_create(struct rendition_cache** cache, size_t capacity)
+{
+    M_REQUIRE_NON_NULL(cache);
+    if (capacity == 0) return ERR_INVALID_ARGUMENT;
+
+    struct rendition_cache* c = calloc(1, sizeof(struct rendition_cache));
+    if (c == NULL) return ERR_OUT_OF_MEMORY;
+    if (pthread_mutex_init(&c->lock, NULL) != 0) {
+        free(c);
+        return ERR_THREADING;
+    }
+    c->capacity = capacity;
+
+    *cache = c;
+    return ERR_NONE;
+}
+
+void rendition_cache_free(struct rendition_cache* cache)
+{
+    if (cache == NULL) return;
+
+    while (cache->oldest != NULL) evict(cache, cache->oldest);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/*******************************************************************
+ * Lookups and insertions
+ */
+int rendition_cache_get(struct rendition_cache* cache, const unsigned char* SHA,
+                        uint32_t width, uint32_t height, void** content, size_t* size)
+{
+    M_REQUIRE_NON_NULL(cache);
+    M_REQUIRE_NON_NULL(SHA);
+    M_REQUIRE_NON_NULL(content);
+    M_REQUIRE_NON_NULL(size);
+
+    int err = ERR_IMAGE_NOT_FOUND;
+    pthread_mutex_lock(&cache->lock);
+    struct rendition* r = *find(cache, SHA, width, height);
+    if (r != NULL) {
+        *content = malloc(r->size);
+        if (*content == NULL) {
+            err = ERR_OUT_OF_MEMORY;
+        } else {
+            memcpy(*content, r->content, r->size);
+            *size = r->size;
+            unlink_lru(cache, r);
+            push_newest(cache, r);
+            err = ERR_NONE;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return err;
+}
+
+int rendition_cache_put(struct rendition_cache* cache, const unsigned char* SHA,
+                        uint32_t width, uint32_t height, const void* content, size_t size)
+{
+    M_REQUIRE_NON_NULL(cache);
+    M_REQUIRE_NON_NULL(SHA);
+    M_REQUIRE_NON_NULL(content);
+    if (size > cache->capacity) return ERR_NONE;
+
+    struct rendition* r = calloc(1, sizeof(struct rendition));
+    if (r == NULL) return ERR_OUT_OF_MEMORY;
+    r->content = malloc(size);
+    if (r->content == NULL) {
+        free(r);
+        return ERR_OUT_OF_MEMORY;
+    }
+    memcpy(r->content, content, size);
+    memcpy(r->SHA, SHA, SHA256_DIGEST_LENGTH);
+    r->width = width;
+    r->height = height;
+    r->size = size;
+
+    pthread_mutex_lock(&cache->lock);
+    // Created meanwhile by someone else: replaced
+    struct rendition* existing = *find(cache, SHA, width, height);
+    if (existing != NULL) evict(cache, existing);
+    while (cache->used + size > cache->capacity) evict(cache, cache->oldest);
+
+    struct rendition** link = find(cache, SHA, width, height);
+    *link = r;
+    push_newest(cache, r);
+    cache->used += size;
+    pthread_mutex_unlock(&cache->lock);
+    return ERR_NONE;
+}
+
+size_t rendition_cache_used(struct rendition_cache* cache)
+{
+    if (cache == NULL) return 0;
+
+    pthread_mutex_lock(&cache->lock);
+    const size_t used = cache->used;
+    pthread_mutex_unlock(&cache->lock);
+    return used;
+}
+
+/*******************************************************************
+ * What to serve, under the lock of the imgFS
+ */
+static int locate_locked(struct imgfs_file* imgfs_file, const char* img_id,
+                         uint32_t width, uint32_t height, int* resolution, unsigned char* SHA)
+{
+    const int index = name_index_find(imgfs_file, img_id);
+    if (index == -1) return ERR_IMAGE_NOT_FOUND;
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+
+    *resolution = -1;
+    for (int res = 0; res < ORIG_RES; ++res) {
+        if (imgfs_file->header.resized_res[2*res] == width
+            && imgfs_file->header.resized_res[(2*res) + 1] == height) {
+            *resolution = res;
+        }
+    }
+    // Never upscaled
+    if (image->orig_res[0] <= width && image->orig_res[1] <= height) *resolution = ORIG_RES;
+
+    memcpy(SHA, image->SHA, SHA256_DIGEST_LENGTH);
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Where the best source to resize from is, under the lock of the imgFS
+ */
+static int find_source(const struct imgfs_file* imgfs_file, const char* img_id, const unsigned char* SHA,
+                       uint32_t width, uint32_t height, uint64_t* source_offset, uint32_t* source_size)
+{
+    const int index = name_index_find(imgfs_file, img_id);
+    if (index == -1) return ERR_IMAGE_NOT_FOUND;
+    const struct img_metadata* image = &imgfs_file->metadata[index];
+    // Replaced meanwhile
+    if (memcmp(image->SHA, SHA, SHA256_DIGEST_LENGTH) != 0) return ERR_IMAGE_NOT_FOUND;
+
+    const int source_res = rendition_source(&imgfs_file->header, image, width, height);
+    *source_offset = image->offset[source_res];
+    *source_size = image->size[source_res];
+    return ERR_NONE;
+}
+
+int rendition_read(struct rendition_cache* cache, struct imgfs_file* imgfs_file, pthread_mutex_t* lock,
+                   const char* img_id, uint32_t width, uint32_t height,
+                   int* resolution, void** content, size_t* size)
+{
+    M_REQUIRE_NON_NULL(cache);
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(lock);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(resolution);
+    M_REQUIRE_NON_NULL(content);
+    M_REQUIRE_NON_NULL(size);
+    if (width == 0 || height == 0) return ERR_RESOLUTIONS;
+
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    pthread_mutex_lock(lock);
+    int err = locate_locked(imgfs_file, img_id, width, height, resolution, SHA);
+    pthread_mutex_unlock(lock);
+    if (err != ERR_NONE || *resolution != -1) return err;
+
+    if (rendition_cache_get(cache, SHA, width, height, content, size) == ERR_NONE) {
+        return ERR_NONE;
+    }
+
+    uint64_t source_offset = 0;
+    uint32_t source_size = 0;
+    pthread_mutex_lock(lock);
+    err = find_source(imgfs_file, img_id, SHA, width, height, &source_offset, &source_size);
+    const uint32_t max_files = imgfs_file->header.max_files;
+    pthread_mutex_unlock(lock);
+    if (err != ERR_NONE) return err;
+
+    // Streamed from the file without the lock
+    void* resized = NULL;
+    size_t resized_size = 0;
+    err = resize_stored_content(imgfs_file, source_offset, source_size, width, height, CODEC_JPEG,
+                                &resized, &resized_size);
+
+    // Grown meanwhile: the source may have been moved while read, so start again
+    pthread_mutex_lock(lock);
+    const int grown = imgfs_file->header.max_files != max_files;
+    pthread_mutex_unlock(lock);
+    if (grown) {
+        g_free(resized);
+        return rendition_read(cache, imgfs_file, lock, img_id, width, height, resolution, content, size);
+    }
+    if (err != ERR_NONE) return err;
+
+    // A copy for the caller, allocated like the cached ones
+    *content = malloc(resized_size);
+    if (*content == NULL) {
+        g_free(resized);
+        return ERR_OUT_OF_MEMORY;
+    }
+    memcpy(*content, resized, resized_size);
+    *size = resized_size;
+    // Served even if it cannot be cached
+    rendition_cache_put(cache, SHA, width, height, resized, resized_size);
+    g_free(resized);
+    return ERR_NONE;
+}
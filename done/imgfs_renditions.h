@@ -0,0 +1,105 @@
+/**
+ * @file imgfs_renditions.h
+ * @brief Images resized on demand to any size, kept in a bounded cache.
+ *
+ * Unlike the variants of the header resolutions, renditions are never
+ * written to the imgFS file: they live in memory, within a maximum total
+ * size, the least recently used ones being evicted first. They are keyed
+ * by content (SHA) and size, so that images with the same content share
+ * them.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#pragma once
+
+#include "imgfs.h" // for struct imgfs_file, SHA256_DIGEST_LENGTH
+
+#include <pthread.h> // for pthread_mutex_t
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rendition_cache;
+
+/**
+ * @brief Creates an empty cache.
+ *
+ * @param cache Where to put the new cache
+ * @param capacity The maximum total size of the cached renditions, in bytes
+ * @return Some error code. 0 if no error.
+ */
+int rendition_cache_create(struct rendition_cache** cache, size_t capacity);
+
+/**
+ * @brief Frees the cache and all its renditions.
+ *
+ * @param cache The cache (may be NULL)
+ */
+void rendition_cache_free(struct rendition_cache* cache);
+
+/**
+ * @brief Looks a rendition up, making it the most recently used.
+ *
+ * @param cache The cache
+ * @param SHA The SHA of the original content
+ * @param width The width of the rendition box
+ * @param height The height of the rendition box
+ * @param content Where to put a copy of the rendition; to be freed by the caller
+ * @param size Where to put the size of the rendition
+ * @return Some error code: ERR_IMAGE_NOT_FOUND if not cached. 0 if no error.
+ */
+int rendition_cache_get(struct rendition_cache* cache, const unsigned char* SHA,
+                        uint32_t width, uint32_t height, void** content, size_t* size);
+
+/**
+ * @brief Adds (a copy of) a rendition, evicting the least recently used
+ *        ones to make room. A rendition larger than the whole cache is not kept.
+ *
+ * @param cache The cache
+ * @param SHA The SHA of the original content
+ * @param width The width of the rendition box
+ * @param height The height of the rendition box
+ * @param content The rendition
+ * @param size The size of the rendition
+ * @return Some error code. 0 if no error.
+ */
+int rendition_cache_put(struct rendition_cache* cache, const unsigned char* SHA,
+                        uint32_t width, uint32_t height, const void* content, size_t size);
+
+/**
+ * @brief The total size of the cached renditions.
+ *
+ * @param cache The cache
+ * @return The size in bytes (0 for NULL).
+ */
+size_t rendition_cache_used(struct rendition_cache* cache);
+
+/**
+ * @brief Finds how to serve an image fitting in width x height: either a
+ *        stored resolution (the variant of exactly that box, or the original
+ *        when it already fits), or a rendition from the cache, created if needed.
+ *        Must be called without holding the lock; only holds it to read
+ *        the metadata and the source content, not while resizing.
+ *
+ * @param cache The cache
+ * @param imgfs_file The main in-memory structure
+ * @param lock The lock protecting imgfs_file
+ * @param img_id The ID of the image
+ * @param width The width of the box to fit the image in
+ * @param height The height of the box to fit the image in
+ * @param resolution Where to put the stored resolution to serve, or -1 for a rendition
+ * @param content Where to put the rendition, if any; to be freed by the caller
+ * @param size Where to put the size of the rendition, if any
+ * @return Some error code. 0 if no error.
+ */
+int rendition_read(struct rendition_cache* cache, struct imgfs_file* imgfs_file, pthread_mutex_t* lock,
+                   const char* img_id, uint32_t width, uint32_t height,
+                   int* resolution, void** content, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
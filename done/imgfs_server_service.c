@@ -9,10 +9,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h> // uint16_t
+#include <inttypes.h> // PRIu64
 #include <pthread.h>
+#include <time.h> // clock_gettime
 #include "error.h"
-#include "util.h" // atouint16
+#include "util.h" // atouint16, atouint32
 #include "imgfs.h"
+#include "imgfs_batch.h"
+#include "imgfs_index.h" // name_index_find
+#include "imgfs_variants.h"
+#include "imgfs_renditions.h"
+#include "imgfs_codecs.h"
+#include "http_prot.h" // http_accepts
 #include "http_net.h"
 #include "imgfs_server_service.h"
 
@@ -20,13 +28,118 @@
 static struct imgfs_file fs_file;
 static uint16_t server_port = DEFAULT_LISTENING_PORT;
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// Creates the resized variants, according to their policies
+static struct variant_pool* variant_pool = NULL;
+// Images resized to the sizes requested, not stored in the file
+static struct rendition_cache* rendition_cache = NULL;
+// Uploads being written to the file, and replies being read from it,
+// without the lock: do_grow() moves contents, so it waits for them
+static size_t uploads = 0;
+static size_t readers = 0;
+static pthread_cond_t no_file_user = PTHREAD_COND_INITIALIZER;
+// Grows waiting for them: no new ones meanwhile, or a grow could wait forever
+static size_t grows_waiting = 0;
+static pthread_cond_t no_grow_waiting = PTHREAD_COND_INITIALIZER;
+// Flushes the batched metadata writes of an idle server
+static pthread_t flusher;
+static int flusher_started = 0;
+static int flusher_stopping = 0;
+static pthread_cond_t flusher_stop = PTHREAD_COND_INITIALIZER;
 
 #define URI_ROOT "/imgfs"
 #define DEFAULT_LISTENING_PORT 8000
+// With batched metadata writes, longest time between two flushes
+#define BATCH_INTERVAL_MS 1000
+#define DEFAULT_VARIANT_WORKERS 2
+// Maximum total size of the cached renditions, in KiB
+#define DEFAULT_RENDITION_CACHE_KIB (16 * 1024)
+
+/*************************
+ * Flusher thread: every half interval, writes the batched changes that
+ * wait for too long, so that they do not depend on a next write; the
+ * pages of a mapped file are synced to disk without the lock
+ ******************** */
+static void* flush_periodically(void* arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&mutex);
+    while (!flusher_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (BATCH_INTERVAL_MS / 2 % 1000) * 1000000L;
+        deadline.tv_sec += BATCH_INTERVAL_MS / 2 / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&flusher_stop, &mutex, &deadline);
+        if (flusher_stopping) break;
+
+        struct imgfs_batch_sync to_sync;
+        int err = imgfs_batch_collect(&fs_file, &to_sync);
+        if (err == ERR_NONE && to_sync.size > 0) {
+            // Synced without the lock, counted as a reader so that
+            // do_grow() does not remap the file meanwhile
+            ++readers;
+            pthread_mutex_unlock(&mutex);
+            err = imgfs_batch_sync(&to_sync);
+            pthread_mutex_lock(&mutex);
+            if (--readers == 0) pthread_cond_broadcast(&no_file_user);
+        }
+        if (err != ERR_NONE) {
+            fprintf(stderr, "Failed to flush the batched writes\n");
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/***********************//*
+ * Options: -thumb <policy>, -small <policy>, -workers <n>, -cache <KiB>,
+ * -threads <n> and -queue <n> (HTTP workers and their queue);
+ * the other arguments are returned in positional (count in *nb_positional)
+ ******************** */
+static int parse_options(int argc, char **argv, enum variant_policy policies[NB_RES],
+                         size_t* nb_workers, size_t* cache_kib, size_t* http_workers, size_t* http_queue,
+                         char** positional, int* nb_positional)
+{
+    *nb_positional = 0;
+    for (int i = 2; i < argc; ++i) {
+        if (argv[i][0] != '-') {
+            positional[(*nb_positional)++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "-workers") == 0) {
+            *nb_workers = atouint16(value);
+            if (*nb_workers == 0) return ERR_INVALID_ARGUMENT;
+            continue;
+        }
+        if (strcmp(argv[i - 1], "-threads") == 0 || strcmp(argv[i - 1], "-queue") == 0) {
+            size_t* size = strcmp(argv[i - 1], "-threads") == 0 ? http_workers : http_queue;
+            *size = atouint16(value);
+            if (*size == 0) return ERR_INVALID_ARGUMENT;
+            continue;
+        }
+        if (strcmp(argv[i - 1], "-cache") == 0) {
+            *cache_kib = atouint32(value);
+            if (*cache_kib == 0) return ERR_INVALID_ARGUMENT;
+            continue;
+        }
+        const int resolution = strcmp(argv[i - 1], "-thumb") == 0 ? THUMB_RES
+                               : strcmp(argv[i - 1], "-small") == 0 ? SMALL_RES : -1;
+        const int policy = variant_policy_atoi(value);
+        if (resolution == -1 || policy == -1) return ERR_INVALID_ARGUMENT;
+        policies[resolution] = (enum variant_policy) policy;
+    }
+    return ERR_NONE;
+}
 
 /***********************//*
  * Startup function. Create imgFS file and load in-memory structure.
  * Pass the imgFS file name as argv[1] and optionally port number as argv[2]
+ * and the number of metadata updates to batch together as argv[3].
+ * The variant policies, number of workers, size of the rendition
+ * cache and size of the HTTP worker pool are given as options.
  ******************** */
 int server_startup(int argc, char **argv)
 {
@@ -36,15 +149,26 @@ int server_startup(int argc, char **argv)
         return ERR_RUNTIME;
     }
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <imgFS_filename> [port]\n", argv[0]);
+    enum variant_policy policies[NB_RES] = { VARIANT_LAZY, VARIANT_LAZY, VARIANT_LAZY };
+    size_t nb_workers = DEFAULT_VARIANT_WORKERS;
+    size_t cache_kib = DEFAULT_RENDITION_CACHE_KIB;
+    size_t http_workers = DEFAULT_HTTP_WORKERS;
+    size_t http_queue = DEFAULT_HTTP_QUEUE;
+    char* positional[argc > 2 ? argc - 2 : 1];
+    int nb_positional = 0;
+    if (argc < 2 || parse_options(argc, argv, policies, &nb_workers, &cache_kib, &http_workers, &http_queue,
+                                  positional, &nb_positional) != ERR_NONE) {
+        fprintf(stderr, "Usage: %s <imgFS_filename> [port [batch_size]]"
+                " [-thumb|-small lazy|eager|never]... [-workers n] [-cache KiB]"
+                " [-threads n] [-queue n]\n", argv[0]);
         return ERR_NOT_ENOUGH_ARGUMENTS;
     }
     if (pthread_mutex_lock(&mutex) != ERR_NONE) {
         perror("pthread_mutex_lock");
         return ERR_RUNTIME;
     }
-    if (do_open(argv[1], "rb+", &fs_file) != ERR_NONE) {
+    // Mapped, so that a large metadata array is not read upfront
+    if (do_open_mmap(argv[1], "rb+", &fs_file) != ERR_NONE) {
         fprintf(stderr, "Failed to open ImgFS file: %s\n", argv[1]);
         return ERR_IO;
     }
@@ -54,15 +178,52 @@ int server_startup(int argc, char **argv)
     }
     print_header(&fs_file.header);
 
-    if (argc > 2) {
-        server_port = atouint16(argv[2]);
+    if (nb_positional > 0) {
+        server_port = atouint16(positional[0]);
         if (server_port == 0) server_port = DEFAULT_LISTENING_PORT;
     }
 
+    // Group the metadata writes of many inserts/deletes (flushed at shutdown too)
+    if (nb_positional > 1) {
+        const uint32_t batch_size = atouint32(positional[1]);
+        if (batch_size > 1 && imgfs_batch_begin(&fs_file, batch_size, BATCH_INTERVAL_MS) != ERR_NONE) {
+            fprintf(stderr, "Failed to enable batched writes\n");
+            do_close(&fs_file);
+            return ERR_RUNTIME;
+        }
+    }
+
+    if (variant_pool_start(&variant_pool, &fs_file, &mutex, policies, nb_workers) != ERR_NONE) {
+        fprintf(stderr, "Failed to start the variant workers\n");
+        do_close(&fs_file);
+        return ERR_THREADING;
+    }
+
+    if (rendition_cache_create(&rendition_cache, cache_kib * 1024) != ERR_NONE) {
+        fprintf(stderr, "Failed to create the rendition cache\n");
+        variant_pool_stop(variant_pool);
+        do_close(&fs_file);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    if (fs_file.batch != NULL) {
+        if (pthread_create(&flusher, NULL, flush_periodically, NULL) != 0) {
+            fprintf(stderr, "Failed to start the flusher thread\n");
+            rendition_cache_free(rendition_cache);
+            variant_pool_stop(variant_pool);
+            do_close(&fs_file);
+            return ERR_THREADING;
+        }
+        flusher_started = 1;
+    }
+
     if (http_init(server_port, handle_http_message) < 0) {
         fprintf(stderr, "HTTP initialization failed on port %u\n", server_port);
         return ERR_IO;
     }
+    http_set_workers(http_workers, http_queue);
+    // Uploads are not buffered, but written as they are received
+    http_stream_uri(URI_ROOT "/insert");
 
     printf("ImgFS server started on http://localhost:%u\n", server_port);
     return ERR_NONE;
@@ -74,6 +235,18 @@ int server_startup(int argc, char **argv)
 void server_shutdown (void)
 {
     fprintf(stderr, "Shutting down...\n");
+    variant_pool_stop(variant_pool);
+    variant_pool = NULL;
+    rendition_cache_free(rendition_cache);
+    rendition_cache = NULL;
+    if (flusher_started) {
+        pthread_mutex_lock(&mutex);
+        flusher_stopping = 1;
+        pthread_cond_signal(&flusher_stop);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(flusher, NULL);
+        flusher_started = 0;
+    }
     pthread_mutex_lock(&mutex);
     do_close(&fs_file);
     pthread_mutex_unlock(&mutex);
@@ -110,6 +283,70 @@ static int reply_302_msg(int connection)
     return http_reply(connection, "302 Found", location, "", 0);
 }
 
+/************************
+ * Counts an upload or a reply using the file without the lock
+ ******************** */
+static void file_user_enter(size_t* users)
+{
+    pthread_mutex_lock(&mutex);
+    while (grows_waiting > 0) pthread_cond_wait(&no_grow_waiting, &mutex);
+    ++*users;
+    pthread_mutex_unlock(&mutex);
+}
+
+static void file_user_leave(size_t* users)
+{
+    pthread_mutex_lock(&mutex);
+    if (--*users == 0) pthread_cond_broadcast(&no_file_user);
+    pthread_mutex_unlock(&mutex);
+}
+
+/************************
+ * Handling grow calls
+ ******************** */
+static int handle_grow_call(struct http_message *msg, int sockfd)
+{
+    char max_files_str[11] = {0}; // any uint32_t
+
+    if (http_get_var(&msg->uri, "max_files", max_files_str, sizeof(max_files_str)) <= 0) {
+        return reply_error_msg(sockfd, ERR_NOT_ENOUGH_ARGUMENTS);
+    }
+    const uint32_t max_files = atouint32(max_files_str);
+    if (max_files == 0) return reply_error_msg(sockfd, ERR_MAX_FILES);
+
+    // The metadata array is replaced, and contents moved: nobody else may
+    // use them meanwhile, not even the uploads and the replies being sent
+    pthread_mutex_lock(&mutex);
+    ++grows_waiting;
+    while (uploads > 0 || readers > 0) pthread_cond_wait(&no_file_user, &mutex);
+    const int ret = do_grow(&fs_file, max_files);
+    if (--grows_waiting == 0) pthread_cond_broadcast(&no_grow_waiting);
+    pthread_mutex_unlock(&mutex);
+    if (ret != ERR_NONE) return reply_error_msg(sockfd, ret);
+
+    return reply_302_msg(sockfd);
+}
+
+/************************
+ * Handling stats calls: the HTTP worker pool, to size it
+ ******************** */
+static int handle_stats_call(int sockfd)
+{
+    struct http_stats stats;
+    http_get_stats(&stats);
+
+    char json[512];
+    const int len = snprintf(json, sizeof(json),
+                             "{\"workers\": %zu, \"queue_capacity\": %zu, \"queue_depth\": %zu, "
+                             "\"max_queue_depth\": %zu, \"dispatched\": %" PRIu64 ", \"rejected\": %" PRIu64 ", "
+                             "\"mean_wait_ms\": %.3f, \"max_wait_ms\": %.3f}",
+                             stats.nb_workers, stats.queue_capacity, stats.queue_depth, stats.max_queue_depth,
+                             stats.dispatched, stats.rejected, stats.mean_wait_ms, stats.max_wait_ms);
+    if (len < 0 || (size_t) len >= sizeof(json)) return reply_error_msg(sockfd, ERR_RUNTIME);
+
+    return http_reply(sockfd, HTTP_OK, "Content-Type: application/json\r\n", json, (size_t) len);
+}
+
 /************************
  * Simple handling of http message. UPDATED IN WEEK 13
  ******************** */
@@ -133,6 +370,12 @@ int handle_http_message(struct http_message* msg, int sockfd)
     if(   http_match_uri(msg, URI_ROOT "/delete")) {
         return handle_delete_call(msg,sockfd);
     }
+    if (http_match_uri(msg, URI_ROOT "/grow") && http_match_verb(&msg->method, "POST")) {
+        return handle_grow_call(msg, sockfd);
+    }
+    if (http_match_uri(msg, URI_ROOT "/stats")) {
+        return handle_stats_call(sockfd);
+    }
     return reply_error_msg(sockfd, ERR_INVALID_COMMAND);
 }
 
@@ -147,7 +390,9 @@ int handle_list_call(int connection)
     char* json;
 
     // List using the do_list function
+    pthread_mutex_lock(&mutex);
     int error = do_list(&fs_file, output_mode, &json);
+    pthread_mutex_unlock(&mutex);
     if (error != ERR_NONE) return reply_error_msg(connection, error);
 
 
@@ -173,7 +418,9 @@ int handle_delete_call(struct http_message *msg, int sockfd)
     }
 
     // Perform the delete operation
+    pthread_mutex_lock(&mutex);
     int ret = do_delete(img_id, &fs_file);
+    pthread_mutex_unlock(&mutex);
     if (ret != ERR_NONE) {
         // If there is an error during deletion, reply with the error message
         return reply_error_msg(sockfd, ret);
@@ -184,13 +431,68 @@ int handle_delete_call(struct http_message *msg, int sockfd)
 }
 
 /************************
- * Handling read calls
+ * Sends a stored resolution of an image, in the codec preferred
+ * for the resized ones (JPEG when the other one cannot be served)
+ ******************** */
+static int reply_stored(int sockfd, const char* img_id, int resolution, enum image_codec codec)
+{
+    // Variants never created: the original instead
+    resolution = variant_pool_resolution(variant_pool, resolution);
+
+    // Find the image in the imgFS file (resizing it if needed)
+    uint64_t image_offset = 0;
+    uint32_t image_size = 0;
+    if (codec != CODEC_JPEG && resolution != ORIG_RES
+        && codec_locate(&fs_file, &mutex, img_id, resolution, &image_offset, &image_size) == ERR_NONE) {
+        return http_reply_file(sockfd, HTTP_OK, "Content-Type: image/webp\r\nVary: Accept\r\n",
+                               fileno(fs_file.file), image_offset, image_size);
+    }
+    // (single creation of a missing variant, even for concurrent requests)
+    int error = variant_pool_locate(variant_pool, img_id, resolution, &image_offset, &image_size);
+
+    if (error != ERR_NONE) return reply_error_msg(sockfd, error);
+
+
+    // Send the response, the image going straight from the file to the socket
+    return http_reply_file(sockfd, HTTP_OK, resolution == ORIG_RES ? "Content-Type: image/jpeg\r\n"
+                           : "Content-Type: image/jpeg\r\nVary: Accept\r\n",
+                           fileno(fs_file.file), image_offset, image_size);
+}
+
+/************************
+ * Sends an image fitting in width x height
+ ******************** */
+static int reply_rendition(int sockfd, const char* img_id, uint32_t width, uint32_t height,
+                           enum image_codec codec)
+{
+    int resolution = -1;
+    void* content = NULL;
+    size_t size = 0;
+    const int err = rendition_read(rendition_cache, &fs_file, &mutex, img_id, width, height,
+                                   &resolution, &content, &size);
+    if (err != ERR_NONE) return reply_error_msg(sockfd, err);
+
+    // Stored already: served like the other resolutions
+    if (resolution != -1) return reply_stored(sockfd, img_id, resolution, codec);
+
+    const int ret = http_reply(sockfd, HTTP_OK, "Content-Type: image/jpeg\r\n", content, size);
+    free(content);
+    return ret;
+}
+
+/************************
+ * Handling read calls: either res=<resolution>,
+ * or width=<w>&height=<h> for any size
  ******************** */
 int handle_read_call(struct http_message *msg, int sockfd)
 {
     char img_id[MAX_IMG_ID + 1] = {0};
     char res[6] = {0};
+    char width[6] = {0}; // any uint16_t
+    char height[6] = {0};
     int err;
+    // WebP for the resized resolutions, to the clients asking for it
+    const enum image_codec codec = http_accepts(msg, "image/webp") == 1 ? CODEC_WEBP : CODEC_JPEG;
 
     // Get the img_id parameter from the URI
     if ((err = http_get_var(&msg->uri, "img_id", img_id, MAX_IMG_ID)) <= 0) {
@@ -199,6 +501,17 @@ int handle_read_call(struct http_message *msg, int sockfd)
 
     // Get the res parameter from the URI
     if ((err = http_get_var(&msg->uri, "res", res, sizeof(res))) <= 0) {
+        if (err == 0 && http_get_var(&msg->uri, "width", width, sizeof(width)) > 0
+            && http_get_var(&msg->uri, "height", height, sizeof(height)) > 0) {
+            const uint16_t w = atouint16(width);
+            const uint16_t h = atouint16(height);
+            if (w == 0 || h == 0) return reply_error_msg(sockfd, ERR_RESOLUTIONS);
+            // Counted from before the image is located until it is sent
+            file_user_enter(&readers);
+            const int ret = reply_rendition(sockfd, img_id, w, h, codec);
+            file_user_leave(&readers);
+            return ret;
+        }
         if (err == 0) {
             return reply_error_msg(sockfd, ERR_NOT_ENOUGH_ARGUMENTS);
         }
@@ -209,21 +522,24 @@ int handle_read_call(struct http_message *msg, int sockfd)
     int resolution = resolution_atoi(res);
     if (resolution == -1) return reply_error_msg(sockfd, ERR_RESOLUTIONS);
 
+    file_user_enter(&readers);
+    const int ret = reply_stored(sockfd, img_id, resolution, codec);
+    file_user_leave(&readers);
+    return ret;
+}
 
-    // Prepare to read the image
-    char *image_buffer = NULL;
-    uint32_t image_size = 0;
-    int error = do_read(img_id, resolution, &image_buffer, &image_size, &fs_file);
-
-    if (error != ERR_NONE) return reply_error_msg(sockfd, error);
-
-
-    // Send the response with the image
-    int result = http_reply(sockfd, HTTP_OK, "Content-Type: image/jpeg\r\n", image_buffer, image_size);
-
-    free(image_buffer);
-    return result;
+/************************
+ * The body of an insert call, read as it is streamed to the file
+ ******************** */
+struct body_source {
+    struct http_message* msg;
+    int sockfd;
+};
 
+static int read_body(void* arg, void* buffer, size_t size, size_t* read)
+{
+    struct body_source* source = arg;
+    return http_read_body(source->msg, source->sockfd, buffer, size, read);
 }
 
 // Function to handle insert calls
@@ -235,22 +551,41 @@ int handle_insert_call(struct http_message *msg, int sockfd)
     int err = http_get_var(&msg->uri, "name", img_id, MAX_IMG_ID);
 
     // Check if the body is empty or the name parameter is not provided
-    if (msg->body.len == 0 || err <= 0)  return reply_error_msg(sockfd, ERR_NOT_ENOUGH_ARGUMENTS);
-
-
-    // Allocate memory for the image buffer
-    char *image_buffer = calloc(1, msg->body.len);
-    if (image_buffer == NULL) return reply_error_msg(sockfd, ERR_OUT_OF_MEMORY);
+    const size_t image_size = msg->body.len + msg->body_pending;
+    if (image_size == 0 || err <= 0)  return reply_error_msg(sockfd, ERR_NOT_ENOUGH_ARGUMENTS);
 
+    // Counted before its space is reserved: do_grow() could move it
+    file_user_enter(&uploads);
+    uint64_t offset = 0;
+    pthread_mutex_lock(&mutex);
+    int ret = do_insert_reserve(&fs_file, img_id, image_size, &offset);
+    pthread_mutex_unlock(&mutex);
 
-    // Copy the image data to the buffer
-    memcpy(image_buffer, msg->body.val, msg->body.len);
+    // Streamed from the connection to the file, without the lock
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    uint32_t width = 0;
+    uint32_t height = 0;
+    if (ret == ERR_NONE) {
+        struct body_source source = { msg, sockfd };
+        ret = do_insert_stream(&fs_file, offset, image_size, read_body, &source, SHA, &width, &height);
+        pthread_mutex_lock(&mutex);
+        if (ret == ERR_NONE) {
+            ret = do_insert_commit(&fs_file, img_id, SHA, image_size, width, height, offset);
+        } else {
+            release_data(&fs_file, offset, image_size);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+    file_user_leave(&uploads);
 
-    // Perform the insert operation
-    int ret = do_insert(image_buffer, msg->body.len, img_id, &fs_file);
-    free(image_buffer);
+    pthread_mutex_lock(&mutex);
+    const int index = ret == ERR_NONE ? name_index_find(&fs_file, img_id) : -1;
+    pthread_mutex_unlock(&mutex);
 
     if (ret != ERR_NONE) return reply_error_msg(sockfd, ret);
 
+    // Eager variants are created in the background
+    if (index != -1) variant_pool_submit(variant_pool, (uint32_t) index);
+
     return reply_302_msg(sockfd);
 }
\ No newline at end of file
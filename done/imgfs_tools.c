@@ -6,13 +6,21 @@
  */
 
 #include "imgfs.h"
+#include "imgfs_batch.h"
+#include "imgfs_codecs.h"
+#include "imgfs_index.h"
 #include "util.h"
 
+#include <errno.h>         // for errno, EINTR
+#include <fcntl.h>         // for fcntl
 #include <inttypes.h>      // for PRIxN macros
 #include <openssl/sha.h>   // for SHA256_DIGEST_LENGTH
 #include <stdio.h>         // for sprintf
 #include <stdlib.h>        // for calloc
-#include <string.h>        // for strcmp
+#include <string.h>        // for strcmp, memcpy
+#include <sys/mman.h>      // for mmap, munmap
+#include <sys/stat.h>      // for fstat
+#include <unistd.h>        // for pread, pwrite, ftruncate
 
 /*******************************************************************
  * Human-readable SHA
@@ -66,6 +74,43 @@ ORIGINAL: %" PRIu32 " x %" PRIu32 "\n",
     printf("*****************************************\n");
 }
 
+/*******************************************************************
+ * Common part of do_open() and do_open_mmap()
+ */
+static void reset_file(struct imgfs_file* imgfs_file)
+{
+    imgfs_file->file = NULL;
+    imgfs_file->metadata = NULL;
+    imgfs_file->hot = NULL;
+    imgfs_file->name_index = NULL;
+    imgfs_file->content_index = NULL;
+    imgfs_file->empty_slots = NULL;
+    imgfs_file->mapping = NULL;
+    imgfs_file->mapping_size = 0;
+    imgfs_file->batch = NULL;
+    imgfs_file->codecs = NULL;
+}
+
+static int build_indexes(struct imgfs_file* imgfs_file)
+{
+    // Index the image IDs, contents and empty slots
+    int err = name_index_build(imgfs_file);
+    if (err == ERR_NONE) err = content_index_build(imgfs_file);
+    if (err == ERR_NONE) err = empty_slots_build(imgfs_file);
+    // and read the WebP variants, if any
+    if (err == ERR_NONE) err = codec_variants_load(imgfs_file);
+    if (err != ERR_NONE) {
+        do_close(imgfs_file);
+    }
+    return err;
+}
+
+static int is_read_only(FILE* file)
+{
+    const int flags = fcntl(fileno(file), F_GETFL);
+    return flags == -1 || (flags & O_ACCMODE) == O_RDONLY;
+}
+
 /**
  * @brief Open imgFS file, read the header and all the metadata.
  *
@@ -82,32 +127,227 @@ int do_open(const char* imgfs_filename,
     M_REQUIRE_NON_NULL(open_mode);
     M_REQUIRE_NON_NULL(imgfs_file);
 
+    reset_file(imgfs_file);
+
     // Open file in specified open_mode
     imgfs_file->file=fopen(imgfs_filename,open_mode);
     if (imgfs_file->file ==NULL) return ERR_IO;
 
     // Read the contents of the header
-    if (fread(&(imgfs_file->header), sizeof(struct imgfs_header), 1, imgfs_file->file) != 1) {
+    if (read_at(imgfs_file, &(imgfs_file->header), sizeof(struct imgfs_header), 0) != ERR_NONE) {
         do_close(imgfs_file);
         return ERR_IO;
     }
     // Allocate memory in metadata array
     imgfs_file->metadata = calloc(imgfs_file->header.max_files, sizeof(struct img_metadata));
-    if (imgfs_file->metadata == NULL) {
+    if (imgfs_file->header.unused_32 == IMGFS_FORMAT_V2) {
+        imgfs_file->hot = calloc(imgfs_file->header.max_files, sizeof(struct img_metadata_hot));
+    }
+    if (imgfs_file->metadata == NULL
+        || (imgfs_file->header.unused_32 == IMGFS_FORMAT_V2 && imgfs_file->hot == NULL)) {
         do_close(imgfs_file);
         return ERR_OUT_OF_MEMORY;
     }
 
-    // Read the contents of the metadata
-    size_t read = fread(imgfs_file->metadata, sizeof(struct img_metadata), imgfs_file->header.max_files, imgfs_file->file);
-    if (read != imgfs_file->header.max_files) {
+    // Read the contents of the metadata (in either format)
+    int err = read_metadata_range(imgfs_file, 0, imgfs_file->header.max_files);
+    if (err != ERR_NONE) {
         do_close(imgfs_file);
-        return ERR_IO;
+        return err;
     }
 
     // All good
+    return build_indexes(imgfs_file);
+
+}
+
+/*******************************************************************
+ * Open with the header and metadata region mapped in memory
+ */
+int do_open_mmap(const char* imgfs_filename,
+                 const char* open_mode,
+                 struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_filename);
+    M_REQUIRE_NON_NULL(open_mode);
+    M_REQUIRE_NON_NULL(imgfs_file);
+
+    reset_file(imgfs_file);
+
+    imgfs_file->file = fopen(imgfs_filename, open_mode);
+    if (imgfs_file->file == NULL) return ERR_IO;
+
+    // The header tells how large the metadata region is
+    if (read_at(imgfs_file, &imgfs_file->header, sizeof(struct imgfs_header), 0) != ERR_NONE) {
+        do_close(imgfs_file);
+        return ERR_IO;
+    }
+    // The split metadata of format v2 cannot be used in place: read it
+    if (imgfs_file->header.unused_32 != IMGFS_FORMAT_V1) {
+        do_close(imgfs_file);
+        return do_open(imgfs_filename, open_mode, imgfs_file);
+    }
+    const size_t size = sizeof(struct imgfs_header)
+                        + (size_t) imgfs_file->header.max_files * sizeof(struct img_metadata);
+
+    // Touching a page past the end of the file would raise SIGBUS: check first
+    const int fd = fileno(imgfs_file->file);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 0 || (uint64_t) st.st_size < size) {
+        do_close(imgfs_file);
+        return ERR_IO;
+    }
+
+    // Read-only files get a private (copy-on-write) mapping, so that
+    // in-memory changes behave as with do_open() and never reach the disk
+    void* mapping = is_read_only(imgfs_file->file)
+                    ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+                    : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        do_close(imgfs_file);
+        return ERR_IO;
+    }
+    imgfs_file->mapping = mapping;
+    imgfs_file->mapping_size = size;
+    imgfs_file->metadata = (struct img_metadata*) ((char*) mapping + sizeof(struct imgfs_header));
+
+    return build_indexes(imgfs_file);
+}
+
+/*******************************************************************
+ * Positional I/O on the imgFS file descriptor: no shared file cursor,
+ * so that several readers can work on the same imgfs_file at once
+ */
+int read_at(const struct imgfs_file* imgfs_file, void* buffer, size_t size, uint64_t offset)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(buffer);
+
+    const int fd = fileno(imgfs_file->file);
+    char* cursor = buffer;
+    while (size > 0) {
+        const ssize_t got = pread(fd, cursor, size, (off_t) offset);
+        if (got < 0 && errno == EINTR) continue;
+        // Short file (got == 0) is an error as well
+        if (got <= 0) return ERR_IO;
+        cursor += got;
+        size -= (size_t) got;
+        offset += (uint64_t) got;
+    }
     return ERR_NONE;
+}
 
+int write_at(struct imgfs_file* imgfs_file, const void* buffer, size_t size, uint64_t offset)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(buffer);
+
+    const int fd = fileno(imgfs_file->file);
+    const char* cursor = buffer;
+    while (size > 0) {
+        const ssize_t put = pwrite(fd, cursor, size, (off_t) offset);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return ERR_IO;
+        cursor += put;
+        size -= (size_t) put;
+        offset += (uint64_t) put;
+    }
+    return ERR_NONE;
+}
+
+int append_data(struct imgfs_file* imgfs_file, const void* buffer, size_t size, uint64_t* offset)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(buffer);
+    M_REQUIRE_NON_NULL(offset);
+
+    // The current end of file is where the data goes
+    struct stat st;
+    if (fstat(fileno(imgfs_file->file), &st) != 0 || st.st_size < 0) return ERR_IO;
+
+    const int err = write_at(imgfs_file, buffer, size, (uint64_t) st.st_size);
+    if (err != ERR_NONE) return err;
+
+    *offset = (uint64_t) st.st_size;
+    return ERR_NONE;
+}
+
+int reserve_data(struct imgfs_file* imgfs_file, size_t size, uint64_t* offset)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(offset);
+
+    // Extended right away, so that the next end of file is after them
+    struct stat st;
+    const int fd = fileno(imgfs_file->file);
+    if (fstat(fd, &st) != 0 || st.st_size < 0) return ERR_IO;
+    if (ftruncate(fd, st.st_size + (off_t) size) != 0) return ERR_IO;
+
+    *offset = (uint64_t) st.st_size;
+    return ERR_NONE;
+}
+
+void release_data(struct imgfs_file* imgfs_file, uint64_t offset, size_t size)
+{
+    if (imgfs_file == NULL || imgfs_file->file == NULL) return;
+
+    struct stat st;
+    const int fd = fileno(imgfs_file->file);
+    if (fstat(fd, &st) == 0 && (uint64_t) st.st_size == offset + size) {
+        if (ftruncate(fd, (off_t) offset) != 0) perror("ftruncate() in release_data()");
+    }
+}
+
+/*******************************************************************
+ * Persistence of the header and of one metadata entry
+ */
+int write_header(struct imgfs_file* imgfs_file)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+
+    if (imgfs_file->batch != NULL) return imgfs_batch_stage_header(imgfs_file);
+
+    if (imgfs_file->mapping != NULL) {
+        if (is_read_only(imgfs_file->file)) return ERR_IO;
+        memcpy(imgfs_file->mapping, &imgfs_file->header, sizeof(struct imgfs_header));
+        return ERR_NONE;
+    }
+
+    return write_at(imgfs_file, &imgfs_file->header, sizeof(struct imgfs_header), 0);
+}
+
+static int write_entry(struct imgfs_file* imgfs_file, uint32_t index, int hot_only)
+{
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(imgfs_file->file);
+    M_REQUIRE_NON_NULL(imgfs_file->metadata);
+    if (index >= imgfs_file->header.max_files) return ERR_INVALID_ARGUMENT;
+
+    // The scans see the change at once, even if the write is batched
+    refresh_hot(imgfs_file, index, 1);
+    if (imgfs_file->batch != NULL) return imgfs_batch_stage_metadata(imgfs_file, index, hot_only);
+
+    // The metadata array is the mapping itself: nothing to copy
+    if (imgfs_file->mapping != NULL) {
+        return is_read_only(imgfs_file->file) ? ERR_IO : ERR_NONE;
+    }
+
+    return write_metadata_range(imgfs_file, index, 1, hot_only);
+}
+
+int write_metadata(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    return write_entry(imgfs_file, index, 0);
+}
+
+int write_metadata_hot(struct imgfs_file* imgfs_file, uint32_t index)
+{
+    return write_entry(imgfs_file, index, 1);
 }
 
 /**
@@ -118,16 +358,33 @@ int do_open(const char* imgfs_filename,
 void do_close(struct imgfs_file* imgfs_file)
 {
     if (imgfs_file!=NULL ) {
+        // Write what is still pending, while the file is open
+        if (imgfs_file->batch != NULL) {
+            if (imgfs_batch_end(imgfs_file) != ERR_NONE) {
+                fprintf(stderr, "do_close(): failed to write pending metadata\n");
+            }
+        }
         // Close the file and make the file pointer point to NULL
         if (imgfs_file->file !=NULL) {
             fclose(imgfs_file->file);
             imgfs_file->file= NULL;
         }
-        // Free space allocated for metadata and make the metadata pointer point to NULL
-        if (imgfs_file->metadata !=NULL) {
+        // Unmap or free the metadata and make the metadata pointer point to NULL
+        if (imgfs_file->mapping != NULL) {
+            munmap(imgfs_file->mapping, imgfs_file->mapping_size);
+            imgfs_file->mapping = NULL;
+            imgfs_file->mapping_size = 0;
+            imgfs_file->metadata = NULL;
+        } else if (imgfs_file->metadata !=NULL) {
             free(imgfs_file->metadata);
             imgfs_file->metadata= NULL;
         }
+        free(imgfs_file->hot);
+        imgfs_file->hot = NULL;
+        name_index_free(imgfs_file);
+        content_index_free(imgfs_file);
+        empty_slots_free(imgfs_file);
+        codec_variants_free(imgfs_file);
 
     }
 
@@ -0,0 +1,352 @@
+/**
+ * @file imgfs_variants.c
+ * @brief implementation of the background generation of variants
+ *
+ * Inserted images wait in a bounded ring buffer of metadata indexes. A
+ * worker takes one, copies what it needs from the imgFS under the lock,
+ * creates all its eager variants without holding it, then
+ * takes the lock again to store them, provided the slot still holds the
+ * same image.
+ *
+ * Readers missing a variant create it the same way (see
+ * variant_pool_locate()). Whoever creates variants records them as in
+ * flight, so that concurrent requests for the same variants wait for
+ * that single creation instead of resizing, and appending, once more.
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "imgfs_variants.h"
+#include "image_content.h" // for resize_source(), resize_stored(), store_variants(), share_variants()
+#include "imgfs_index.h"   // for name_index_find()
+
+#include <stdio.h>      // for fprintf
+#include <stdlib.h>     // for calloc, free
+#include <string.h>     // for strcmp, memcpy, memcmp
+#include <vips/vips.h>  // for g_free
+
+// Inserted images waiting for their variants
+#define QUEUE_SIZE 1024u
+
+/*******************************************************************
+ * Variants being created of a content: one per creator, on its stack
+ */
+struct in_flight {
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    unsigned resolutions;
+    struct in_flight* next;
+};
+
+struct variant_pool {
+    struct imgfs_file* imgfs_file;
+    pthread_mutex_t* lock;            // protects imgfs_file, in_flight
+    struct in_flight* in_flight;      // variants being created
+    pthread_cond_t created;           // signaled (with lock) when some are done
+    enum variant_policy policies[NB_RES];
+    unsigned eager;                   // RES_BIT() of the eager resolutions
+
+    pthread_mutex_t queue_lock;       // protects what follows
+    pthread_cond_t not_empty;
+    pthread_cond_t idle;
+    uint32_t queue[QUEUE_SIZE];
+    size_t head;                      // next index to take
+    size_t count;
+    size_t busy;                      // workers creating variants
+    int stopping;
+
+    pthread_t* workers;
+    size_t nb_workers;
+};
+
+static const char* const policy_names[NB_VARIANT_POLICIES] = { "lazy", "eager", "never" };
+
+/*******************************************************************
+ * Policy names
+ */
+int variant_policy_atoi(const char* policy)
+{
+    if (policy == NULL) return -1;
+    for (int p = 0; p < NB_VARIANT_POLICIES; ++p) {
+        if (strcmp(policy, policy_names[p]) == 0) return p;
+    }
+    return -1;
+}
+
+static unsigned resolutions_in_flight(const struct variant_pool* pool, const unsigned char* SHA)
+{
+    unsigned resolutions = 0;
+    for (const struct in_flight* f = pool->in_flight; f != NULL; f = f->next) {
+        if (memcmp(f->SHA, SHA, SHA256_DIGEST_LENGTH) == 0) resolutions |= f->resolutions;
+    }
+    return resolutions;
+}
+
+static void remove_in_flight(struct variant_pool* pool, const struct in_flight* done)
+{
+    struct in_flight** link = &pool->in_flight;
+    while (*link != done) link = &(*link)->next;
+    *link = done->next;
+}
+
+/*******************************************************************
+ * Creates the wanted variants of an image, from a single pass over the
+ * source, streamed from the file. Called and returns with the lock held,
+ * but releases it while resizing. Variants
+ * already being created by someone else, for that image or another one
+ * with the same content, are waited for, not redone.
+ */
+static int create_variants(struct variant_pool* pool, uint32_t index, unsigned wanted)
+{
+    struct imgfs_file* imgfs_file = pool->imgfs_file;
+
+    unsigned resolutions = 0;
+    for (;;) {
+        // Deleted (the caller checks again)
+        if (index >= imgfs_file->header.max_files || imgfs_file->metadata[index].is_valid != NON_EMPTY) {
+            return ERR_NONE;
+        }
+        // Maybe created for the same content meanwhile
+        const int err = share_variants(imgfs_file, index);
+        if (err != ERR_NONE) return err;
+
+        resolutions = wanted;
+        for (int res = 0; res < ORIG_RES; ++res) {
+            if (imgfs_file->metadata[index].size[res] != 0) resolutions &= ~RES_BIT(res);
+        }
+        if (resolutions == 0) return ERR_NONE;
+        if ((resolutions & resolutions_in_flight(pool, imgfs_file->metadata[index].SHA)) == 0) break;
+
+        pthread_cond_wait(&pool->created, pool->lock);
+    }
+
+    struct in_flight self;
+    memcpy(self.SHA, imgfs_file->metadata[index].SHA, SHA256_DIGEST_LENGTH);
+    self.resolutions = resolutions;
+    self.next = pool->in_flight;
+    pool->in_flight = &self;
+
+    const struct imgfs_header header = imgfs_file->header;
+    const unsigned char* SHA = self.SHA;
+    const int source_res = resize_source(&header, &imgfs_file->metadata[index], resolutions);
+    const uint64_t source_offset = imgfs_file->metadata[index].offset[source_res];
+    const uint32_t source_size = imgfs_file->metadata[index].size[source_res];
+
+    // Streamed from the file without the lock
+    void* resized[NB_RES] = { NULL };
+    size_t resized_size[NB_RES] = { 0 };
+    pthread_mutex_unlock(pool->lock);
+    int err = resize_stored(imgfs_file, &header, resolutions, source_res, source_offset, source_size,
+                            resized, resized_size);
+    pthread_mutex_lock(pool->lock);
+
+    // Grown meanwhile: the source may have been moved while read, so start again
+    if (imgfs_file->header.max_files != header.max_files) {
+        for (int res = 0; res < NB_RES; ++res) {
+            g_free(resized[res]);
+        }
+        remove_in_flight(pool, &self);
+        pthread_cond_broadcast(&pool->created);
+        return create_variants(pool, index, wanted);
+    }
+
+    // Same image still there: store the variants it still lacks
+    if (err == ERR_NONE
+        && index < imgfs_file->header.max_files
+        && imgfs_file->metadata[index].is_valid == NON_EMPTY
+        && memcmp(imgfs_file->metadata[index].SHA, SHA, SHA256_DIGEST_LENGTH) == 0) {
+        for (int res = 0; res < ORIG_RES; ++res) {
+            if (resized[res] != NULL && imgfs_file->metadata[index].size[res] != 0) {
+                g_free(resized[res]);
+                resized[res] = NULL;
+            }
+        }
+        err = store_variants(imgfs_file, index, resized, resized_size);
+    }
+
+    remove_in_flight(pool, &self);
+    pthread_cond_broadcast(&pool->created);
+
+    for (int res = 0; res < NB_RES; ++res) {
+        g_free(resized[res]);
+    }
+    return err;
+}
+
+/*******************************************************************
+ * Where to read an image from, creating the variant if needed
+ */
+int variant_pool_locate(struct variant_pool* pool, const char* img_id, int resolution,
+                        uint64_t* offset, uint32_t* size)
+{
+    M_REQUIRE_NON_NULL(pool);
+    M_REQUIRE_NON_NULL(img_id);
+    M_REQUIRE_NON_NULL(offset);
+    M_REQUIRE_NON_NULL(size);
+    if (resolution < THUMB_RES || resolution > ORIG_RES) return ERR_RESOLUTIONS;
+
+    struct imgfs_file* imgfs_file = pool->imgfs_file;
+    pthread_mutex_lock(pool->lock);
+
+    int index = name_index_find(imgfs_file, img_id);
+    int err = ERR_NONE;
+    if (index != -1 && imgfs_file->metadata[index].size[resolution] == 0 && resolution != ORIG_RES) {
+        err = create_variants(pool, (uint32_t) index, RES_BIT(resolution));
+        // The lock was released meanwhile
+        index = name_index_find(imgfs_file, img_id);
+        if (err == ERR_NONE && index != -1 && imgfs_file->metadata[index].size[resolution] == 0) {
+            err = ERR_IMGLIB;
+        }
+    }
+    if (err == ERR_NONE && index == -1) err = ERR_IMAGE_NOT_FOUND;
+    if (err == ERR_NONE) {
+        *offset = imgfs_file->metadata[index].offset[resolution];
+        *size = imgfs_file->metadata[index].size[resolution];
+    }
+
+    pthread_mutex_unlock(pool->lock);
+    return err;
+}
+
+/*******************************************************************
+ * Worker threads
+ */
+static void* worker(void* arg)
+{
+    struct variant_pool* pool = arg;
+
+    pthread_mutex_lock(&pool->queue_lock);
+    for (;;) {
+        while (!pool->stopping && pool->count == 0) {
+            pthread_cond_wait(&pool->not_empty, &pool->queue_lock);
+        }
+        if (pool->stopping) break;
+
+        const uint32_t index = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % QUEUE_SIZE;
+        --pool->count;
+        ++pool->busy;
+        pthread_mutex_unlock(&pool->queue_lock);
+
+        pthread_mutex_lock(pool->lock);
+        const int err = create_variants(pool, index, pool->eager);
+        pthread_mutex_unlock(pool->lock);
+        if (err != ERR_NONE) {
+            fprintf(stderr, "Variants of image in slot %u: %s\n", index, ERR_MSG(err));
+        }
+
+        pthread_mutex_lock(&pool->queue_lock);
+        --pool->busy;
+        if (pool->count == 0 && pool->busy == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->queue_lock);
+    return NULL;
+}
+
+/*******************************************************************
+ * Start and stop
+ */
+int variant_pool_start(struct variant_pool** pool, struct imgfs_file* imgfs_file,
+                       pthread_mutex_t* lock, const enum variant_policy policies[NB_RES],
+                       size_t nb_workers)
+{
+    M_REQUIRE_NON_NULL(pool);
+    M_REQUIRE_NON_NULL(imgfs_file);
+    M_REQUIRE_NON_NULL(lock);
+    M_REQUIRE_NON_NULL(policies);
+    if (nb_workers == 0) return ERR_INVALID_ARGUMENT;
+
+    struct variant_pool* p = calloc(1, sizeof(struct variant_pool));
+    if (p == NULL) return ERR_OUT_OF_MEMORY;
+    p->workers = calloc(nb_workers, sizeof(pthread_t));
+    if (p->workers == NULL) {
+        free(p);
+        return ERR_OUT_OF_MEMORY;
+    }
+    p->imgfs_file = imgfs_file;
+    p->lock = lock;
+    memcpy(p->policies, policies, sizeof(p->policies));
+    p->policies[ORIG_RES] = VARIANT_LAZY;
+    for (int res = 0; res < ORIG_RES; ++res) {
+        if (p->policies[res] == VARIANT_EAGER) p->eager |= RES_BIT(res);
+    }
+    pthread_cond_init(&p->created, NULL);
+    pthread_mutex_init(&p->queue_lock, NULL);
+    pthread_cond_init(&p->not_empty, NULL);
+    pthread_cond_init(&p->idle, NULL);
+
+    for (; p->nb_workers < nb_workers; ++p->nb_workers) {
+        if (pthread_create(&p->workers[p->nb_workers], NULL, worker, p) != 0) {
+            variant_pool_stop(p);
+            return ERR_THREADING;
+        }
+    }
+
+    *pool = p;
+    return ERR_NONE;
+}
+
+void variant_pool_stop(struct variant_pool* pool)
+{
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->queue_lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->queue_lock);
+
+    for (size_t i = 0; i < pool->nb_workers; ++i) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->created);
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->queue_lock);
+    free(pool->workers);
+    free(pool);
+}
+
+/*******************************************************************
+ * Queueing
+ */
+int variant_pool_submit(struct variant_pool* pool, uint32_t index)
+{
+    M_REQUIRE_NON_NULL(pool);
+
+    // Nothing to do in the background
+    if (pool->eager == 0) {
+        return ERR_NONE;
+    }
+
+    pthread_mutex_lock(&pool->queue_lock);
+    if (pool->count < QUEUE_SIZE) {
+        pool->queue[(pool->head + pool->count) % QUEUE_SIZE] = index;
+        ++pool->count;
+        pthread_cond_signal(&pool->not_empty);
+    }
+    pthread_mutex_unlock(&pool->queue_lock);
+    return ERR_NONE;
+}
+
+void variant_pool_wait(struct variant_pool* pool)
+{
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->queue_lock);
+    while (pool->count > 0 || pool->busy > 0) {
+        pthread_cond_wait(&pool->idle, &pool->queue_lock);
+    }
+    pthread_mutex_unlock(&pool->queue_lock);
+}
+
+/*******************************************************************
+ * What is served
+ */
+int variant_pool_resolution(const struct variant_pool* pool, int resolution)
+{
+    if (pool == NULL || resolution < 0 || resolution >= NB_RES) return resolution;
+    return pool->policies[resolution] == VARIANT_NEVER ? ORIG_RES : resolution;
+}
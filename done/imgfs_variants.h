@@ -0,0 +1,117 @@
+/**
+ * @file imgfs_variants.h
+ * @brief Background generation of the resized variants of the images.
+ *
+ * Each resized resolution has a policy: lazy variants are created when
+ * first read (see lazily_resize()), eager ones by a pool of worker
+ * threads as soon as the image is inserted, and never-created ones are
+ * replaced by the original image.
+ *
+ * The workers share the imgFS structure with the caller, through the
+ * given lock: it is only held to read the original content and to store
+ * the variants, not while resizing. Callers must hold it as well whenever
+ * they use the imgFS structure while the pool runs, and should read
+ * images through variant_pool_locate().
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#pragma once
+
+#include "imgfs.h" // for struct imgfs_file, NB_RES
+
+#include <pthread.h> // for pthread_mutex_t
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum variant_policy {
+    VARIANT_LAZY,
+    VARIANT_EAGER,
+    VARIANT_NEVER,
+    NB_VARIANT_POLICIES
+};
+
+struct variant_pool;
+
+/**
+ * @brief Transforms a policy string to its value.
+ *
+ * @param policy The policy string. Shall be "lazy", "eager" or "never".
+ * @return The corresponding value or -1 if error.
+ */
+int variant_policy_atoi(const char* policy);
+
+/**
+ * @brief Starts the worker threads.
+ *
+ * @param pool Where to put the new pool
+ * @param imgfs_file The main in-memory structure, shared with the workers
+ * @param lock The lock protecting imgfs_file
+ * @param policies The policy of each resolution (the one of ORIG_RES is ignored)
+ * @param nb_workers The number of worker threads (at least 1)
+ * @return Some error code. 0 if no error.
+ */
+int variant_pool_start(struct variant_pool** pool, struct imgfs_file* imgfs_file,
+                       pthread_mutex_t* lock, const enum variant_policy policies[NB_RES],
+                       size_t nb_workers);
+
+/**
+ * @brief Queues the creation of the eager variants of an image.
+ *        When the queue is full, the request is dropped: the variants will
+ *        then be created on first read, as lazy ones.
+ *        Must be called without holding the lock.
+ *
+ * @param pool The pool
+ * @param index The index of the image in the metadata array
+ * @return Some error code. 0 if no error.
+ */
+int variant_pool_submit(struct variant_pool* pool, uint32_t index);
+
+/**
+ * @brief Waits until all queued variants are created.
+ *        Must be called without holding the lock.
+ *
+ * @param pool The pool
+ */
+void variant_pool_wait(struct variant_pool* pool);
+
+/**
+ * @brief Stops the workers, dropping the variants still queued, and frees the pool.
+ *        Must be called without holding the lock, before closing the imgFS.
+ *
+ * @param pool The pool (may be NULL)
+ */
+void variant_pool_stop(struct variant_pool* pool);
+
+/**
+ * @brief Like do_locate(), for callers sharing the imgFS with the pool:
+ *        a missing variant is created without holding the lock, and a
+ *        single time even when requested by several threads at once
+ *        (the others wait for it). Must be called without holding the lock.
+ *
+ * @param pool The pool
+ * @param img_id The ID of the image to be located.
+ * @param resolution The desired resolution for the image.
+ * @param offset Location of the offset of the image content in the file
+ * @param size Location of the image size variable
+ * @return Some error code. 0 if no error.
+ */
+int variant_pool_locate(struct variant_pool* pool, const char* img_id, int resolution,
+                        uint64_t* offset, uint32_t* size);
+
+/**
+ * @brief The resolution actually served for a requested one.
+ *
+ * @param pool The pool (may be NULL: all policies are then lazy)
+ * @param resolution The requested resolution
+ * @return ORIG_RES for a resolution that is never created, resolution otherwise.
+ */
+int variant_pool_resolution(const struct variant_pool* pool, int resolution);
+
+#ifdef __cplusplus
+}
+#endif
@@ -30,7 +30,9 @@ struct command_mapping commands[] = {
     {"help", help},
     {"delete", do_delete_cmd},
     {"insert", do_insert_cmd},
-    {"read",do_read_cmd}
+    {"read",do_read_cmd},
+    {"gc", do_gbcollect_cmd},
+    {"grow", do_grow_cmd}
 };
 
 // Constant of the number of commands in the commands array
@@ -15,6 +15,7 @@
 #define MAX_FILES_OPTION "-max_files"
 #define THUMB_RES_OPTION "-thumb_res"
 #define SMALL_RES_OPTION "-small_res"
+#define FORMAT_OPTION    "-format"
 
 // default values
 static const uint32_t default_max_files = 128;
@@ -45,11 +46,16 @@ int help(int useless _unused, char** useless_too _unused)
     printf("          %s <X_RES> <Y_RES>: resolution for small images.\n", SMALL_RES_OPTION);
     printf("                                  default value is %dx%d\n", default_small_res, default_small_res);
     printf("                                  maximum value is %dx%d\n", MAX_SMALL_RES, MAX_SMALL_RES);
+    printf("          %s <1|2>: on-disk format; 2 stores the frequently used metadata apart.\n", FORMAT_OPTION);
+    printf("                                  default value is 1\n");
     printf("  read <imgFS_filename> <imgID> [original|orig|thumbnail|thumb|small]:\n");
     printf("      read an image from the imgFS and save it to a file.\n");
     printf("      default resolution is \"original\".\n");
     printf("  insert <imgFS_filename> <imgID> <filename>: insert a new image in the imgFS.\n");
     printf("  delete <imgFS_filename> <imgID>: delete image imgID from imgFS.\n");
+    printf("  gc <imgFS_filename> <tmp imgFS_filename>: performs garbage collecting on imgFS.\n");
+    printf("      Requires a temporary filename for copying the imgFS.\n");
+    printf("  grow <imgFS_filename> <MAX_FILES>: increases the maximum number of files of the imgFS.\n");
     return ERR_NONE;
 }
 
@@ -139,6 +145,17 @@ int do_create_cmd(int argc, char** argv)
             }
             // Advance index of next argv to be read, so it can read string specifying next field to be set
             i += 2;
+        } // Check whether argument matches -format
+        else if (strcmp(argv[i], FORMAT_OPTION) == 0) {
+            if (i + 1 >= argc) {
+                return ERR_NOT_ENOUGH_ARGUMENTS;
+            }
+            const uint32_t format = atouint32(argv[i + 1]);
+            if (format != 1 && format != 2) {
+                return ERR_INVALID_ARGUMENT;
+            }
+            file.header.unused_32 = (format == 2) ? IMGFS_FORMAT_V2 : IMGFS_FORMAT_V1;
+            i++;
         } else {
             return ERR_INVALID_ARGUMENT;
         }
@@ -193,6 +210,41 @@ int do_delete_cmd(int argc, char** argv)
     return ERR_NONE;
 }
 
+/**********************************************************************
+ * Compacts the imgFS (garbage collection).
+ */
+int do_gbcollect_cmd(int argc, char** argv)
+{
+    M_REQUIRE_NON_NULL(argv);
+
+    // The imgFS and a temporary file to build the compacted copy in
+    if (argc < 2) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+    return do_gbcollect(argv[0], argv[1]);
+}
+
+/**********************************************************************
+ * Opens imgFS file and calls do_grow().
+ ********************************************************************** */
+int do_grow_cmd(int argc, char** argv)
+{
+    M_REQUIRE_NON_NULL(argv);
+
+    // The imgFS and its new maximum number of files
+    if (argc < 2) return ERR_NOT_ENOUGH_ARGUMENTS;
+
+    const uint32_t max_files = atouint32(argv[1]);
+    if (max_files == 0) return ERR_MAX_FILES;
+
+    struct imgfs_file imgfs_file;
+    int err = do_open(argv[0], "rb+", &imgfs_file);
+    if (err != ERR_NONE) return err;
+
+    err = do_grow(&imgfs_file, max_files);
+    do_close(&imgfs_file);
+    return err;
+}
+
 /**********************************************************************
  *  Create the name of the file to use to save the read image
  */
@@ -36,3 +36,13 @@ int do_insert_cmd(int argc, char* argv[]);
  * Reads an image from the imgFS.
  *******************************************************************/
 int do_read_cmd(int argc, char* argv[]);
+
+/********************************************************************
+ * Compacts the imgFS (garbage collection).
+ *******************************************************************/
+int do_gbcollect_cmd(int argc, char* argv[]);
+
+/********************************************************************
+ * Increases the maximum number of files of the imgFS.
+ *******************************************************************/
+int do_grow_cmd(int argc, char* argv[]);
@@ -0,0 +1,153 @@
+/**
+ * @file parser-bench.c
+ * @brief Compares the cost of parsing a message received in segments of
+ *        a few sizes, per capture: parsed again from its start after each
+ *        segment (http_parse_message()), or resumed (http_parser_feed()).
+ *
+ * The captures are turned into upload requests: their first line is
+ * replaced by a request line, their header and body are kept.
+ *
+ * Usage: parser-bench <iterations> <captured messages...>
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "http_prot.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REQUEST_LINE "POST /imgfs/insert?&name=bench HTTP/1.1"
+
+/*******************************************************************
+ * Monotonic time, in microseconds
+ */
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+/*******************************************************************
+ * Reads a capture as a request; the content is to be freed by the caller
+ */
+static int load_request(const char* path, char** request, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return ERR_IO;
+
+    int err = ERR_IO;
+    char* content = NULL;
+    long end = -1;
+    if (fseek(file, 0, SEEK_END) == 0 && (end = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        content = calloc((size_t) end + 1, 1);
+        if (content == NULL) {
+            err = ERR_OUT_OF_MEMORY;
+        } else if (fread(content, 1, (size_t) end, file) == (size_t) end) {
+            err = ERR_NONE;
+        }
+    }
+    fclose(file);
+
+    const char* first_line_end = content != NULL ? strstr(content, HTTP_LINE_DELIM) : NULL;
+    if (err == ERR_NONE && first_line_end == NULL) err = ERR_INVALID_ARGUMENT;
+    if (err == ERR_NONE) {
+        const size_t rest = (size_t) end - (size_t) (first_line_end - content);
+        *size = strlen(REQUEST_LINE) + rest;
+        *request = calloc(*size + 1, 1);
+        if (*request == NULL) {
+            err = ERR_OUT_OF_MEMORY;
+        } else {
+            memcpy(*request, REQUEST_LINE, strlen(REQUEST_LINE));
+            memcpy(*request + strlen(REQUEST_LINE), first_line_end, rest);
+        }
+    }
+    free(content);
+    return err;
+}
+
+/*******************************************************************
+ * Mean time, in microseconds, of receiving the request in segments of
+ * segment bytes, and parsing it after each of them
+ */
+static int time_parse(const char* request, size_t size, size_t segment, int resumed, int iterations,
+                      char* stream, double* latency)
+{
+    double total = 0;
+    for (int i = 0; i < iterations; ++i) {
+        // Not filled yet: zeroes, as read by the server
+        memset(stream, 0, size + 1);
+        struct http_parser parser;
+        struct http_message message;
+        int content_len = 0;
+        int ret = 0;
+        size_t received = 0;
+
+        const double start = now_us();
+        http_parser_init(&parser);
+        while (ret == 0 && received < size) {
+            const size_t len = size - received < segment ? size - received : segment;
+            memcpy(stream + received, request + received, len);
+            received += len;
+            ret = resumed ? http_parser_feed(&parser, stream, received, &message)
+                  : http_parse_message(stream, received, &message, &content_len);
+        }
+        total += now_us() - start;
+
+        if (ret != 1 || received != size) return ERR_INVALID_ARGUMENT;
+    }
+    *latency = total / iterations;
+    return ERR_NONE;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <iterations> <captured messages...>\n", argv[0]);
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+    const int iterations = atoi(argv[1]);
+    if (iterations <= 0) return ERR_INVALID_ARGUMENT;
+
+    // One byte at a time, small writes, one Ethernet frame at a time
+    static const size_t segments[] = { 1, 64, 1460 };
+    printf("%-32s %8s %8s %12s %12s %8s\n", "capture", "bytes", "segment", "reparse(us)", "resumed(us)",
+           "speedup");
+
+    int err = ERR_NONE;
+    for (int i = 2; i < argc && err == ERR_NONE; ++i) {
+        char* request = NULL;
+        size_t size = 0;
+        err = load_request(argv[i], &request, &size);
+        char* stream = err == ERR_NONE ? malloc(size + 1) : NULL;
+        if (err == ERR_NONE && stream == NULL) err = ERR_OUT_OF_MEMORY;
+        if (err != ERR_NONE) {
+            fprintf(stderr, "%s: %s\n", argv[i], ERR_MSG(err));
+            free(request);
+            break;
+        }
+
+        const char* name = strrchr(argv[i], '/') != NULL ? strrchr(argv[i], '/') + 1 : argv[i];
+        for (size_t s = 0; s < sizeof(segments) / sizeof(segments[0]) && err == ERR_NONE; ++s) {
+            double reparse = 0, resumed = 0;
+            err = time_parse(request, size, segments[s], 0, iterations, stream, &reparse);
+            if (err == ERR_NONE) {
+                err = time_parse(request, size, segments[s], 1, iterations, stream, &resumed);
+            }
+            if (err != ERR_NONE) {
+                fprintf(stderr, "%s: %s\n", argv[i], ERR_MSG(err));
+                break;
+            }
+            printf("%-32s %8zu %8zu %12.1f %12.1f %7.1fx\n", name, size, segments[s], reparse, resumed,
+                   resumed > 0 ? reparse / resumed : 0.0);
+        }
+        free(stream);
+        free(request);
+    }
+
+    return err;
+}
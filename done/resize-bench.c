@@ -0,0 +1,141 @@
+/**
+ * @file resize-bench.c
+ * @brief Compares the latency of creating resized variants, per image and
+ *        per resolution, with the former path (full-size decode, then
+ *        resize) and the current one (resize_contents(), shrink-on-load).
+ *
+ * Usage: resize-bench <iterations> <JPEG files...>
+ *
+ * @author Marta Adarve de Leon & Imane Oujja
+ */
+
+#include "imgfs.h"
+#include "image_content.h"
+#include "bench.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vips/vips.h>
+
+#define DEFAULT_THUMB_RES 64
+#define DEFAULT_SMALL_RES 256
+
+/*******************************************************************
+ * The former path: full-size decode, then resize and encode
+ */
+static int resize_decoded(const struct imgfs_header* header, int res,
+                          void* original, size_t original_size, size_t* resized_size)
+{
+    VipsImage* original_image = NULL;
+    if (vips_jpegload_buffer(original, original_size, &original_image, NULL) != 0) {
+        return ERR_IMGLIB;
+    }
+
+    int err = ERR_NONE;
+    VipsImage* resized_image = NULL;
+    if (vips_thumbnail_image(original_image, &resized_image, header->resized_res[2*res], "height",
+                             header->resized_res[(2*res) + 1], NULL) != 0) {
+        err = ERR_IMGLIB;
+    } else {
+        void* resized = NULL;
+        if (vips_jpegsave_buffer(resized_image, &resized, resized_size, NULL) != 0) {
+            err = ERR_IMGLIB;
+        }
+        g_free(resized);
+        g_object_unref(resized_image);
+    }
+    g_object_unref(original_image);
+    return err;
+}
+
+/*******************************************************************
+ * The current path
+ */
+static int resize_shrunk(const struct imgfs_header* header, int res,
+                         void* original, size_t original_size, size_t* resized_size)
+{
+    void* resized[NB_RES];
+    size_t sizes[NB_RES];
+    const int err = resize_contents(header, RES_BIT(res), ORIG_RES, original, original_size,
+                                    resized, sizes);
+    if (err != ERR_NONE) return err;
+
+    *resized_size = sizes[res];
+    g_free(resized[res]);
+    return ERR_NONE;
+}
+
+/*******************************************************************
+ * Mean latency, in milliseconds, of one way of resizing
+ */
+static int time_resize(int (*resize)(const struct imgfs_header*, int, void*, size_t, size_t*),
+                       const struct imgfs_header* header, int res, void* original,
+                       size_t original_size, int iterations, double* latency, size_t* resized_size)
+{
+    // Once beforehand, so that both paths start warm
+    int err = resize(header, res, original, original_size, resized_size);
+
+    const double start = now_ms();
+    for (int i = 0; i < iterations && err == ERR_NONE; ++i) {
+        err = resize(header, res, original, original_size, resized_size);
+    }
+    *latency = (now_ms() - start) / iterations;
+    return err;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <iterations> <JPEG files...>\n", argv[0]);
+        return ERR_NOT_ENOUGH_ARGUMENTS;
+    }
+    const int iterations = atoi(argv[1]);
+    if (iterations <= 0) return ERR_INVALID_ARGUMENT;
+
+    if (VIPS_INIT(argv[0])) {
+        return ERR_IMGLIB;
+    }
+
+    struct imgfs_header header;
+    memset(&header, 0, sizeof(header));
+    header.resized_res[2 * THUMB_RES] = header.resized_res[2 * THUMB_RES + 1] = DEFAULT_THUMB_RES;
+    header.resized_res[2 * SMALL_RES] = header.resized_res[2 * SMALL_RES + 1] = DEFAULT_SMALL_RES;
+
+    static const char* const names[] = { "thumb", "small" };
+    printf("%-32s %-6s %12s %12s %8s\n", "image", "res", "decoded(ms)", "shrunk(ms)", "speedup");
+
+    int err = ERR_NONE;
+    for (int i = 2; i < argc && err == ERR_NONE; ++i) {
+        void* original = NULL;
+        size_t original_size = 0;
+        err = load_file(argv[i], &original, &original_size);
+        if (err != ERR_NONE) {
+            fprintf(stderr, "%s: %s\n", argv[i], ERR_MSG(err));
+            break;
+        }
+
+        const char* name = strrchr(argv[i], '/') != NULL ? strrchr(argv[i], '/') + 1 : argv[i];
+        for (int res = THUMB_RES; res < ORIG_RES && err == ERR_NONE; ++res) {
+            double decoded = 0, shrunk = 0;
+            size_t decoded_size = 0, shrunk_size = 0;
+            err = time_resize(resize_decoded, &header, res, original, original_size,
+                              iterations, &decoded, &decoded_size);
+            if (err == ERR_NONE) {
+                err = time_resize(resize_shrunk, &header, res, original, original_size,
+                                  iterations, &shrunk, &shrunk_size);
+            }
+            if (err != ERR_NONE) {
+                fprintf(stderr, "%s: %s\n", argv[i], ERR_MSG(err));
+                break;
+            }
+            printf("%-32s %-6s %12.3f %12.3f %7.2fx\n", name, names[res],
+                   decoded, shrunk, shrunk > 0 ? decoded / shrunk : 0.0);
+        }
+        free(original);
+    }
+
+    vips_shutdown();
+    return err;
+}
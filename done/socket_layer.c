@@ -1,9 +1,14 @@
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include "error.h"
+#include "socket_layer.h"
 #include <stdlib.h>
 /**
  * @brief initialize a network communication over TCP
@@ -48,9 +53,9 @@ int tcp_server_init(uint16_t port)
 }
 
 /**
- * @brief Blocking call that accepts a new TCP connection
+ * @brief Accepts a new TCP connection; blocking unless passive_socket is non-blocking
  * @param passive_socket the file descriptor of the socket that listens for new connections
- * @return the socket id of the new connection
+ * @return the socket id of the new connection, or -1 (errno EAGAIN if none is pending)
  */
 int tcp_accept(int passive_socket)
 {
@@ -58,7 +63,8 @@ int tcp_accept(int passive_socket)
 }
 
 /**
- * @brief Blocking call that reads the active socket once and stores the output in buf
+ * @brief Reads the active socket once and stores the output in buf;
+ *        blocking unless active_socket is non-blocking (then -1 with errno EAGAIN if nothing to read)
  * @param active_socket the file descriptor of the socket that is being read
  * @param buf the buffer where the data will be stored
  * @param buflen the size of the buffer
@@ -77,6 +83,47 @@ ssize_t tcp_read(int active_socket, char* buf, size_t buflen)
     return recv(active_socket, buf, buflen, 0);
 }
 
+/**
+ * @brief Makes a socket non-blocking
+ * @param socket the file descriptor of the socket
+ * @return some error code, 0 if no error
+ */
+int tcp_set_nonblocking(int socket)
+{
+    const int flags = fcntl(socket, F_GETFL);
+    if (flags == -1 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1) return ERR_IO;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Waits until a non-blocking socket has bytes to read (or is closed)
+ * @param active_socket the file descriptor of the socket
+ * @param timeout_ms how long to wait at most
+ * @return some error code, 0 if there is something to read
+ */
+int tcp_wait_readable(int active_socket, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = active_socket, .events = POLLIN };
+    int ret;
+    while ((ret = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR);
+    return ret == 1 && (pfd.revents & (POLLIN | POLLHUP)) != 0 ? ERR_NONE : ERR_IO;
+}
+
+/**
+ * @brief Waits until the socket can be written again, after EAGAIN
+ *        on a non-blocking socket, at most SEND_TIMEOUT_MS: a client
+ *        that stops reading does not hold the sending thread forever
+ * @return whether it can
+ */
+static int wait_writable(int active_socket)
+{
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return 0;
+    struct pollfd pfd = { .fd = active_socket, .events = POLLOUT };
+    int ret;
+    while ((ret = poll(&pfd, 1, SEND_TIMEOUT_MS)) == -1 && errno == EINTR);
+    return ret == 1 && (pfd.revents & POLLOUT) != 0;
+}
+
 /**
  * @brief Send a response message
  * @param active_socket the file descriptor of the socket that is sending the message
@@ -91,5 +138,31 @@ ssize_t tcp_send(int active_socket, const char* response, size_t response_len)
     if (response_len == 0 || active_socket < 0) {
         return ERR_INVALID_ARGUMENT;
     }
-    return send(active_socket, response, response_len, 0);
+    // Non-blocking sockets: wait for room in the send buffer
+    ssize_t sent;
+    while ((sent = send(active_socket, response, response_len, MSG_NOSIGNAL)) == -1
+           && wait_writable(active_socket));
+    return sent;
+}
+
+/**
+ * @brief Send part of a file
+ * @param active_socket the file descriptor of the socket that is sending the data
+ * @param in_fd the file descriptor of the file to be sent
+ * @param offset where to start in the file; advanced by the number of bytes sent
+ * @param count the number of bytes to be sent
+ * @return the number of bytes sent or -1 on error
+ */
+ssize_t tcp_sendfile(int active_socket, int in_fd, uint64_t* offset, size_t count)
+{
+    // Check validity of arguments
+    M_REQUIRE_NON_NULL(offset);
+    if (count == 0 || active_socket < 0 || in_fd < 0) {
+        return ERR_INVALID_ARGUMENT;
+    }
+    off_t position = (off_t) *offset;
+    ssize_t sent;
+    while ((sent = sendfile(active_socket, in_fd, &position, count)) == -1 && wait_writable(active_socket));
+    if (sent > 0) *offset = (uint64_t) position;
+    return sent;
 }
@@ -11,16 +11,43 @@
 #include <stdint.h> // uint16_t
 #include <sys/types.h> // ssize_t
 
+#define SEND_TIMEOUT_MS 10000 // longest wait for room in the send buffer of a non-blocking socket
+
 int tcp_server_init(uint16_t port);
 
 /**
- * @brief Blocking call that accepts a new TCP connection
+ * @brief Accepts a new TCP connection; blocking unless passive_socket is non-blocking
  */
 int tcp_accept(int passive_socket);
 
 /**
- * @brief Blocking call that reads the active socket once and stores the output in buf
+ * @brief Reads the active socket once and stores the output in buf;
+ *        blocking unless active_socket is non-blocking
  */
 ssize_t tcp_read(int active_socket, char* buf, size_t buflen);
 
+/**
+ * @brief Makes a socket non-blocking (for an event loop)
+ */
+int tcp_set_nonblocking(int socket);
+
+/**
+ * @brief Waits until a non-blocking socket has bytes to read, for at most timeout_ms
+ * @return some error code, 0 if it has
+ */
+int tcp_wait_readable(int active_socket, int timeout_ms);
+
+/**
+ * @brief Sends a response; on a non-blocking socket, waits whenever the send
+ *        buffer is full, at most SEND_TIMEOUT_MS each time
+ */
 ssize_t tcp_send(int active_socket, const char* response, size_t response_len);
+
+/**
+ * @brief Sends count bytes of the file in_fd, starting at *offset, without
+ *        copying them to user space. *offset is advanced by the bytes sent.
+ *        On a non-blocking socket, waits whenever the send buffer is full,
+ *        at most SEND_TIMEOUT_MS each time.
+ * @return the number of bytes sent or -1 on error
+ */
+ssize_t tcp_sendfile(int active_socket, int in_fd, uint64_t* offset, size_t count);
@@ -10,6 +10,7 @@
 
 #include <check.h>
 #include <stdlib.h>   // EXIT_FAILURE
+#include <sys/stat.h> // stat
 
 #ifndef ck_assert_mem_eq
 // exists since check 0.11.0
@@ -248,6 +249,13 @@ static void read_file_and_size(void **buffer, const char *filename, size_t* size
 
     fclose(file);
 }
+static long file_size(const char *filename)
+{
+    struct stat st;
+    ck_assert_int_eq(stat(filename, &st), 0);
+    return (long) st.st_size;
+}
+
 static size_t locate_sos(char *buffer, size_t size) {
     for (size_t i = 0; i < size - 1; ++i) {
         if (buffer[i] == (char)0xff && buffer[i+1] == (char)0xda) {
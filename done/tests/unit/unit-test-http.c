@@ -279,6 +279,214 @@ START_TEST(http_parse_message_full_headers_full_content)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(http_parse_message_pipelined)
+{
+    start_test_print;
+
+    const char *str =
+    "POST /imgfs/insert?&name=papillon.jpg HTTP/1.1" HTTP_LINE_DELIM "Content-Length: 12" HTTP_HDR_END_DELIM
+    "Hello world!"
+    "GET /imgfs/read?res=thumb&img_id=pic1 HTTP/1.1" HTTP_LINE_DELIM "Host: localhost:8000" HTTP_HDR_END_DELIM
+    "GET /imgfs/read?res=small";
+    struct http_message msg;
+    int content_len;
+
+    // The first one only, whatever follows it
+    ck_assert_int_eq(http_parse_message(str, strlen(str), &msg, &content_len), 1);
+    ck_assert_http_str_eq(msg.uri, "/imgfs/insert?&name=papillon.jpg");
+    ck_assert_int_eq(content_len, 12);
+    ck_assert_http_str_eq(msg.body, "Hello world!");
+
+    const char *next = msg.body.val + msg.body.len;
+    ck_assert_int_eq(http_parse_message(next, strlen(next), &msg, &content_len), 1);
+    ck_assert_http_str_eq(msg.uri, "/imgfs/read?res=thumb&img_id=pic1");
+    ck_assert_int_eq(content_len, 0);
+    ck_assert_int_eq(msg.num_headers, 1);
+
+    next = strstr(next, HTTP_HDR_END_DELIM) + strlen(HTTP_HDR_END_DELIM);
+    ck_assert_int_eq(http_parse_message(next, strlen(next), &msg, &content_len), 0);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_parser_body_start_pipelined)
+{
+    start_test_print;
+
+    const char *header = "POST /imgfs/insert?&name=papillon.jpg HTTP/1.1" HTTP_LINE_DELIM "Content-Length: 12"
+                         HTTP_HDR_END_DELIM;
+    const char *str =
+    "POST /imgfs/insert?&name=papillon.jpg HTTP/1.1" HTTP_LINE_DELIM "Content-Length: 12" HTTP_HDR_END_DELIM
+    "Hello world!"
+    "GET /imgfs/read?res=thumb&img_id=pic1 HTTP/1.1" HTTP_LINE_DELIM HTTP_LINE_DELIM;
+    struct http_parser parser;
+    struct http_message msg;
+
+    // Part of the body only: the rest is pending
+    const size_t partial = strlen(header) + 5;
+    http_parser_init(&parser);
+    ck_assert_int_eq(http_parser_feed(&parser, str, partial, &msg), 0);
+    ck_assert_uint_eq(parser.header_len, strlen(header));
+    http_parser_body_start(&parser, str, partial, &msg);
+    ck_assert_http_str_eq(msg.body, "Hello");
+    ck_assert_uint_eq(msg.body_pending, 7);
+
+    // Received with the next message: that one is left out
+    http_parser_init(&parser);
+    ck_assert_int_eq(http_parser_feed(&parser, str, strlen(str), &msg), 1);
+    http_parser_body_start(&parser, str, strlen(str), &msg);
+    ck_assert_http_str_eq(msg.body, "Hello world!");
+    ck_assert_uint_eq(msg.body_pending, 0);
+    ck_assert_int_eq(strncmp(msg.body.val + msg.body.len, "GET ", 4), 0);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_parser_null_params)
+{
+    start_test_print;
+
+    struct http_parser parser;
+    struct http_message msg;
+    const char *str = "GET / HTTP/1.1" HTTP_HDR_END_DELIM;
+
+    http_parser_init(NULL);
+    http_parser_init(&parser);
+    ck_assert_invalid_arg(http_parser_feed(NULL, str, strlen(str), &msg));
+    ck_assert_invalid_arg(http_parser_feed(&parser, NULL, 0, &msg));
+    ck_assert_invalid_arg(http_parser_feed(&parser, str, strlen(str), NULL));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_parser_byte_by_byte)
+{
+    start_test_print;
+
+    const char *str =
+    "POST /imgfs/insert?&name=papillon.jpg HTTP/1.1" HTTP_LINE_DELIM "Host: localhost:8000" HTTP_LINE_DELIM
+    "Content-Length: 12" HTTP_HDR_END_DELIM "Hello world!"
+    "GET /imgfs/list HTTP/1.1" HTTP_HDR_END_DELIM;
+    const size_t first_len = strlen(str) - strlen("GET /imgfs/list HTTP/1.1" HTTP_HDR_END_DELIM);
+    char stream[256] = { 0 };
+    struct http_parser parser;
+    struct http_message msg;
+
+    // As received by a slow client: the message is only complete with its last byte
+    http_parser_init(&parser);
+    size_t received = 0;
+    int ret = 0;
+    while (ret == 0 && received < strlen(str)) {
+        stream[received] = str[received];
+        ++received;
+        ret = http_parser_feed(&parser, stream, received, &msg);
+        ck_assert_int_eq(ret, received == first_len);
+    }
+    ck_assert_uint_eq(received, first_len);
+    ck_assert_uint_eq(parser.header_len + (size_t) parser.content_len, first_len);
+    ck_assert_int_eq(parser.content_len, 12);
+    ck_assert_http_str_eq(msg.method, "POST");
+    ck_assert_http_str_eq(msg.uri, "/imgfs/insert?&name=papillon.jpg");
+    ck_assert_int_eq(msg.num_headers, 2);
+    ck_assert_http_str_eq(msg.body, "Hello world!");
+
+    // The next one, already there
+    http_parser_init(&parser);
+    const char *next = str + first_len;
+    ck_assert_int_eq(http_parser_feed(&parser, next, strlen(next), &msg), 1);
+    ck_assert_http_str_eq(msg.uri, "/imgfs/list");
+    ck_assert_int_eq(parser.content_len, 0);
+    ck_assert_uint_eq(parser.header_len, strlen(next));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_parser_moved_stream)
+{
+    start_test_print;
+
+    const char *str =
+    "POST /imgfs/insert?&name=papillon.jpg HTTP/1.1" HTTP_LINE_DELIM "Content-Length: 12" HTTP_HDR_END_DELIM
+    "Hello world!";
+    char before[256] = { 0 };
+    char after[256] = { 0 };
+    struct http_parser parser;
+    struct http_message msg;
+
+    http_parser_init(&parser);
+    const size_t partial = strlen(str) - strlen("world!");
+    memcpy(before, str, partial);
+    ck_assert_int_eq(http_parser_feed(&parser, before, partial, &msg), 0);
+    ck_assert_int_eq(parser.content_len, 12);
+
+    // Moved to a larger buffer before the rest of the body is received
+    strcpy(after, str);
+    ck_assert_int_eq(http_parser_feed(&parser, after, strlen(after), &msg), 1);
+    ck_assert_ptr_eq(msg.uri.val, after + strlen("POST "));
+    ck_assert_http_str_eq(msg.uri, "/imgfs/insert?&name=papillon.jpg");
+    ck_assert_ptr_eq(msg.body.val, after + partial - strlen("Hello "));
+    ck_assert_http_str_eq(msg.body, "Hello world!");
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_accepts_null_params)
+{
+    start_test_print;
+
+    struct http_message msg;
+    memset(&msg, 0, sizeof(msg));
+
+    ck_assert_invalid_arg(http_accepts(NULL, "image/webp"));
+    ck_assert_invalid_arg(http_accepts(&msg, NULL));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(http_accepts_media_types)
+{
+    start_test_print;
+
+    const char *str =
+    "GET /imgfs/read?res=small&img_id=pic1 HTTP/1.1" HTTP_LINE_DELIM
+    "Accept: text/html, IMAGE/WebP;q=0.9, image/png;q=0, image/avif;q=0.000;level=1, */*;q=0.8" HTTP_LINE_DELIM
+    "accept: image/gif;q=0.5" HTTP_HDR_END_DELIM;
+    struct http_message msg;
+    int content_len;
+
+    ck_assert_int_eq(http_parse_message(str, strlen(str), &msg, &content_len), 1);
+
+    ck_assert_int_eq(http_accepts(&msg, "image/webp"), 1);
+    ck_assert_int_eq(http_accepts(&msg, "text/html"), 1);
+    ck_assert_int_eq(http_accepts(&msg, "image/gif"), 1);
+    // Refused, or only through a wildcard
+    ck_assert_int_eq(http_accepts(&msg, "image/png"), 0);
+    ck_assert_int_eq(http_accepts(&msg, "image/avif"), 0);
+    ck_assert_int_eq(http_accepts(&msg, "image/jpeg"), 0);
+    ck_assert_int_eq(http_accepts(&msg, "image/web"), 0);
+
+    // No Accept header at all
+    const char *none = "GET / HTTP/1.1" HTTP_LINE_DELIM "Host: localhost" HTTP_HDR_END_DELIM;
+    ck_assert_int_eq(http_parse_message(none, strlen(none), &msg, &content_len), 1);
+    ck_assert_int_eq(http_accepts(&msg, "image/webp"), 0);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 Suite *http_test_suite()
 {
@@ -300,6 +508,14 @@ Suite *http_test_suite()
     Add_Test(s, http_parse_message_full_headers_no_content);
     Add_Test(s, http_parse_message_full_headers_partial_content);
     Add_Test(s, http_parse_message_full_headers_full_content);
+    Add_Test(s, http_parse_message_pipelined);
+    Add_Test(s, http_parser_null_params);
+    Add_Test(s, http_parser_byte_by_byte);
+    Add_Test(s, http_parser_moved_stream);
+    Add_Test(s, http_parser_body_start_pipelined);
+
+    Add_Test(s, http_accepts_null_params);
+    Add_Test(s, http_accepts_media_types);
 
     return s;
 }
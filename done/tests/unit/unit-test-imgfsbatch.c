@@ -0,0 +1,259 @@
+#include "imgfs.h"
+#include "imgfs_batch.h"
+#include "test.h"
+#include <check.h>
+#include <string.h> // memset, strcpy
+#include <unistd.h> // usleep
+
+// What is on disk right now, through a second handle
+static void check_on_disk(const char* filename, uint16_t pic1_valid, uint32_t nb_files)
+{
+    struct imgfs_file other;
+    ck_assert_err_none(do_open(filename, "rb", &other));
+    ck_assert_int_eq(other.metadata[0].is_valid, pic1_valid);
+    ck_assert_int_eq(other.header.nb_files, nb_files);
+    do_close(&other);
+}
+
+// ======================================================================
+START_TEST(imgfs_batch_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_invalid_arg(imgfs_batch_begin(NULL, 10, 0));
+    ck_assert_invalid_arg(imgfs_batch_flush(NULL));
+    ck_assert_invalid_arg(imgfs_batch_end(NULL));
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_invalid_arg(imgfs_batch_begin(&file, 0, 0));
+    ck_assert_err_none(imgfs_batch_begin(&file, 10, 0));
+    ck_assert_invalid_arg(imgfs_batch_begin(&file, 10, 0));
+    ck_assert_err_none(imgfs_batch_end(&file));
+    ck_assert_ptr_null(file.batch);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_staged_until_flush)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 100, 0));
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_int_eq(file.header.nb_files, 1);
+    check_on_disk(dump, NON_EMPTY, 2);
+
+    ck_assert_err_none(imgfs_batch_flush(&file));
+    check_on_disk(dump, EMPTY, 1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_flush_on_count)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 2, 0));
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    check_on_disk(dump, NON_EMPTY, 2);
+
+    // Second entry: both written together
+    ck_assert_err_none(do_delete("pic2", &file));
+    struct imgfs_file other;
+    ck_assert_err_none(do_open(dump, "rb", &other));
+    ck_assert_int_eq(other.metadata[0].is_valid, EMPTY);
+    ck_assert_int_eq(other.metadata[1].is_valid, EMPTY);
+    do_close(&other);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_flush_on_close)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 100, 0));
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    do_close(&file);
+    ck_assert_ptr_null(file.batch);
+
+    check_on_disk(dump, EMPTY, 1);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_read_only)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 100, 0));
+
+    // Staged fine, but cannot be written
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_err(imgfs_batch_flush(&file), ERR_IO);
+
+    do_close(&file);
+    check_on_disk(dump, NON_EMPTY, 2);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_tick_after_interval)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open_mmap(dump, "rb+", &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 100, 50));
+    ck_assert_invalid_arg(imgfs_batch_tick(NULL));
+
+    // Nothing pending yet, then too recent
+    ck_assert_err_none(imgfs_batch_tick(&file));
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_err_none(imgfs_batch_tick(&file));
+
+    // No other write needed once the interval is over
+    usleep(100 * 1000);
+    ck_assert_err_none(imgfs_batch_tick(&file));
+    check_on_disk(dump, EMPTY, 1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_collect_then_sync)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open_mmap(dump, "rb+", &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 100, 50));
+
+    struct imgfs_batch_sync to_sync;
+    ck_assert_invalid_arg(imgfs_batch_collect(NULL, &to_sync));
+    ck_assert_invalid_arg(imgfs_batch_collect(&file, NULL));
+    ck_assert_invalid_arg(imgfs_batch_sync(NULL));
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    usleep(100 * 1000);
+    ck_assert_err_none(imgfs_batch_collect(&file, &to_sync));
+    // Header and first entry, left to sync
+    ck_assert_ptr_eq(to_sync.start, file.mapping);
+    ck_assert_uint_ge(to_sync.size, sizeof(struct imgfs_header) + sizeof(struct img_metadata));
+    ck_assert_err_none(imgfs_batch_sync(&to_sync));
+    check_on_disk(dump, EMPTY, 1);
+
+    // Nothing left
+    ck_assert_err_none(imgfs_batch_collect(&file, &to_sync));
+    ck_assert_uint_eq(to_sync.size, 0);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(imgfs_batch_hot_only_v2)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    memset(&file, 0, sizeof(file));
+    file.header.max_files = 10;
+    file.header.resized_res[2 * THUMB_RES] = file.header.resized_res[2 * THUMB_RES + 1] = 64;
+    file.header.resized_res[2 * SMALL_RES] = file.header.resized_res[2 * SMALL_RES + 1] = 256;
+    file.header.unused_32 = IMGFS_FORMAT_V2;
+    ck_assert_err_none(do_create(dump, &file));
+    ck_assert_err_none(imgfs_batch_begin(&file, 100, 0));
+
+    // Staged twice as hot only: the image ID stays as it is on disk
+    strcpy(file.metadata[0].img_id, "cold");
+    file.metadata[0].orig_res[0] = 12;
+    ck_assert_err_none(write_metadata_hot(&file, 0));
+    ck_assert_err_none(write_metadata_hot(&file, 0));
+    ck_assert_err_none(imgfs_batch_flush(&file));
+
+    struct imgfs_file other;
+    ck_assert_err_none(do_open(dump, "rb", &other));
+    ck_assert_uint_eq(other.metadata[0].orig_res[0], 12);
+    ck_assert_str_eq(other.metadata[0].img_id, "");
+    do_close(&other);
+
+    // A full write staged as well: all of it
+    ck_assert_err_none(write_metadata_hot(&file, 0));
+    ck_assert_err_none(write_metadata(&file, 0));
+    ck_assert_err_none(write_metadata_hot(&file, 0));
+    ck_assert_err_none(imgfs_batch_flush(&file));
+
+    ck_assert_err_none(do_open(dump, "rb", &other));
+    ck_assert_str_eq(other.metadata[0].img_id, "cold");
+    do_close(&other);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_batch_suite()
+{
+    Suite *s = suite_create("Tests for the batched metadata writes");
+
+    Add_Test(s, imgfs_batch_null_params);
+    Add_Test(s, imgfs_batch_staged_until_flush);
+    Add_Test(s, imgfs_batch_flush_on_count);
+    Add_Test(s, imgfs_batch_tick_after_interval);
+    Add_Test(s, imgfs_batch_collect_then_sync);
+    Add_Test(s, imgfs_batch_hot_only_v2);
+    Add_Test(s, imgfs_batch_flush_on_close);
+    Add_Test(s, imgfs_batch_read_only);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_batch_suite)
@@ -0,0 +1,207 @@
+#include "imgfs.h"
+#include "imgfs_codecs.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdlib.h> // malloc, free
+#include <vips/vips.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// ======================================================================
+START_TEST(codec_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    uint64_t offset;
+    uint32_t size;
+
+    ck_assert_str_eq(codec_content_type(CODEC_JPEG), "image/jpeg");
+    ck_assert_str_eq(codec_content_type(CODEC_WEBP), "image/webp");
+
+    ck_assert_invalid_arg(codec_variants_load(NULL));
+    ck_assert_invalid_arg(codec_variants_find(NULL, 0, THUMB_RES, &offset, &size));
+    ck_assert_invalid_arg(codec_variants_store(NULL, 0, THUMB_RES, "a", 1));
+    ck_assert_invalid_arg(codec_locate(NULL, &lock, "pic1", THUMB_RES, &offset, &size));
+    ck_assert_invalid_arg(codec_locate(&file, NULL, "pic1", THUMB_RES, &offset, &size));
+    ck_assert_invalid_arg(codec_locate(&file, &lock, NULL, THUMB_RES, &offset, &size));
+    ck_assert_invalid_arg(codec_locate(&file, &lock, "pic1", THUMB_RES, NULL, &size));
+    ck_assert_invalid_arg(codec_locate(&file, &lock, "pic1", THUMB_RES, &offset, NULL));
+    codec_variants_free(NULL);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(codec_find_none)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    uint64_t offset;
+    uint32_t size;
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_uint_eq(file.header.unused_64, 0);
+    ck_assert_ptr_null(file.codecs);
+
+    ck_assert_err(codec_variants_find(&file, 0, THUMB_RES, &offset, &size), ERR_IMAGE_NOT_FOUND);
+    ck_assert_err(codec_variants_find(&file, 0, ORIG_RES, &offset, &size), ERR_RESOLUTIONS);
+    ck_assert_err(codec_variants_find(&file, file.header.max_files, THUMB_RES, &offset, &size),
+                  ERR_INVALID_IMGID);
+    ck_assert_err(codec_locate(&file, &lock, "nope", THUMB_RES, &offset, &size), ERR_IMAGE_NOT_FOUND);
+    ck_assert_err(codec_locate(&file, &lock, "pic1", ORIG_RES, &offset, &size), ERR_RESOLUTIONS);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(codec_locate_creates_once)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    uint64_t offset, again_offset;
+    uint32_t size, again_size;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    const long size_before = file_size(dump);
+
+    ck_assert_err_none(codec_locate(&file, &lock, "pic1", THUMB_RES, &offset, &size));
+    ck_assert_uint_ne(file.header.unused_64, 0);
+    ck_assert_ptr_nonnull(file.codecs);
+    ck_assert_uint_gt(size, 0);
+    ck_assert_uint_ge(offset, (uint64_t) size_before);
+    // The JPEG variants are left alone
+    ck_assert_uint_eq(file.metadata[0].size[THUMB_RES], 0);
+    const long size_after = file_size(dump);
+
+    // Already created
+    ck_assert_err_none(codec_locate(&file, &lock, "pic1", THUMB_RES, &again_offset, &again_size));
+    ck_assert_uint_eq(again_offset, offset);
+    ck_assert_uint_eq(again_size, size);
+    ck_assert_int_eq(file_size(dump), size_after);
+    // Other resolution, other image: still to be created
+    ck_assert_err(codec_variants_find(&file, 0, SMALL_RES, &again_offset, &again_size), ERR_IMAGE_NOT_FOUND);
+    ck_assert_err(codec_variants_find(&file, 1, THUMB_RES, &again_offset, &again_size), ERR_IMAGE_NOT_FOUND);
+    do_close(&file);
+
+    // Found again when reopening
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_err_none(codec_variants_find(&file, 0, THUMB_RES, &again_offset, &again_size));
+    ck_assert_uint_eq(again_offset, offset);
+    ck_assert_uint_eq(again_size, size);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// What a variant holds, to be compared after it was moved
+static void* read_variant(struct imgfs_file* file, size_t index, int resolution, uint32_t* size)
+{
+    uint64_t offset;
+    ck_assert_err_none(codec_variants_find(file, index, resolution, &offset, size));
+    void* content = malloc(*size);
+    ck_assert_ptr_nonnull(content);
+    ck_assert_err_none(read_at(file, content, *size, offset));
+    return content;
+}
+
+// ======================================================================
+START_TEST(codec_kept_by_grow)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    uint64_t offset;
+    uint32_t size, size_after;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(codec_locate(&file, &lock, "pic2", SMALL_RES, &offset, &size));
+    void* before = read_variant(&file, 1, SMALL_RES, &size);
+
+    const uint32_t max_files = 2 * file.header.max_files;
+    ck_assert_err_none(do_grow(&file, max_files));
+    ck_assert_ptr_nonnull(file.codecs);
+    ck_assert_uint_ge(file.header.unused_64, sizeof(struct imgfs_header) + metadata_region_size(&file.header));
+    void* after = read_variant(&file, 1, SMALL_RES, &size_after);
+    ck_assert_uint_eq(size_after, size);
+    ck_assert_mem_eq(after, before, size);
+    free(after);
+
+    // Room for the new entries, and the same once opened again
+    do_close(&file);
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_uint_eq(file.header.max_files, max_files);
+    after = read_variant(&file, 1, SMALL_RES, &size_after);
+    ck_assert_mem_eq(after, before, size);
+    ck_assert_err(codec_variants_find(&file, 0, SMALL_RES, &offset, &size), ERR_IMAGE_NOT_FOUND);
+    free(after);
+    free(before);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(codec_kept_by_gbcollect)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DECLARE_DUMP_PREFIXED(_tmp);
+
+    struct imgfs_file file;
+    uint64_t offset;
+    uint32_t size, size_after;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(codec_locate(&file, &lock, "pic1", THUMB_RES, &offset, &size));
+    ck_assert_err_none(codec_locate(&file, &lock, "pic2", SMALL_RES, &offset, &size));
+    void* before = read_variant(&file, 1, SMALL_RES, &size);
+    ck_assert_err_none(do_delete("pic1", &file));
+    do_close(&file);
+
+    ck_assert_err_none(do_gbcollect(dump, dump_tmp));
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_ptr_nonnull(file.codecs);
+    void* after = read_variant(&file, 1, SMALL_RES, &size_after);
+    ck_assert_uint_eq(size_after, size);
+    ck_assert_mem_eq(after, before, size);
+    // Only the variants of the valid images are copied
+    ck_assert_uint_eq(file.codecs[0].size[THUMB_RES], 0);
+    free(after);
+    free(before);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_codecs_suite()
+{
+    Suite *s = suite_create("Tests for the variants in other codecs");
+
+    Add_Test(s, codec_null_params);
+    Add_Test(s, codec_find_none);
+    Add_Test(s, codec_locate_creates_once);
+    Add_Test(s, codec_kept_by_grow);
+    Add_Test(s, codec_kept_by_gbcollect);
+
+    return s;
+}
+
+TEST_SUITE_VIPS(imgfs_codecs_suite)
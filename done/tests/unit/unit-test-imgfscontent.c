@@ -2,6 +2,7 @@
 #include "imgfs.h"
 #include "test.h"
 #include <check.h>
+#include <string.h>
 #include <vips/vips.h>
 
 #if VIPS_MINOR_VERSION >= 15
@@ -262,6 +263,283 @@ START_TEST(lazily_resize_valid_fallible)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(resize_all_null_params)
+{
+    start_test_print;
+
+    ck_assert_invalid_arg(resize_all(NULL, 0));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_err(resize_all(&file, 3), ERR_INVALID_IMGID);
+    ck_assert_err(resize_all(&file, 218), ERR_INVALID_IMGID);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(resize_all_valid)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long size_before = ftell(file.file);
+
+    // Both created at once, stored one after the other
+    ck_assert_err_none(resize_all(&file, 1));
+    const struct img_metadata* md = &file.metadata[1];
+    ck_assert_uint_gt(md->size[THUMB_RES], 0);
+    ck_assert_uint_gt(md->size[SMALL_RES], 0);
+    ck_assert_uint_eq(md->offset[THUMB_RES], size_before);
+    ck_assert_uint_eq(md->offset[SMALL_RES], size_before + md->size[THUMB_RES]);
+
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long size_after = ftell(file.file);
+    ck_assert_int_eq(size_after, size_before + md->size[THUMB_RES] + md->size[SMALL_RES]);
+
+    // Nothing left to create
+    ck_assert_err_none(resize_all(&file, 1));
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    ck_assert_int_eq(ftell(file.file), size_after);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_gt(file.metadata[1].size[THUMB_RES], 0);
+    ck_assert_uint_gt(file.metadata[1].size[SMALL_RES], 0);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(lazily_resize_shared_content)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    char image[72876];
+    read_file(image, DATA_DIR "/papillon.jpg", 72876);
+
+    // Same content as pic1, which has no small variant yet
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(do_insert(image, 72876, "alias", &file));
+    ck_assert_uint_eq(file.metadata[0].size[SMALL_RES], 0);
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long size_before = ftell(file.file);
+
+    // Created once, for both
+    ck_assert_err_none(lazily_resize(SMALL_RES, &file, 2));
+    ck_assert_uint_gt(file.metadata[2].size[SMALL_RES], 0);
+    ck_assert_uint_eq(file.metadata[0].size[SMALL_RES], file.metadata[2].size[SMALL_RES]);
+    ck_assert_uint_eq(file.metadata[0].offset[SMALL_RES], file.metadata[2].offset[SMALL_RES]);
+    ck_assert_err_none(lazily_resize(SMALL_RES, &file, 0));
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    ck_assert_int_eq(ftell(file.file), size_before + (long) file.metadata[2].size[SMALL_RES]);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.metadata[0].offset[SMALL_RES], file.metadata[2].offset[SMALL_RES]);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(resize_source_quality_guard)
+{
+    start_test_print;
+
+    struct imgfs_header header;
+    memset(&header, 0, sizeof(header));
+    header.resized_res[2 * THUMB_RES] = header.resized_res[2 * THUMB_RES + 1] = 64;
+    header.resized_res[2 * SMALL_RES] = header.resized_res[2 * SMALL_RES + 1] = 256;
+    struct img_metadata md;
+    memset(&md, 0, sizeof(md));
+    md.size[ORIG_RES] = 72876;
+
+    ck_assert_int_eq(resize_source(NULL, &md, RES_BIT(THUMB_RES)), ORIG_RES);
+    ck_assert_int_eq(resize_source(&header, NULL, RES_BIT(THUMB_RES)), ORIG_RES);
+
+    // No variant stored yet
+    ck_assert_int_eq(resize_source(&header, &md, RES_BIT(THUMB_RES)), ORIG_RES);
+
+    md.size[SMALL_RES] = 16296;
+    ck_assert_int_eq(resize_source(&header, &md, RES_BIT(THUMB_RES)), SMALL_RES);
+    ck_assert_int_eq(resize_source(&header, &md, RES_BIT(SMALL_RES)), ORIG_RES);
+    ck_assert_int_eq(resize_source(&header, &md, RES_BIT(THUMB_RES) | RES_BIT(SMALL_RES)), ORIG_RES);
+
+    // Not large enough in one dimension
+    header.resized_res[2 * SMALL_RES + 1] = 127;
+    ck_assert_int_eq(resize_source(&header, &md, RES_BIT(THUMB_RES)), ORIG_RES);
+    header.resized_res[2 * SMALL_RES + 1] = 128;
+    ck_assert_int_eq(resize_source(&header, &md, RES_BIT(THUMB_RES)), SMALL_RES);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(resize_contents_params)
+{
+    start_test_print;
+
+    struct imgfs_header header;
+    memset(&header, 0, sizeof(header));
+    header.resized_res[2 * THUMB_RES] = header.resized_res[2 * THUMB_RES + 1] = 64;
+    header.resized_res[2 * SMALL_RES] = header.resized_res[2 * SMALL_RES + 1] = 100;
+    const char content[] = "content";
+    void* resized[NB_RES];
+    size_t sizes[NB_RES];
+
+    ck_assert_invalid_arg(resize_contents(NULL, RES_BIT(THUMB_RES), ORIG_RES, content, 1, resized, sizes));
+    ck_assert_invalid_arg(resize_contents(&header, RES_BIT(THUMB_RES), ORIG_RES, NULL, 1, resized, sizes));
+    ck_assert_err(resize_contents(&header, 0, ORIG_RES, content, 1, resized, sizes), ERR_RESOLUTIONS);
+    ck_assert_err(resize_contents(&header, RES_BIT(ORIG_RES), ORIG_RES, content, 1, resized, sizes),
+                  ERR_RESOLUTIONS);
+    ck_assert_err(resize_contents(&header, RES_BIT(THUMB_RES), NB_RES, content, 1, resized, sizes),
+                  ERR_RESOLUTIONS);
+
+    // Neither from itself nor from a variant less than twice as large
+    ck_assert_err(resize_contents(&header, RES_BIT(SMALL_RES), SMALL_RES, content, 1, resized, sizes),
+                  ERR_RESOLUTIONS);
+    ck_assert_err(resize_contents(&header, RES_BIT(THUMB_RES), SMALL_RES, content, 1, resized, sizes),
+                  ERR_RESOLUTIONS);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(lazily_resize_from_variant)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_int_eq(resize_source(&file.header, &file.metadata[0], RES_BIT(THUMB_RES)), ORIG_RES);
+
+    // The thumbnail then comes from the (four times larger) small variant
+    ck_assert_err_none(lazily_resize(SMALL_RES, &file, 0));
+    ck_assert_int_eq(resize_source(&file.header, &file.metadata[0], RES_BIT(THUMB_RES)), SMALL_RES);
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long size_before = ftell(file.file);
+
+    ck_assert_err_none(lazily_resize(THUMB_RES, &file, 0));
+    ck_assert_uint_gt(file.metadata[0].size[THUMB_RES], 0);
+    ck_assert_uint_lt(file.metadata[0].size[THUMB_RES], file.metadata[0].size[SMALL_RES]);
+    ck_assert_uint_eq(file.metadata[0].offset[THUMB_RES], size_before);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(resize_stored_streams)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    void* resized[NB_RES];
+    size_t sizes[NB_RES];
+    void* buffered[NB_RES];
+    size_t buffered_sizes[NB_RES];
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    const struct img_metadata* image = &file.metadata[0];
+
+    ck_assert_invalid_arg(resize_stored(NULL, &file.header, RES_BIT(THUMB_RES), ORIG_RES,
+                                        image->offset[ORIG_RES], image->size[ORIG_RES], resized, sizes));
+    ck_assert_invalid_arg(resize_stored(&file, NULL, RES_BIT(THUMB_RES), ORIG_RES,
+                                        image->offset[ORIG_RES], image->size[ORIG_RES], resized, sizes));
+    ck_assert_err(resize_stored(&file, &file.header, RES_BIT(ORIG_RES), ORIG_RES,
+                                image->offset[ORIG_RES], image->size[ORIG_RES], resized, sizes), ERR_RESOLUTIONS);
+    // Not an image there
+    ck_assert_err(resize_stored(&file, &file.header, RES_BIT(THUMB_RES), ORIG_RES,
+                                0, image->size[ORIG_RES], resized, sizes), ERR_IMGLIB);
+
+    // Same as from the whole content in memory
+    ck_assert_err_none(resize_stored(&file, &file.header, RES_BIT(THUMB_RES) | RES_BIT(SMALL_RES), ORIG_RES,
+                                     image->offset[ORIG_RES], image->size[ORIG_RES], resized, sizes));
+    void* original = malloc(image->size[ORIG_RES]);
+    ck_assert_ptr_nonnull(original);
+    ck_assert_err_none(read_at(&file, original, image->size[ORIG_RES], image->offset[ORIG_RES]));
+    ck_assert_err_none(resize_contents(&file.header, RES_BIT(THUMB_RES) | RES_BIT(SMALL_RES), ORIG_RES,
+                                       original, image->size[ORIG_RES], buffered, buffered_sizes));
+    for (int res = THUMB_RES; res < ORIG_RES; ++res) {
+        ck_assert_uint_gt(sizes[res], 0);
+        ck_assert_uint_eq(sizes[res], buffered_sizes[res]);
+        ck_assert_mem_eq(resized[res], buffered[res], sizes[res]);
+        g_free(resized[res]);
+        g_free(buffered[res]);
+    }
+
+    free(original);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(resize_stored_content_codecs)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    void* resized = NULL;
+    size_t size = 0;
+    void* buffered = NULL;
+    size_t buffered_size = 0;
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    const struct img_metadata* image = &file.metadata[0];
+
+    ck_assert_invalid_arg(resize_stored_content(NULL, image->offset[ORIG_RES], image->size[ORIG_RES],
+                                                64, 64, CODEC_JPEG, &resized, &size));
+    ck_assert_invalid_arg(resize_stored_content(&file, image->offset[ORIG_RES], image->size[ORIG_RES],
+                                                64, 64, CODEC_JPEG, NULL, &size));
+    ck_assert_err(resize_stored_content(&file, image->offset[ORIG_RES], image->size[ORIG_RES],
+                                        0, 64, CODEC_JPEG, &resized, &size), ERR_RESOLUTIONS);
+    ck_assert_invalid_arg(resize_stored_content(&file, image->offset[ORIG_RES], image->size[ORIG_RES],
+                                                64, 64, NB_CODECS, &resized, &size));
+
+    // Same as from the whole content in memory, in both codecs
+    void* original = malloc(image->size[ORIG_RES]);
+    ck_assert_ptr_nonnull(original);
+    ck_assert_err_none(read_at(&file, original, image->size[ORIG_RES], image->offset[ORIG_RES]));
+    for (int codec = CODEC_JPEG; codec < NB_CODECS; ++codec) {
+        ck_assert_err_none(resize_stored_content(&file, image->offset[ORIG_RES], image->size[ORIG_RES],
+                                                 200, 150, (enum image_codec) codec, &resized, &size));
+        ck_assert_err_none(resize_content(original, image->size[ORIG_RES], 200, 150, (enum image_codec) codec,
+                                          &buffered, &buffered_size));
+        ck_assert_uint_gt(size, 0);
+        ck_assert_uint_eq(size, buffered_size);
+        ck_assert_mem_eq(resized, buffered, size);
+        g_free(resized);
+        g_free(buffered);
+    }
+
+    free(original);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 Suite *imgfs_content_test_suite()
 {
@@ -275,6 +553,14 @@ Suite *imgfs_content_test_suite()
     Add_Test(s, lazily_resize_already_exists);
     Add_Test(s, lazily_resize_valid);
     Add_Test(s, lazily_resize_valid_fallible);
+    Add_Test(s, resize_all_null_params);
+    Add_Test(s, resize_all_valid);
+    Add_Test(s, lazily_resize_shared_content);
+    Add_Test(s, resize_source_quality_guard);
+    Add_Test(s, resize_contents_params);
+    Add_Test(s, lazily_resize_from_variant);
+    Add_Test(s, resize_stored_streams);
+    Add_Test(s, resize_stored_content_codecs);
 
     return s;
 }
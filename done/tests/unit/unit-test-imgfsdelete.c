@@ -81,6 +81,56 @@ START_TEST(do_delete_correct)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(do_delete_mmap_read_only)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open_mmap(dump, "rb", &file));
+
+    ck_assert_err(do_delete("pic1", &file), ERR_IO);
+
+    do_close(&file);
+
+    // Private mapping: nothing reached the disk
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_int_eq(file.metadata[0].is_valid, NON_EMPTY);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_delete_mmap_correct)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open_mmap(dump, "rb+", &file));
+
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_int_eq(file.header.version, 3);
+    ck_assert_int_eq(file.header.nb_files, 1);
+
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_int_eq(file.metadata[0].is_valid, EMPTY);
+    ck_assert_int_eq(file.header.version, 3);
+    ck_assert_int_eq(file.header.nb_files, 1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 START_TEST(do_delete_bad_open_mode)
 {
@@ -179,6 +229,8 @@ Suite *imgfs_do_delete_test_suite()
     Add_Test(s, do_delete_read_only);
     Add_Test(s, do_delete_cmd_not_enough_arguments);
     Add_Test(s, do_delete_correct);
+    Add_Test(s, do_delete_mmap_read_only);
+    Add_Test(s, do_delete_mmap_correct);
     Add_Test(s, do_delete_bad_open_mode);
     Add_Test(s, do_delete_cmd_null_params);
     Add_Test(s, do_delete_cmd_image_not_found);
@@ -0,0 +1,207 @@
+#include "imgfs.h"
+#include "imgfs_index.h"
+#include "test.h"
+#include <check.h>
+#include <string.h>
+#include <vips/vips.h>
+
+#define V2_ENTRY_SIZE (sizeof(struct img_metadata_hot) + MAX_IMG_ID + 1 + SHA256_DIGEST_LENGTH)
+
+// A v2 imgFS containing papillon.jpg as "pic1"
+static void create_v2(const char* filename, char* image)
+{
+    struct imgfs_file file;
+    memset(&file, 0, sizeof(file));
+    file.header.max_files = 10;
+    file.header.resized_res[2 * THUMB_RES] = file.header.resized_res[2 * THUMB_RES + 1] = 64;
+    file.header.resized_res[2 * SMALL_RES] = file.header.resized_res[2 * SMALL_RES + 1] = 256;
+    file.header.unused_32 = IMGFS_FORMAT_V2;
+
+    read_file(image, DATA_DIR "/papillon.jpg", 72876);
+    ck_assert_err_none(do_create(filename, &file));
+    ck_assert_err_none(do_insert(image, 72876, "pic1", &file));
+    do_close(&file);
+}
+
+// ======================================================================
+START_TEST(format_v2_create_and_read)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char image[72876];
+    create_v2(dump, image);
+    ck_assert_int_eq(file_size(dump), (long) (sizeof(struct imgfs_header) + 10 * V2_ENTRY_SIZE + 72876));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.unused_32, IMGFS_FORMAT_V2);
+    ck_assert_uint_eq(metadata_region_size(&file.header), 10 * V2_ENTRY_SIZE);
+    ck_assert_int_eq(file.header.nb_files, 1);
+    ck_assert_int_eq(file.metadata[0].is_valid, NON_EMPTY);
+    ck_assert_str_eq(file.metadata[0].img_id, "pic1");
+    ck_assert_uint_eq(file.metadata[0].offset[ORIG_RES], sizeof(struct imgfs_header) + 10 * V2_ENTRY_SIZE);
+
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("pic1", ORIG_RES, &buffer, &size, &file));
+    ck_assert_uint_eq(size, 72876);
+    ck_assert_mem_eq(buffer, image, size);
+
+    free(buffer);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(format_v2_delete)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char image[72876];
+    create_v2(dump, image);
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(do_delete("pic1", &file));
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_int_eq(file.header.nb_files, 0);
+    ck_assert_int_eq(file.metadata[0].is_valid, EMPTY);
+    // Only the hot part was rewritten
+    ck_assert_str_eq(file.metadata[0].img_id, "pic1");
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(format_v2_hot_array)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char image[72876];
+    create_v2(dump, image);
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_ptr_nonnull(file.hot);
+    ck_assert_int_eq(file.hot[0].is_valid, NON_EMPTY);
+    ck_assert_uint_eq(file.hot[0].offset[ORIG_RES], file.metadata[0].offset[ORIG_RES]);
+    ck_assert_uint_eq(file.hot[0].size[ORIG_RES], 72876);
+    ck_assert_int_eq(file.hot[1].is_valid, EMPTY);
+
+    // The scans see the deletion
+    ck_assert_err_none(do_delete("pic1", &file));
+    ck_assert_int_eq(file.hot[0].is_valid, EMPTY);
+    ck_assert_int_eq(empty_slots_first(&file), 0);
+
+    // and the insertion
+    ck_assert_err_none(do_insert(image, 72876, "pic2", &file));
+    ck_assert_int_eq(file.hot[0].is_valid, NON_EMPTY);
+    ck_assert_uint_eq(file.hot[0].offset[ORIG_RES], file.metadata[0].offset[ORIG_RES]);
+    do_close(&file);
+
+    // Format v1 has none
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_ptr_null(file.hot);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(format_v2_open_mmap)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char image[72876];
+    create_v2(dump, image);
+
+    // Not mapped, but usable all the same
+    struct imgfs_file file;
+    ck_assert_err_none(do_open_mmap(dump, "rb+", &file));
+    ck_assert_ptr_null(file.mapping);
+    ck_assert_str_eq(file.metadata[0].img_id, "pic1");
+    ck_assert_err_none(do_delete("pic1", &file));
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_int_eq(file.metadata[0].is_valid, EMPTY);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(format_v2_gbcollect)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DECLARE_DUMP_PREFIXED(_tmp);
+
+    char image[72876];
+    create_v2(dump, image);
+
+    ck_assert_err_none(do_gbcollect(dump, dump_tmp));
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.unused_32, IMGFS_FORMAT_V2);
+
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("pic1", ORIG_RES, &buffer, &size, &file));
+    ck_assert_uint_eq(size, 72876);
+    ck_assert_mem_eq(buffer, image, size);
+
+    free(buffer);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(format_v1_unchanged)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_uint_eq(file.header.unused_32, IMGFS_FORMAT_V1);
+    ck_assert_uint_eq(metadata_region_size(&file.header),
+                      file.header.max_files * sizeof(struct img_metadata));
+    ck_assert_str_eq(file.metadata[0].img_id, "pic1");
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_format_suite()
+{
+    Suite *s = suite_create("Tests for the on-disk formats of ImgFS");
+
+    Add_Test(s, format_v2_create_and_read);
+    Add_Test(s, format_v2_delete);
+    Add_Test(s, format_v2_hot_array);
+    Add_Test(s, format_v2_open_mmap);
+    Add_Test(s, format_v2_gbcollect);
+    Add_Test(s, format_v1_unchanged);
+
+    return s;
+}
+
+TEST_SUITE_VIPS(imgfs_format_suite)
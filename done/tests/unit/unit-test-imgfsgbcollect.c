@@ -0,0 +1,136 @@
+#include "imgfs.h"
+#include "test.h"
+#include <check.h>
+#include <unistd.h>
+#include <vips/vips.h>
+
+// ======================================================================
+START_TEST(do_gbcollect_null_params)
+{
+    start_test_print;
+
+    ck_assert_invalid_arg(do_gbcollect(NULL, "tmp"));
+    ck_assert_invalid_arg(do_gbcollect("imgfs", NULL));
+    ck_assert_err(do_gbcollect("not a file", DATA_DIR "dump-not-created.imgfs"), ERR_IO);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_gbcollect_nothing_to_reclaim)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DECLARE_DUMP_PREFIXED(_tmp);
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    const long before = file_size(dump);
+
+    ck_assert_err_none(do_gbcollect(dump, dump_tmp));
+    ck_assert_int_eq(file_size(dump), before);
+    ck_assert_int_eq(access(dump_tmp, F_OK), -1);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_gbcollect_after_delete)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DECLARE_DUMP_PREFIXED(_tmp);
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    // Keep pic2 for reference
+    char* expected;
+    uint32_t expected_size;
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(do_read("pic2", ORIG_RES, &expected, &expected_size, &file));
+    const uint32_t pic1_size = file.metadata[0].size[ORIG_RES];
+    ck_assert_err_none(do_delete("pic1", &file));
+    const uint32_t version = file.header.version;
+    do_close(&file);
+
+    const long before = file_size(dump);
+    ck_assert_err_none(do_gbcollect(dump, dump_tmp));
+    ck_assert_int_eq(file_size(dump), before - pic1_size);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_int_eq(file.header.nb_files, 1);
+    ck_assert_int_eq(file.header.version, version + 1);
+    ck_assert_int_eq(file.metadata[0].is_valid, EMPTY);
+
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("pic2", ORIG_RES, &buffer, &size, &file));
+    ck_assert_uint_eq(size, expected_size);
+    ck_assert_mem_eq(buffer, expected, size);
+
+    free(buffer);
+    free(expected);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_gbcollect_keeps_shared_content)
+{
+    start_test_print;
+    DECLARE_DUMP;
+    DECLARE_DUMP_PREFIXED(_tmp);
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+
+    // Same content as pic1, under another name
+    char image[72876];
+    read_file(image, DATA_DIR "/papillon.jpg", 72876);
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(do_insert(image, 72876, "alias", &file));
+    ck_assert_err_none(do_delete("pic2", &file));
+    do_close(&file);
+
+    ck_assert_err_none(do_gbcollect(dump, dump_tmp));
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_int_eq(file.header.nb_files, 2);
+    ck_assert_uint_eq(file.metadata[2].offset[ORIG_RES], file.metadata[0].offset[ORIG_RES]);
+
+    // A single copy left
+    ck_assert_int_eq(file_size(dump), (long) (sizeof(struct imgfs_header)
+                                              + file.header.max_files * sizeof(struct img_metadata)
+                                              + 72876));
+
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("alias", ORIG_RES, &buffer, &size, &file));
+    ck_assert_uint_eq(size, 72876);
+    ck_assert_mem_eq(buffer, image, size);
+
+    free(buffer);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_gbcollect_suite()
+{
+    Suite *s = suite_create("Tests for the garbage collection of ImgFS");
+
+    Add_Test(s, do_gbcollect_null_params);
+    Add_Test(s, do_gbcollect_nothing_to_reclaim);
+    Add_Test(s, do_gbcollect_after_delete);
+    Add_Test(s, do_gbcollect_keeps_shared_content);
+
+    return s;
+}
+
+TEST_SUITE_VIPS(imgfs_gbcollect_suite)
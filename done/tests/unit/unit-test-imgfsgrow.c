@@ -0,0 +1,218 @@
+#include "imgfs.h"
+#include "test.h"
+#include <check.h>
+#include <string.h>
+#include <vips/vips.h>
+
+// Both images of test02 still read as before
+static void check_contents(struct imgfs_file* file, const char* pic1, uint32_t pic1_size)
+{
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("pic1", ORIG_RES, &buffer, &size, file));
+    ck_assert_uint_eq(size, pic1_size);
+    ck_assert_mem_eq(buffer, pic1, size);
+    free(buffer);
+
+    ck_assert_err_none(do_read("pic2", ORIG_RES, &buffer, &size, file));
+    ck_assert_uint_eq(size, file->metadata[1].size[ORIG_RES]);
+    free(buffer);
+}
+
+// ======================================================================
+START_TEST(do_grow_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_invalid_arg(do_grow(NULL, 100));
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_err(do_grow(&file, file.header.max_files), ERR_MAX_FILES);
+    ck_assert_err(do_grow(&file, 1), ERR_MAX_FILES);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_read_only)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    const uint32_t max_files = file.header.max_files;
+    ck_assert_err(do_grow(&file, max_files * 2), ERR_IO);
+    ck_assert_uint_eq(file.header.max_files, max_files);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.max_files, max_files);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_moves_contents)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char pic1[72876];
+    read_file(pic1, DATA_DIR "/papillon.jpg", 72876);
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    const uint32_t version = file.header.version;
+    const uint32_t max_files = file.header.max_files * 100;
+
+    ck_assert_err_none(do_grow(&file, max_files));
+    ck_assert_uint_eq(file.header.max_files, max_files);
+    ck_assert_uint_eq(file.header.nb_files, 2);
+    ck_assert_uint_eq(file.header.version, version + 1);
+    check_contents(&file, pic1, 72876);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.max_files, max_files);
+    const uint64_t data_start = sizeof(struct imgfs_header) + metadata_region_size(&file.header);
+    ck_assert_uint_ge(file.metadata[0].offset[ORIG_RES], data_start);
+    ck_assert_uint_ge(file.metadata[1].offset[ORIG_RES], data_start);
+    ck_assert_int_eq(file.metadata[max_files - 1].is_valid, EMPTY);
+    check_contents(&file, pic1, 72876);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_when_full)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char image[72876];
+    read_file(image, DATA_DIR "/papillon.jpg", 72876);
+
+    struct imgfs_file file;
+    memset(&file, 0, sizeof(file));
+    file.header.max_files = 1;
+    file.header.resized_res[2 * THUMB_RES] = file.header.resized_res[2 * THUMB_RES + 1] = 64;
+    file.header.resized_res[2 * SMALL_RES] = file.header.resized_res[2 * SMALL_RES + 1] = 256;
+    ck_assert_err_none(do_create(dump, &file));
+    ck_assert_err_none(do_insert(image, 72876, "pic1", &file));
+    ck_assert_err(do_insert(image, 72876, "pic2", &file), ERR_IMGFS_FULL);
+
+    ck_assert_err_none(do_grow(&file, 4));
+    ck_assert_err_none(do_insert(image, 72876, "pic2", &file));
+    ck_assert_uint_eq(file.metadata[1].offset[ORIG_RES], file.metadata[0].offset[ORIG_RES]);
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.nb_files, 2);
+
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("pic2", ORIG_RES, &buffer, &size, &file));
+    ck_assert_uint_eq(size, 72876);
+    ck_assert_mem_eq(buffer, image, size);
+    free(buffer);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_mmap)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char pic1[72876];
+    read_file(pic1, DATA_DIR "/papillon.jpg", 72876);
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open_mmap(dump, "rb+", &file));
+    const uint32_t max_files = file.header.max_files * 2;
+
+    ck_assert_err_none(do_grow(&file, max_files));
+    ck_assert_ptr_nonnull(file.mapping);
+    ck_assert_uint_eq(file.mapping_size, sizeof(struct imgfs_header) + max_files * sizeof(struct img_metadata));
+    check_contents(&file, pic1, 72876);
+    ck_assert_err_none(do_delete("pic2", &file));
+    do_close(&file);
+
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.max_files, max_files);
+    ck_assert_int_eq(file.metadata[1].is_valid, EMPTY);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_grow_format_v2)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    char image[72876];
+    read_file(image, DATA_DIR "/papillon.jpg", 72876);
+
+    struct imgfs_file file;
+    memset(&file, 0, sizeof(file));
+    file.header.max_files = 2;
+    file.header.resized_res[2 * THUMB_RES] = file.header.resized_res[2 * THUMB_RES + 1] = 64;
+    file.header.resized_res[2 * SMALL_RES] = file.header.resized_res[2 * SMALL_RES + 1] = 256;
+    file.header.unused_32 = IMGFS_FORMAT_V2;
+    ck_assert_err_none(do_create(dump, &file));
+    ck_assert_err_none(do_insert(image, 72876, "pic1", &file));
+    ck_assert_err(do_grow(&file, 50), NOT_IMPLEMENTED);
+    ck_assert_uint_eq(file.header.max_files, 2);
+    do_close(&file);
+
+    // Left as it was
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_eq(file.header.unused_32, IMGFS_FORMAT_V2);
+    ck_assert_uint_eq(file.header.max_files, 2);
+    ck_assert_str_eq(file.metadata[0].img_id, "pic1");
+
+    char* buffer;
+    uint32_t size;
+    ck_assert_err_none(do_read("pic1", ORIG_RES, &buffer, &size, &file));
+    ck_assert_uint_eq(size, 72876);
+    ck_assert_mem_eq(buffer, image, size);
+    free(buffer);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_grow_suite()
+{
+    Suite *s = suite_create("Tests for growing an ImgFS");
+
+    Add_Test(s, do_grow_null_params);
+    Add_Test(s, do_grow_read_only);
+    Add_Test(s, do_grow_moves_contents);
+    Add_Test(s, do_grow_when_full);
+    Add_Test(s, do_grow_mmap);
+    Add_Test(s, do_grow_format_v2);
+
+    return s;
+}
+
+TEST_SUITE_VIPS(imgfs_grow_suite)
@@ -0,0 +1,285 @@
+#include "imgfs.h"
+#include "imgfs_index.h"
+#include "test.h"
+#include <check.h>
+
+// ======================================================================
+START_TEST(name_index_null_params)
+{
+    start_test_print;
+
+    ck_assert_invalid_arg(name_index_build(NULL));
+    ck_assert_int_eq(name_index_find(NULL, "pic1"), -1);
+    ck_assert_invalid_arg(content_index_build(NULL));
+    ck_assert_int_eq(content_index_find(NULL, NULL), -1);
+
+    name_index_free(NULL);
+    name_index_remove(NULL, 0);
+    content_index_free(NULL);
+    content_index_remove(NULL, 0);
+    ck_assert_invalid_arg(empty_slots_build(NULL));
+    ck_assert_int_eq(empty_slots_first(NULL), -1);
+    empty_slots_free(NULL);
+    empty_slots_take(NULL, 0);
+    empty_slots_release(NULL, 0);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(name_index_built_on_open)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    ck_assert_ptr_nonnull(file.name_index);
+    ck_assert_int_eq(name_index_find(&file, "pic1"), 0);
+    ck_assert_int_eq(name_index_find(&file, "pic2"), 1);
+    ck_assert_int_eq(name_index_find(&file, "pic3"), -1);
+
+    do_close(&file);
+    ck_assert_ptr_null(file.name_index);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(name_index_skips_invalid)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    // Invalidated behind the index's back: must not be found anymore
+    file.metadata[0].is_valid = EMPTY;
+    ck_assert_int_eq(name_index_find(&file, "pic1"), -1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(name_index_add_remove)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    strcpy(file.metadata[5].img_id, "pic5");
+    file.metadata[5].is_valid = NON_EMPTY;
+    ck_assert_int_eq(name_index_find(&file, "pic5"), -1);
+
+    ck_assert_err_none(name_index_add(&file, 5));
+    ck_assert_int_eq(name_index_find(&file, "pic5"), 5);
+
+    name_index_remove(&file, 5);
+    ck_assert_int_eq(name_index_find(&file, "pic5"), -1);
+    ck_assert_int_eq(name_index_find(&file, "pic1"), 0);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(name_index_many_updates)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    // Enough add/remove cycles to force the tombstones to be cleaned up
+    for (uint32_t round = 0; round < 1000; ++round) {
+        const uint32_t slot = 2 + round % 50;
+        snprintf(file.metadata[slot].img_id, MAX_IMG_ID + 1, "img%u", round);
+        file.metadata[slot].is_valid = NON_EMPTY;
+        ck_assert_err_none(name_index_add(&file, slot));
+        ck_assert_int_eq(name_index_find(&file, file.metadata[slot].img_id), slot);
+        name_index_remove(&file, slot);
+        file.metadata[slot].is_valid = EMPTY;
+    }
+    ck_assert_int_eq(name_index_find(&file, "pic2"), 1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(content_index_built_on_open)
+{
+    start_test_print;
+
+    const unsigned char pic1_sha[] = {0x66, 0xac, 0x64, 0x8b, 0x32, 0xa8, 0x26, 0x8e, 0xd0, 0xb3, 0x50,
+                                      0xb1, 0x84, 0xcf, 0xa0, 0x4c, 0x00, 0xc6, 0x23, 0x6a, 0xf3, 0xa2,
+                                      0xaa, 0x44, 0x11, 0xc0, 0x15, 0x18, 0xf6, 0x06, 0x1a, 0xf8
+                                     };
+    const unsigned char zero_sha[SHA256_DIGEST_LENGTH] = {0};
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    ck_assert_ptr_nonnull(file.content_index);
+    ck_assert_int_eq(content_index_find(&file, pic1_sha), 0);
+    ck_assert_int_eq(content_index_find(&file, file.metadata[1].SHA), 1);
+    ck_assert_int_eq(content_index_find(&file, zero_sha), -1);
+
+    do_close(&file);
+    ck_assert_ptr_null(file.content_index);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(content_index_shared_content)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    // Second image with the same content as pic1
+    memcpy(&file.metadata[4], &file.metadata[0], sizeof(struct img_metadata));
+    strcpy(file.metadata[4].img_id, "alias");
+    ck_assert_err_none(content_index_add(&file, 4));
+
+    // Either is fine while both are valid; the remaining one afterwards
+    const int found = content_index_find(&file, file.metadata[0].SHA);
+    ck_assert(found == 0 || found == 4);
+
+    content_index_remove(&file, 0);
+    file.metadata[0].is_valid = EMPTY;
+    ck_assert_int_eq(content_index_find(&file, file.metadata[4].SHA), 4);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(content_index_all_aliases)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    memcpy(&file.metadata[4], &file.metadata[0], sizeof(struct img_metadata));
+    strcpy(file.metadata[4].img_id, "alias");
+    ck_assert_err_none(content_index_add(&file, 4));
+
+    // Both, in any order, with or without the index
+    for (int indexed = 1; indexed >= 0; --indexed) {
+        if (!indexed) content_index_free(&file);
+        uint32_t cursor = 0;
+        int seen = 0;
+        for (int slot; (slot = content_index_next(&file, file.metadata[0].SHA, &cursor)) != -1; ) {
+            ck_assert(slot == 0 || slot == 4);
+            seen |= 1 << slot;
+        }
+        ck_assert_int_eq(seen, (1 << 0) | (1 << 4));
+        ck_assert_int_eq(content_index_next(&file, file.metadata[0].SHA, &cursor), -1);
+    }
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(empty_slots_first_free)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    ck_assert_ptr_nonnull(file.empty_slots);
+    ck_assert_int_eq(empty_slots_first(&file), 2);
+
+    empty_slots_take(&file, 2);
+    file.metadata[2].is_valid = NON_EMPTY;
+    ck_assert_int_eq(empty_slots_first(&file), 3);
+
+    // Released slots are handed out again, lowest first
+    file.metadata[0].is_valid = EMPTY;
+    empty_slots_release(&file, 0);
+    ck_assert_int_eq(empty_slots_first(&file), 0);
+
+    do_close(&file);
+    ck_assert_ptr_null(file.empty_slots);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(empty_slots_full)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("full"), "rb", &file));
+
+    ck_assert_int_eq(empty_slots_first(&file), -1);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(empty_slots_filled_behind_back)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    // Slots filled without telling the bitmap are skipped
+    for (uint32_t i = 2; i < 70; ++i) {
+        file.metadata[i].is_valid = NON_EMPTY;
+    }
+    ck_assert_int_eq(empty_slots_first(&file), 70);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_index_suite()
+{
+    Suite *s = suite_create("Tests for the in-memory indexes");
+
+    Add_Test(s, name_index_null_params);
+    Add_Test(s, name_index_built_on_open);
+    Add_Test(s, name_index_skips_invalid);
+    Add_Test(s, name_index_add_remove);
+    Add_Test(s, name_index_many_updates);
+    Add_Test(s, content_index_built_on_open);
+    Add_Test(s, content_index_shared_content);
+    Add_Test(s, content_index_all_aliases);
+    Add_Test(s, empty_slots_first_free);
+    Add_Test(s, empty_slots_full);
+    Add_Test(s, empty_slots_filled_behind_back);
+
+    return s;
+}
+
+TEST_SUITE(imgfs_index_suite)
@@ -1,4 +1,5 @@
 #include "imgfs.h"
+#include "imgfs_index.h"
 #include "test.h"
 #include <check.h>
 #include <string.h>
@@ -95,8 +96,20 @@ START_TEST(do_insert_invalid_file_mode)
     ck_assert_err_none(do_open(dump, "rb", &file));
     read_file(image, DATA_DIR "/papillon.jpg", 72876);
 
+    const uint32_t nb_files = file.header.nb_files;
+    const uint32_t version = file.header.version;
     ck_assert_err(do_insert(image, 72876, "pic3", &file), ERR_IO);
 
+    // Nothing recorded, not even in memory
+    ck_assert_uint_eq(file.header.nb_files, nb_files);
+    ck_assert_uint_eq(file.header.version, version);
+    for (uint32_t i = 0; i < file.header.max_files; ++i) {
+        ck_assert_str_ne(file.metadata[i].img_id, "pic3");
+    }
+    char* buffer = NULL;
+    uint32_t size = 0;
+    ck_assert_err(do_read("pic3", ORIG_RES, &buffer, &size, &file), ERR_IMAGE_NOT_FOUND);
+
     do_close(&file);
 
     end_test_print;
@@ -338,6 +351,188 @@ START_TEST(do_insert_write_initializes_metadata)
 }
 END_TEST
 
+// ======================================================================
+// A content read in parts of at most part bytes, or stopped at limit
+struct memory_reader {
+    const char* content;
+    size_t size;
+    size_t position;
+    size_t part;
+    size_t limit;
+};
+
+static int read_memory(void* arg, void* buffer, size_t size, size_t* read)
+{
+    struct memory_reader* reader = arg;
+    size_t len = reader->limit - reader->position;
+    if (len > size) len = size;
+    if (len > reader->part) len = reader->part;
+    memcpy(buffer, reader->content + reader->position, len);
+    reader->position += len;
+    *read = len;
+    return ERR_NONE;
+}
+
+// The three steps, as the server takes them
+static int insert_streamed(struct imgfs_file* file, const char* img_id, size_t size,
+                           struct memory_reader* reader)
+{
+    uint64_t offset = 0;
+    int err = do_insert_reserve(file, img_id, size, &offset);
+    if (err != ERR_NONE) return err;
+
+    unsigned char SHA[SHA256_DIGEST_LENGTH];
+    uint32_t width = 0;
+    uint32_t height = 0;
+    err = do_insert_stream(file, offset, size, read_memory, reader, SHA, &width, &height);
+    if (err != ERR_NONE) {
+        release_data(file, offset, size);
+        return err;
+    }
+    return do_insert_commit(file, img_id, SHA, size, width, height, offset);
+}
+
+// ======================================================================
+START_TEST(do_insert_streamed_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    struct memory_reader reader;
+    uint64_t offset;
+    unsigned char SHA[SHA256_DIGEST_LENGTH] = {0};
+    uint32_t width;
+    uint32_t height;
+
+    ck_assert_invalid_arg(do_insert_reserve(NULL, "pic3", 1, &offset));
+    file.metadata = NULL;
+    ck_assert_invalid_arg(do_insert_reserve(&file, "pic3", 1, &offset));
+    ck_assert_invalid_arg(do_insert_commit(&file, "pic3", SHA, 1, 1, 1, 0));
+    file.metadata = (struct img_metadata*) &reader;
+    ck_assert_invalid_arg(do_insert_reserve(&file, NULL, 1, &offset));
+    ck_assert_invalid_arg(do_insert_reserve(&file, "pic3", 1, NULL));
+    ck_assert_invalid_arg(do_insert_reserve(&file, "pic3", 0, &offset));
+
+    ck_assert_invalid_arg(do_insert_stream(NULL, 0, 1, read_memory, &reader, SHA, &width, &height));
+    ck_assert_invalid_arg(do_insert_stream(&file, 0, 1, NULL, &reader, SHA, &width, &height));
+    ck_assert_invalid_arg(do_insert_stream(&file, 0, 1, read_memory, &reader, NULL, &width, &height));
+    ck_assert_invalid_arg(do_insert_stream(&file, 0, 1, read_memory, &reader, SHA, NULL, &height));
+    ck_assert_invalid_arg(do_insert_stream(&file, 0, 1, read_memory, &reader, SHA, &width, NULL));
+    ck_assert_invalid_arg(do_insert_stream(&file, 0, 0, read_memory, &reader, SHA, &width, &height));
+
+    ck_assert_invalid_arg(do_insert_commit(NULL, "pic3", SHA, 1, 1, 1, 0));
+    ck_assert_invalid_arg(do_insert_commit(&file, NULL, SHA, 1, 1, 1, 0));
+    ck_assert_invalid_arg(do_insert_commit(&file, "pic3", NULL, 1, 1, 1, 0));
+    ck_assert_invalid_arg(do_insert_commit(&file, "pic3", SHA, 0, 1, 1, 0));
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_insert_streamed_valid)
+{
+    start_test_print;
+
+    DECLARE_DUMP;
+    char image[82234];
+    struct imgfs_file file;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    read_file(image, DATA_DIR "/brouillard.jpg", 82234);
+
+    // In parts unlike the ones written
+    struct memory_reader reader = { image, sizeof(image), 0, 1000, sizeof(image) };
+    ck_assert_err_none(insert_streamed(&file, "pic3", sizeof(image), &reader));
+    ck_assert_uint_eq(reader.position, sizeof(image));
+
+    const int index = name_index_find(&file, "pic3");
+    ck_assert_int_ne(index, -1);
+    const struct img_metadata *md = &file.metadata[index];
+    unsigned char pic_sha[SHA256_DIGEST_LENGTH] = {0xf8, 0x88, 0xf0, 0xdd, 0xd4, 0xf8, 0x24, 0x75, 0x99, 0xf6, 0xde,
+                                                   0x79, 0x7e, 0x0a, 0x6f, 0x55, 0x76, 0xd3, 0xd1, 0xe7, 0x41, 0x97,
+                                                   0xd3, 0x3d, 0xac, 0x09, 0x08, 0x94, 0xdb, 0x07, 0xbf, 0x1e
+                                                  };
+    ck_assert_mem_eq(md->SHA, pic_sha, SHA256_DIGEST_LENGTH);
+    ck_assert_int_eq(md->orig_res[0], 600);
+    ck_assert_int_eq(md->orig_res[1], 400);
+    ck_assert_int_eq(md->size[ORIG_RES], 82234);
+    ck_assert_int_eq(md->offset[ORIG_RES], 192659);
+    ck_assert_int_eq(md->is_valid, NON_EMPTY);
+    ck_assert_int_eq(file.header.nb_files, 3);
+
+    char stored[82234];
+    ck_assert_err_none(read_at(&file, stored, sizeof(stored), md->offset[ORIG_RES]));
+    ck_assert_mem_eq(stored, image, sizeof(image));
+    do_close(&file);
+    ck_assert_int_eq(file_size(dump), 192659 + 82234);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_insert_streamed_duplicate)
+{
+    start_test_print;
+
+    DECLARE_DUMP;
+    char image[82234];
+    struct imgfs_file file;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    read_file(image, DATA_DIR "/brouillard.jpg", 82234);
+
+    struct memory_reader reader = { image, sizeof(image), 0, sizeof(image), sizeof(image) };
+    ck_assert_err_none(insert_streamed(&file, "pic3", sizeof(image), &reader));
+    const long size_after = file_size(dump);
+
+    // Same content: stored once, the space reserved for it given back
+    reader.position = 0;
+    ck_assert_err_none(insert_streamed(&file, "pic4", sizeof(image), &reader));
+    ck_assert_int_eq(file_size(dump), size_after);
+    ck_assert_int_eq(file.metadata[name_index_find(&file, "pic4")].offset[ORIG_RES],
+                     file.metadata[name_index_find(&file, "pic3")].offset[ORIG_RES]);
+
+    // Same ID: refused before reading anything
+    reader.position = 0;
+    ck_assert_err(insert_streamed(&file, "pic4", sizeof(image), &reader), ERR_DUPLICATE_ID);
+    ck_assert_uint_eq(reader.position, 0);
+    ck_assert_int_eq(file.header.nb_files, 4);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_insert_streamed_short)
+{
+    start_test_print;
+
+    DECLARE_DUMP;
+    char image[82234];
+    struct imgfs_file file;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    read_file(image, DATA_DIR "/brouillard.jpg", 82234);
+    const long size_before = file_size(dump);
+
+    // The client stops before the announced size
+    struct memory_reader reader = { image, sizeof(image), 0, 4096, sizeof(image) / 2 };
+    ck_assert_err(insert_streamed(&file, "pic3", sizeof(image), &reader), ERR_IO);
+    ck_assert_int_eq(name_index_find(&file, "pic3"), -1);
+    ck_assert_int_eq(file.header.nb_files, 2);
+    ck_assert_int_eq(file_size(dump), size_before);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 Suite *imgfs_content_test_suite()
 {
@@ -352,6 +547,10 @@ Suite *imgfs_content_test_suite()
     Add_Test(s, do_insert_valid);
     Add_Test(s, do_insert_write_correct_metadata);
     Add_Test(s, do_insert_write_initializes_metadata);
+    Add_Test(s, do_insert_streamed_null_params);
+    Add_Test(s, do_insert_streamed_valid);
+    Add_Test(s, do_insert_streamed_duplicate);
+    Add_Test(s, do_insert_streamed_short);
 
     return s;
 }
@@ -74,6 +74,61 @@ START_TEST(do_read_valid)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(do_read_ignores_file_cursor)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    char expected_buffer[72876];
+    char *buffer;
+    uint32_t size;
+
+    read_file(expected_buffer, DATA_DIR "/papillon.jpg", 72876);
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    // Reads are positional: wherever the stream cursor is does not matter
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long end = ftell(file.file);
+
+    ck_assert_err_none(do_read("pic1", ORIG_RES, &buffer, &size, &file));
+    ck_assert_int_eq(size, 72876);
+    ck_assert_mem_eq(expected_buffer, buffer, 72876);
+    ck_assert_int_eq(ftell(file.file), end);
+
+    free(buffer);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_locate_valid)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    uint64_t offset;
+    uint32_t size;
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+
+    ck_assert_invalid_arg(do_locate("pic1", ORIG_RES, NULL, &size, &file));
+    ck_assert_invalid_arg(do_locate("pic1", ORIG_RES, &offset, NULL, &file));
+    ck_assert_err(do_locate("pic1", 3, &offset, &size, &file), ERR_RESOLUTIONS);
+    ck_assert_err(do_locate("pic3", ORIG_RES, &offset, &size, &file), ERR_IMAGE_NOT_FOUND);
+
+    ck_assert_err_none(do_locate("pic1", ORIG_RES, &offset, &size, &file));
+    ck_assert_uint_eq(offset, file.metadata[0].offset[ORIG_RES]);
+    ck_assert_uint_eq(size, 72876);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 START_TEST(do_read_resize)
 {
@@ -142,6 +197,8 @@ Suite *imgfs_read_test_suite()
     Add_Test(s, do_read_null_params);
     Add_Test(s, do_read_not_found);
     Add_Test(s, do_read_valid);
+    Add_Test(s, do_read_ignores_file_cursor);
+    Add_Test(s, do_locate_valid);
     Add_Test(s, do_read_resize);
     Add_Test(s, do_read_resize_invalid_mode);
 
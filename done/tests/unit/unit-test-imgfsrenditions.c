@@ -0,0 +1,190 @@
+#include "imgfs.h"
+#include "imgfs_renditions.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <string.h>
+#include <vips/vips.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const unsigned char SHA_A[SHA256_DIGEST_LENGTH] = { 0xA };
+static const unsigned char SHA_B[SHA256_DIGEST_LENGTH] = { 0xB };
+
+// ======================================================================
+START_TEST(rendition_cache_null_params)
+{
+    start_test_print;
+
+    struct rendition_cache* cache;
+    void* content;
+    size_t size;
+    int resolution;
+    struct imgfs_file file;
+
+    ck_assert_invalid_arg(rendition_cache_create(NULL, 100));
+    ck_assert_invalid_arg(rendition_cache_create(&cache, 0));
+    ck_assert_err_none(rendition_cache_create(&cache, 100));
+
+    ck_assert_invalid_arg(rendition_cache_get(NULL, SHA_A, 1, 1, &content, &size));
+    ck_assert_invalid_arg(rendition_cache_get(cache, NULL, 1, 1, &content, &size));
+    ck_assert_invalid_arg(rendition_cache_put(NULL, SHA_A, 1, 1, "a", 1));
+    ck_assert_invalid_arg(rendition_cache_put(cache, SHA_A, 1, 1, NULL, 1));
+    ck_assert_invalid_arg(rendition_read(NULL, &file, &lock, "pic1", 1, 1, &resolution, &content, &size));
+    ck_assert_invalid_arg(rendition_read(cache, NULL, &lock, "pic1", 1, 1, &resolution, &content, &size));
+    ck_assert_invalid_arg(rendition_read(cache, &file, NULL, "pic1", 1, 1, &resolution, &content, &size));
+    ck_assert_invalid_arg(rendition_read(cache, &file, &lock, NULL, 1, 1, &resolution, &content, &size));
+    ck_assert_uint_eq(rendition_cache_used(NULL), 0);
+
+    rendition_cache_free(cache);
+    rendition_cache_free(NULL);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(rendition_cache_lru_eviction)
+{
+    start_test_print;
+
+    struct rendition_cache* cache;
+    char data[200];
+    memset(data, 'x', sizeof(data));
+    void* content;
+    size_t size;
+
+    ck_assert_err_none(rendition_cache_create(&cache, 100));
+    ck_assert_err(rendition_cache_get(cache, SHA_A, 10, 10, &content, &size), ERR_IMAGE_NOT_FOUND);
+
+    // Same content, other sizes, and same size, other content: all different
+    ck_assert_err_none(rendition_cache_put(cache, SHA_A, 10, 10, data, 40));
+    ck_assert_err_none(rendition_cache_put(cache, SHA_A, 20, 10, data, 30));
+    ck_assert_err(rendition_cache_get(cache, SHA_B, 10, 10, &content, &size), ERR_IMAGE_NOT_FOUND);
+    ck_assert_uint_eq(rendition_cache_used(cache), 70);
+
+    // Used last, so kept
+    ck_assert_err_none(rendition_cache_get(cache, SHA_A, 10, 10, &content, &size));
+    ck_assert_uint_eq(size, 40);
+    ck_assert_mem_eq(content, data, size);
+    free(content);
+
+    ck_assert_err_none(rendition_cache_put(cache, SHA_B, 10, 10, data, 40));
+    ck_assert_uint_eq(rendition_cache_used(cache), 80);
+    ck_assert_err(rendition_cache_get(cache, SHA_A, 20, 10, &content, &size), ERR_IMAGE_NOT_FOUND);
+    ck_assert_err_none(rendition_cache_get(cache, SHA_A, 10, 10, &content, &size));
+    free(content);
+    ck_assert_err_none(rendition_cache_get(cache, SHA_B, 10, 10, &content, &size));
+    free(content);
+
+    // Larger than the whole cache: not kept, nothing evicted
+    ck_assert_err_none(rendition_cache_put(cache, SHA_B, 50, 50, data, 200));
+    ck_assert_err(rendition_cache_get(cache, SHA_B, 50, 50, &content, &size), ERR_IMAGE_NOT_FOUND);
+    ck_assert_uint_eq(rendition_cache_used(cache), 80);
+
+    rendition_cache_free(cache);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(rendition_read_stored)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    struct rendition_cache* cache;
+    void* content = NULL;
+    size_t size = 0;
+    int resolution;
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_err_none(rendition_cache_create(&cache, 1 << 20));
+
+    ck_assert_err(rendition_read(cache, &file, &lock, "nope", 100, 100, &resolution, &content, &size),
+                  ERR_IMAGE_NOT_FOUND);
+    ck_assert_err(rendition_read(cache, &file, &lock, "pic1", 0, 100, &resolution, &content, &size),
+                  ERR_RESOLUTIONS);
+
+    // The box of a resolution of the header
+    ck_assert_err_none(rendition_read(cache, &file, &lock, "pic1",
+                                      file.header.resized_res[2 * SMALL_RES],
+                                      file.header.resized_res[2 * SMALL_RES + 1],
+                                      &resolution, &content, &size));
+    ck_assert_int_eq(resolution, SMALL_RES);
+    ck_assert_ptr_null(content);
+
+    // Never upscaled
+    ck_assert_err_none(rendition_read(cache, &file, &lock, "pic1", 4000, 4000, &resolution, &content, &size));
+    ck_assert_int_eq(resolution, ORIG_RES);
+    ck_assert_ptr_null(content);
+    ck_assert_uint_eq(rendition_cache_used(cache), 0);
+
+    rendition_cache_free(cache);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(rendition_read_cached)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    struct rendition_cache* cache;
+    int resolution;
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long size_before = ftell(file.file);
+    ck_assert_err_none(rendition_cache_create(&cache, 1 << 20));
+
+    void* first = NULL;
+    size_t first_size = 0;
+    ck_assert_err_none(rendition_read(cache, &file, &lock, "pic1", 100, 90, &resolution, &first, &first_size));
+    ck_assert_int_eq(resolution, -1);
+    ck_assert_ptr_nonnull(first);
+    ck_assert_uint_gt(first_size, 0);
+    ck_assert_uint_eq(rendition_cache_used(cache), first_size);
+
+    // Served from the cache, and never stored in the file
+    void* second = NULL;
+    size_t second_size = 0;
+    ck_assert_err_none(rendition_read(cache, &file, &lock, "pic1", 100, 90, &resolution, &second, &second_size));
+    ck_assert_int_eq(resolution, -1);
+    ck_assert_uint_eq(second_size, first_size);
+    ck_assert_mem_eq(second, first, first_size);
+    ck_assert_uint_eq(rendition_cache_used(cache), first_size);
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    ck_assert_int_eq(ftell(file.file), size_before);
+    ck_assert_uint_eq(file.metadata[0].size[THUMB_RES], 0);
+    ck_assert_uint_eq(file.metadata[0].size[SMALL_RES], 0);
+
+    free(first);
+    free(second);
+    rendition_cache_free(cache);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_renditions_suite()
+{
+    Suite *s = suite_create("Tests for the renditions of any size");
+
+    Add_Test(s, rendition_cache_null_params);
+    Add_Test(s, rendition_cache_lru_eviction);
+    Add_Test(s, rendition_read_stored);
+    Add_Test(s, rendition_read_cached);
+
+    return s;
+}
+
+TEST_SUITE_VIPS(imgfs_renditions_suite)
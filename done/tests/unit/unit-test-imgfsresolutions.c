@@ -52,6 +52,31 @@ START_TEST(get_resolution_valid)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(get_resolution_header_only)
+{
+    start_test_print;
+
+    // Up to the frame header of a progressive JPEG, nothing to decode
+    const unsigned char header[] = {
+        0xFF, 0xD8,                                     // SOI
+        0xFF, 0xE0, 0x00, 0x04, 'J', 'F',               // APP0
+        0xFF, 0xFF,                                     // fill bytes
+        0xFF, 0xC2, 0x00, 0x0B, 0x08, 0x00, 0x2D, 0x00, // SOF2: 45 x 123
+        0x7B, 0x01, 0x01, 0x11, 0x00,
+        0xFF, 0xDA                                      // SOS, truncated
+    };
+
+    uint32_t height = 0, width = 0;
+    ck_assert_err_none(get_resolution(&height, &width, (const char*) header, sizeof(header)));
+
+    ck_assert_uint_eq(height, 45);
+    ck_assert_uint_eq(width, 123);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 Suite *imgfs_get_resolution_test_suite()
 {
@@ -60,6 +85,7 @@ Suite *imgfs_get_resolution_test_suite()
     Add_Test(s, get_resolution_null);
     Add_Test(s, get_resolution_invalid_buffer);
     Add_Test(s, get_resolution_valid);
+    Add_Test(s, get_resolution_header_only);
 
     return s;
 }
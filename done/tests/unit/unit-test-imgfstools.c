@@ -3,6 +3,7 @@
 #include "test.h"
 #include "util.h"
 #include <check.h>
+#include <unistd.h> // for truncate()
 
 START_TEST(do_open_null_params)
 {
@@ -111,6 +112,100 @@ START_TEST(do_open_correct_metadata)
 }
 END_TEST
 
+// ======================================================================
+START_TEST(do_open_mmap_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+
+    ck_assert_invalid_arg(do_open_mmap(NULL, "rb", &file));
+    ck_assert_invalid_arg(do_open_mmap("asdf", NULL, &file));
+    ck_assert_invalid_arg(do_open_mmap("asdf", "rb", NULL));
+    ck_assert_err(do_open_mmap("not a file", "rb", &file), ERR_IO);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_open_mmap_same_as_do_open)
+{
+    start_test_print;
+
+    struct imgfs_file read_file;
+    struct imgfs_file mapped_file;
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &read_file));
+    ck_assert_err_none(do_open_mmap(IMGFS("test02"), "rb", &mapped_file));
+
+    ck_assert_ptr_nonnull(mapped_file.mapping);
+    ck_assert_ptr_eq(mapped_file.metadata, (char*) mapped_file.mapping + sizeof(struct imgfs_header));
+    ck_assert_mem_eq(&mapped_file.header, &read_file.header, sizeof(struct imgfs_header));
+    ck_assert_mem_eq(mapped_file.metadata, read_file.metadata,
+                     read_file.header.max_files * sizeof(struct img_metadata));
+
+    do_close(&read_file);
+    do_close(&mapped_file);
+    ck_assert_ptr_null(mapped_file.mapping);
+    ck_assert_ptr_null(mapped_file.metadata);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(do_open_mmap_truncated)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    // Header complete, but the metadata array is cut short
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_int_eq(truncate(dump, sizeof(struct imgfs_header) + sizeof(struct img_metadata)), 0);
+
+    struct imgfs_file file;
+    ck_assert_err(do_open_mmap(dump, "rb", &file), ERR_IO);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(read_at_write_at)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+
+    char buffer[sizeof(struct imgfs_header)];
+    ck_assert_invalid_arg(read_at(NULL, buffer, sizeof(buffer), 0));
+    ck_assert_invalid_arg(read_at(&file, NULL, sizeof(buffer), 0));
+    ck_assert_invalid_arg(write_at(NULL, buffer, sizeof(buffer), 0));
+
+    ck_assert_err_none(read_at(&file, buffer, sizeof(buffer), 0));
+    ck_assert_mem_eq(buffer, &file.header, sizeof(buffer));
+
+    // Reading past the end of the file fails
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const uint64_t end = (uint64_t) ftell(file.file);
+    ck_assert_err(read_at(&file, buffer, 2, end - 1), ERR_IO);
+
+    uint64_t offset = 0;
+    ck_assert_err_none(append_data(&file, "abcd", 4, &offset));
+    ck_assert_uint_eq(offset, end);
+    ck_assert_err_none(write_at(&file, "xy", 2, end + 1));
+    ck_assert_err_none(read_at(&file, buffer, 4, end));
+    ck_assert_mem_eq(buffer, "axyd", 4);
+
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
 // ======================================================================
 START_TEST(do_close_null_param)
 {
@@ -128,6 +223,7 @@ START_TEST(do_close_null_file)
     start_test_print;
 
     struct imgfs_file file;
+    zero_init_var(file);
     file.file = NULL;
     file.metadata = malloc(sizeof(struct img_metadata));
 
@@ -147,6 +243,10 @@ Suite *imgfs_tools_suite_RES()
     Add_Test(s, do_open_invalid_mode);
     Add_Test(s, do_open_correct_header);
     Add_Test(s, do_open_correct_metadata);
+    Add_Test(s, do_open_mmap_null_params);
+    Add_Test(s, do_open_mmap_same_as_do_open);
+    Add_Test(s, do_open_mmap_truncated);
+    Add_Test(s, read_at_write_at);
 
     Add_Test(s, do_close_null_param);
     Add_Test(s, do_close_null_file);
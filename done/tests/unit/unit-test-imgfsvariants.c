@@ -0,0 +1,227 @@
+#include "imgfs.h"
+#include "imgfs_variants.h"
+#include "test.h"
+#include <check.h>
+#include <pthread.h>
+#include <vips/vips.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define NB_READERS 8
+
+struct reader {
+    struct variant_pool* pool;
+    uint64_t offset;
+    uint32_t size;
+    int err;
+};
+
+static void* read_small(void* arg)
+{
+    struct reader* reader = arg;
+    reader->err = variant_pool_locate(reader->pool, "pic2", SMALL_RES, &reader->offset, &reader->size);
+    return NULL;
+}
+
+// ======================================================================
+START_TEST(variant_policy_atoi_values)
+{
+    start_test_print;
+
+    ck_assert_int_eq(variant_policy_atoi("lazy"), VARIANT_LAZY);
+    ck_assert_int_eq(variant_policy_atoi("eager"), VARIANT_EAGER);
+    ck_assert_int_eq(variant_policy_atoi("never"), VARIANT_NEVER);
+    ck_assert_int_eq(variant_policy_atoi("sometimes"), -1);
+    ck_assert_int_eq(variant_policy_atoi(NULL), -1);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(variant_pool_null_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    struct variant_pool* pool;
+    const enum variant_policy policies[NB_RES] = { VARIANT_LAZY, VARIANT_LAZY, VARIANT_LAZY };
+
+    ck_assert_invalid_arg(variant_pool_start(NULL, &file, &lock, policies, 1));
+    ck_assert_invalid_arg(variant_pool_start(&pool, NULL, &lock, policies, 1));
+    ck_assert_invalid_arg(variant_pool_start(&pool, &file, NULL, policies, 1));
+    ck_assert_invalid_arg(variant_pool_start(&pool, &file, &lock, NULL, 1));
+    ck_assert_invalid_arg(variant_pool_start(&pool, &file, &lock, policies, 0));
+    ck_assert_invalid_arg(variant_pool_submit(NULL, 0));
+    variant_pool_stop(NULL);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(variant_pool_resolution_policies)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    struct variant_pool* pool;
+    const enum variant_policy policies[NB_RES] = { VARIANT_NEVER, VARIANT_EAGER, VARIANT_NEVER };
+
+    ck_assert_int_eq(variant_pool_resolution(NULL, THUMB_RES), THUMB_RES);
+
+    ck_assert_err_none(variant_pool_start(&pool, &file, &lock, policies, 1));
+    ck_assert_int_eq(variant_pool_resolution(pool, THUMB_RES), ORIG_RES);
+    ck_assert_int_eq(variant_pool_resolution(pool, SMALL_RES), SMALL_RES);
+    ck_assert_int_eq(variant_pool_resolution(pool, ORIG_RES), ORIG_RES);
+    variant_pool_stop(pool);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(variant_pool_creates_eager)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    struct variant_pool* pool;
+    const enum variant_policy policies[NB_RES] = { VARIANT_LAZY, VARIANT_EAGER, VARIANT_LAZY };
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_uint_eq(file.metadata[1].size[SMALL_RES], 0);
+    const uint32_t thumb_size = file.metadata[1].size[THUMB_RES];
+
+    ck_assert_err_none(variant_pool_start(&pool, &file, &lock, policies, 2));
+    ck_assert_err_none(variant_pool_submit(pool, 1));
+    variant_pool_wait(pool);
+    variant_pool_stop(pool);
+
+    ck_assert_uint_gt(file.metadata[1].size[SMALL_RES], 0);
+    ck_assert_uint_eq(file.metadata[1].size[THUMB_RES], thumb_size);
+    do_close(&file);
+
+    // On disk as well
+    ck_assert_err_none(do_open(dump, "rb", &file));
+    ck_assert_uint_gt(file.metadata[1].size[SMALL_RES], 0);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(variant_pool_skips_deleted)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    struct variant_pool* pool;
+    const enum variant_policy policies[NB_RES] = { VARIANT_EAGER, VARIANT_EAGER, VARIANT_LAZY };
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_err_none(do_delete("pic2", &file));
+
+    ck_assert_err_none(variant_pool_start(&pool, &file, &lock, policies, 1));
+    ck_assert_err_none(variant_pool_submit(pool, 1));
+    variant_pool_wait(pool);
+    variant_pool_stop(pool);
+
+    ck_assert_uint_eq(file.metadata[1].size[SMALL_RES], 0);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(variant_pool_locate_params)
+{
+    start_test_print;
+
+    struct imgfs_file file;
+    struct variant_pool* pool;
+    const enum variant_policy policies[NB_RES] = { VARIANT_LAZY, VARIANT_LAZY, VARIANT_LAZY };
+    uint64_t offset;
+    uint32_t size;
+
+    ck_assert_err_none(do_open(IMGFS("test02"), "rb", &file));
+    ck_assert_err_none(variant_pool_start(&pool, &file, &lock, policies, 1));
+    ck_assert_invalid_arg(variant_pool_locate(NULL, "pic1", ORIG_RES, &offset, &size));
+    ck_assert_invalid_arg(variant_pool_locate(pool, NULL, ORIG_RES, &offset, &size));
+    ck_assert_err(variant_pool_locate(pool, "pic1", NB_RES, &offset, &size), ERR_RESOLUTIONS);
+    ck_assert_err(variant_pool_locate(pool, "nope", ORIG_RES, &offset, &size), ERR_IMAGE_NOT_FOUND);
+
+    ck_assert_err_none(variant_pool_locate(pool, "pic1", ORIG_RES, &offset, &size));
+    ck_assert_uint_eq(offset, file.metadata[0].offset[ORIG_RES]);
+    ck_assert_uint_eq(size, file.metadata[0].size[ORIG_RES]);
+    variant_pool_stop(pool);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+START_TEST(variant_pool_locate_single_flight)
+{
+    start_test_print;
+    DECLARE_DUMP;
+
+    struct imgfs_file file;
+    struct variant_pool* pool;
+    const enum variant_policy policies[NB_RES] = { VARIANT_LAZY, VARIANT_LAZY, VARIANT_LAZY };
+
+    DUPLICATE_FILE(dump, IMGFS("test02"));
+    ck_assert_err_none(do_open(dump, "rb+", &file));
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    const long size_before = ftell(file.file);
+
+    ck_assert_err_none(variant_pool_start(&pool, &file, &lock, policies, 1));
+    pthread_t threads[NB_READERS];
+    struct reader readers[NB_READERS];
+    for (int i = 0; i < NB_READERS; ++i) {
+        readers[i].pool = pool;
+        ck_assert_int_eq(pthread_create(&threads[i], NULL, read_small, &readers[i]), 0);
+    }
+    for (int i = 0; i < NB_READERS; ++i) {
+        ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+    }
+    variant_pool_stop(pool);
+
+    // All served the same, single, copy
+    for (int i = 0; i < NB_READERS; ++i) {
+        ck_assert_err_none(readers[i].err);
+        ck_assert_uint_eq(readers[i].offset, file.metadata[1].offset[SMALL_RES]);
+        ck_assert_uint_eq(readers[i].size, file.metadata[1].size[SMALL_RES]);
+    }
+    ck_assert_int_eq(fseek(file.file, 0, SEEK_END), 0);
+    ck_assert_int_eq(ftell(file.file), size_before + (long) file.metadata[1].size[SMALL_RES]);
+    do_close(&file);
+
+    end_test_print;
+}
+END_TEST
+
+// ======================================================================
+Suite *imgfs_variants_suite()
+{
+    Suite *s = suite_create("Tests for the background creation of variants");
+
+    Add_Test(s, variant_policy_atoi_values);
+    Add_Test(s, variant_pool_null_params);
+    Add_Test(s, variant_pool_resolution_policies);
+    Add_Test(s, variant_pool_creates_eager);
+    Add_Test(s, variant_pool_skips_deleted);
+    Add_Test(s, variant_pool_locate_params);
+    Add_Test(s, variant_pool_locate_single_flight);
+
+    return s;
+}
+
+TEST_SUITE_VIPS(imgfs_variants_suite)